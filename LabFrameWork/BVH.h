@@ -0,0 +1,172 @@
+#pragma once
+
+/*
+	Bounding volume hierarchy built on the CPU and flattened for the compute shaders.
+
+	Nodes are stored depth first: an interior node's left child is the next node and
+	`leftFirst` holds the right child, a leaf's `leftFirst` is the first primitive of a
+	contiguous range of `count` primitives in `order`. Splits use a binned surface area
+	heuristic over the primitive centroids.
+
+	The shaders walk a tree with a fixed stack of BVH_STACK_SIZE (32) nodes, and a walk
+	keeps at most depth + 1 nodes pending: one sibling per level above, plus both
+	children of the deepest node. Nodes past MAX_DEPTH therefore become leaves, however
+	many primitives they hold.
+*/
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+#include "glm/glm.hpp"
+
+struct AABB {
+	glm::vec3 min;
+	glm::vec3 max;
+
+	AABB() : min(std::numeric_limits<float>::max()), max(-std::numeric_limits<float>::max()) {}
+	AABB(const glm::vec3& lo, const glm::vec3& hi) : min(lo), max(hi) {}
+
+	void grow(const glm::vec3& p) { min = glm::min(min, p); max = glm::max(max, p); }
+	void grow(const AABB& b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+	glm::vec3 center() const { return (min + max) * 0.5f; }
+	float area() const
+	{
+		if (min.x > max.x) return 0;
+		glm::vec3 d = max - min;
+		return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+};
+
+// std430 layout, mirrored by the shaders
+struct BVHNode {
+	glm::vec3 min;
+	int leftFirst;
+	glm::vec3 max;
+	int count;
+};
+
+class BVH
+{
+public:
+	// Deepest a leaf goes, the root is at 0. A leaf there holds every primitive left under
+	// it, so its count has no bound: code packing counts into fewer bits must check them,
+	// like RayTracingScene::uploadScene() does.
+	static const int MAX_DEPTH = 30;
+
+	std::vector<BVHNode> nodes;
+	std::vector<int> order;         /// primitive index for every leaf slot
+
+	// Builds over one box per primitive. Leaves aim for maxLeafSize primitives, the SAH
+	// may keep up to four times that in a leaf when splitting them costs more.
+	void build(const std::vector<AABB>& boxes, int maxLeafSize = 4)
+	{
+		nodes.clear();
+		order.resize(boxes.size());
+		for (size_t i = 0; i < order.size(); i++) order[i] = (int)i;
+		if (boxes.empty()) return;
+
+		m_boxes = &boxes;
+		m_maxLeafSize = std::max(1, maxLeafSize);
+		nodes.reserve(boxes.size() * 2);
+		buildNode(0, (int)boxes.size(), 0);
+		m_boxes = NULL;
+	}
+
+private:
+	static const int BIN_COUNT = 12;
+	const std::vector<AABB>* m_boxes;
+	int m_maxLeafSize;
+
+	int buildNode(int first, int count, int depth)
+	{
+		const std::vector<AABB>& boxes = *m_boxes;
+		int index = (int)nodes.size();
+		nodes.push_back(BVHNode());
+
+		AABB bounds, centroids;
+		for (int i = first; i < first + count; i++) {
+			bounds.grow(boxes[order[i]]);
+			centroids.grow(boxes[order[i]].center());
+		}
+		nodes[index].min = bounds.min;
+		nodes[index].max = bounds.max;
+
+		int axis;
+		float split;
+		int leftCount = count / 2;
+		if (depth >= MAX_DEPTH) {
+			nodes[index].leftFirst = first;
+			nodes[index].count = count;
+			return index;
+		}
+		if (count > m_maxLeafSize && findSplit(first, count, bounds, centroids, axis, split)) {
+			int* mid = std::partition(&order[first], &order[first] + count,
+				[&](int p) { return boxes[p].center()[axis] < split; });
+			leftCount = (int)(mid - &order[first]);
+			if (leftCount == 0 || leftCount == count) leftCount = count / 2;
+		}
+		else if (count <= 4 * m_maxLeafSize) {
+			// a leaf is cheaper, unless it would be huge because the centroids all coincide
+			nodes[index].leftFirst = first;
+			nodes[index].count = count;
+			return index;
+		}
+
+		nodes[index].count = 0;
+		buildNode(first, leftCount, depth + 1);
+		int right = buildNode(first + leftCount, count - leftCount, depth + 1);
+		nodes[index].leftFirst = right;
+		return index;
+	}
+
+	// Cheapest binned SAH split, false when keeping the leaf is cheaper
+	bool findSplit(int first, int count, const AABB& bounds, const AABB& centroids, int& bestAxis, float& bestSplit) const
+	{
+		const std::vector<AABB>& boxes = *m_boxes;
+		float bestCost = std::numeric_limits<float>::max();
+
+		for (int axis = 0; axis < 3; axis++) {
+			float lo = centroids.min[axis], hi = centroids.max[axis];
+			if (hi <= lo) continue;
+
+			AABB binBounds[BIN_COUNT];
+			int binCount[BIN_COUNT] = { 0 };
+			float scale = BIN_COUNT / (hi - lo);
+			for (int i = first; i < first + count; i++) {
+				const AABB& b = boxes[order[i]];
+				int bin = std::min(BIN_COUNT - 1, (int)((b.center()[axis] - lo) * scale));
+				binBounds[bin].grow(b);
+				binCount[bin]++;
+			}
+
+			// sweep from the right, then from the left evaluating every plane between bins
+			float rightArea[BIN_COUNT - 1];
+			int rightCount[BIN_COUNT - 1];
+			AABB right;
+			int rightSum = 0;
+			for (int i = BIN_COUNT - 1; i > 0; i--) {
+				right.grow(binBounds[i]);
+				rightSum += binCount[i];
+				rightArea[i - 1] = right.area();
+				rightCount[i - 1] = rightSum;
+			}
+			AABB left;
+			int leftSum = 0;
+			for (int i = 0; i < BIN_COUNT - 1; i++) {
+				left.grow(binBounds[i]);
+				leftSum += binCount[i];
+				float cost = leftSum * left.area() + rightCount[i] * rightArea[i];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = lo + (i + 1) / scale;
+				}
+			}
+		}
+
+		// a traversal step costs about as much as one intersection test
+		float area = bounds.area();
+		return bestCost < std::numeric_limits<float>::max() && area > 0 && bestCost / area + 1 < count;
+	}
+};
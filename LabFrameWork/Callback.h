@@ -1,6 +1,7 @@
 #pragma once
 #include <GLFW/glfw3.h>
 #include "RayTracingScene.h"
+#include "GpuProfiler.h"
 
 double cx, cy;
 bool lbutton_down;
@@ -9,6 +10,13 @@ bool mbutton_down;
 float m_lastMouseX;
 float m_lastMouseY;
 int m_width, m_height;
+bool renderModeKey;
+bool compareKey;
+bool recordKey;
+bool wavefrontKey;
+bool hybridKey;
+bool reflectionKey;
+bool refreshNeeded;
 
 class Callback
 {
@@ -28,6 +36,13 @@ public:
 		m_height = height;
 	}
 
+	// The window system lost the window's contents, e.g. uncovered or restored: present
+	// again even though the scene did not change
+	static void window_refresh_callback(GLFWwindow* window)
+	{
+		refreshNeeded = true;
+	}
+
 	static void cursor_pos_callback(GLFWwindow* window, double xpos, double ypos)
 	{
 		cx = xpos;
@@ -98,6 +113,38 @@ public:
 		m_lastMouseY = (float)cy;
 	}
 
+	// The scene keys pressed since the last call
+	void handleKeys()
+	{
+		if (renderModeKey) {
+			// full rate, checkerboard, quarter
+			RenderMode mode = scene->renderMode();
+			scene->setRenderMode(mode == RENDER_FULL_RATE ? RENDER_CHECKERBOARD : mode == RENDER_CHECKERBOARD ? RENDER_QUARTER : RENDER_FULL_RATE);
+			std::cout << "Render mode " << scene->renderMode() << std::endl;
+			renderModeKey = false;
+		}
+		if (compareKey) {
+			scene->compareWithFullRate();
+			compareKey = false;
+		}
+		if (wavefrontKey) {
+			scene->setWavefront(!scene->wavefront());
+			std::cout << (scene->wavefront() ? "Wavefront tracing" : "One invocation per pixel") << std::endl;
+			wavefrontKey = false;
+		}
+		if (hybridKey) {
+			scene->setHybrid(!scene->hybrid());
+			std::cout << (scene->hybrid() ? "Rasterized primary hits" : "Traced primary rays") << std::endl;
+			hybridKey = false;
+		}
+		if (reflectionKey) {
+			// 1, 2, 4
+			scene->setReflectionScale(scene->reflectionScale() == 4 ? 1 : scene->reflectionScale() * 2);
+			std::cout << "Reflection scale " << scene->reflectionScale() << std::endl;
+			reflectionKey = false;
+		}
+	}
+
 	static void error_callback(int error, const char* description)
 	{
 		fprintf(stderr, "Error %d: %s\n", error, description);
@@ -107,5 +154,22 @@ public:
 	{
 		if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
 			glfwSetWindowShouldClose(window, GLFW_TRUE);
+		if (key == GLFW_KEY_P && action == GLFW_PRESS)
+			GpuProfiler::get().writeChromeTrace("profile_trace.json");
+		// M cycles the render mode, C compares the frame with a full rate one, see handleKeys;
+		// R starts and stops recording the window, see Source::Render; W switches the wavefront tracer,
+		// H the hybrid renderer, F cycles the reflection scale
+		if (key == GLFW_KEY_M && action == GLFW_PRESS)
+			renderModeKey = true;
+		if (key == GLFW_KEY_C && action == GLFW_PRESS)
+			compareKey = true;
+		if (key == GLFW_KEY_R && action == GLFW_PRESS)
+			recordKey = true;
+		if (key == GLFW_KEY_W && action == GLFW_PRESS)
+			wavefrontKey = true;
+		if (key == GLFW_KEY_H && action == GLFW_PRESS)
+			hybridKey = true;
+		if (key == GLFW_KEY_F && action == GLFW_PRESS)
+			reflectionKey = true;
 	}
 };
\ No newline at end of file
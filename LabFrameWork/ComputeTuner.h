@@ -0,0 +1,177 @@
+#pragma once
+
+/*
+	Picks the workgroup size of a 2D compute shader for the GPU it runs on.
+
+	The shader declares its local size through LOCAL_SIZE_X / LOCAL_SIZE_Y. Every
+	candidate tile is compiled with those defines, dispatched once to warm up and then
+	timed a few times with GL_TIME_ELAPSED queries; the fastest one wins. Drivers whose
+	timer queries report nonsense (llvmpipe answers 1 ns) are timed with the CPU clock
+	around glFinish() instead. Winners are kept in a small text file keyed by the GL
+	vendor, renderer and version strings and a hash of the shader source, so only the
+	first start on a machine (or after a driver update or a shader edit) pays for the
+	tuning. The file goes into the working directory.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <limits>
+#include <algorithm>
+#include <chrono>
+
+#include "GL/glew.h"
+#include "Loader.h"
+
+struct WorkgroupSize {
+	GLint x;
+	GLint y;
+};
+
+class ComputeTuner
+{
+public:
+	typedef std::function<ShaderProgram*(WorkgroupSize)> Compile;
+	typedef std::function<void(ShaderProgram*, WorkgroupSize)> Dispatch;
+
+	ComputeTuner(const std::string& cachePath = "compute_tuning.txt") : m_cachePath(cachePath), m_runs(3) {}
+
+	// #defines to pass to ShaderProgram::initComputeFromFile for a given size
+	static std::string defines(WorkgroupSize size)
+	{
+		std::ostringstream os;
+		os << "#define LOCAL_SIZE_X " << size.x << "\n#define LOCAL_SIZE_Y " << size.y << "\n";
+		return os.str();
+	}
+
+	// Tile shapes worth trying, minus the ones this GPU can't run
+	static std::vector<WorkgroupSize> candidates()
+	{
+		static const WorkgroupSize sizes[] = { { 8, 8 }, { 16, 16 }, { 32, 4 }, { 16, 8 }, { 8, 4 }, { 32, 8 }, { 64, 1 }, { 4, 4 } };
+
+		GLint maxInvocations = 0, maxX = 0, maxY = 0;
+		glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &maxInvocations);
+		glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &maxX);
+		glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 1, &maxY);
+
+		std::vector<WorkgroupSize> result;
+		for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+			if (sizes[i].x * sizes[i].y <= maxInvocations && sizes[i].x <= maxX && sizes[i].y <= maxY)
+				result.push_back(sizes[i]);
+		}
+		return result;
+	}
+
+	// Returns the program built with the fastest size. `compile` builds the shader for a size,
+	// `dispatch` runs the whole workload once; the chosen size is written to `chosen`.
+	ShaderProgram* tune(const std::string& shaderPath, Compile compile, Dispatch dispatch, WorkgroupSize& chosen)
+	{
+		std::string key = cacheKey(shaderPath);
+		if (lookup(key, chosen)) {
+			std::cout << "Workgroup size of " << shaderPath << ": " << chosen.x << "x" << chosen.y << " (cached)" << std::endl;
+			return compile(chosen);
+		}
+
+		std::vector<WorkgroupSize> sizes = candidates();
+		std::vector<ShaderProgram*> programs(sizes.size());
+		std::vector<GLuint64> gpuTimes(sizes.size()), cpuTimes(sizes.size());
+		bool gpuTimesValid = true;
+		GLuint query;
+		glGenQueries(1, &query);
+
+		for (size_t i = 0; i < sizes.size(); i++) {
+			programs[i] = compile(sizes[i]);
+			dispatch(programs[i], sizes[i]);
+			glFinish();
+
+			gpuTimes[i] = cpuTimes[i] = std::numeric_limits<GLuint64>::max();
+			for (int run = 0; run < m_runs; run++) {
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				glBeginQuery(GL_TIME_ELAPSED, query);
+				dispatch(programs[i], sizes[i]);
+				glEndQuery(GL_TIME_ELAPSED);
+				glFinish();
+				GLuint64 cpu = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+				GLuint64 gpu = 0;
+				glGetQueryObjectui64v(query, GL_QUERY_RESULT, &gpu);
+				gpuTimes[i] = std::min(gpuTimes[i], gpu);
+				cpuTimes[i] = std::min(cpuTimes[i], cpu);
+			}
+			// a whole frame of rays can't take under a microsecond
+			if (gpuTimes[i] < 1000) gpuTimesValid = false;
+		}
+		glDeleteQueries(1, &query);
+
+		const std::vector<GLuint64>& times = gpuTimesValid ? gpuTimes : cpuTimes;
+		size_t best = 0;
+		for (size_t i = 0; i < sizes.size(); i++) {
+			std::cout << "Workgroup " << sizes[i].x << "x" << sizes[i].y << ": " << times[i] / 1e6 << " ms" << std::endl;
+			if (times[i] < times[best]) best = i;
+		}
+		for (size_t i = 0; i < sizes.size(); i++) {
+			if (i != best) delete programs[i];
+		}
+		chosen = sizes[best];
+		if (!gpuTimesValid) std::cout << "Timer queries look broken, used the CPU clock" << std::endl;
+
+		std::cout << "Workgroup size of " << shaderPath << ": " << chosen.x << "x" << chosen.y << std::endl;
+		store(key, chosen);
+		return programs[best];
+	}
+
+private:
+	std::string m_cachePath;
+	int m_runs;
+
+	// GPU, driver and shader source, tabs and line breaks removed so it fits on one line
+	std::string cacheKey(const std::string& shaderPath) const
+	{
+		// with its #includes, an edit to one of them retunes too
+		std::string source = ShaderProgram::loadShaderFromFile(shaderPath);
+
+		std::ostringstream os;
+		os << glGetString(GL_VENDOR) << " | " << glGetString(GL_RENDERER) << " | " << glGetString(GL_VERSION)
+			<< " | " << shaderPath << " | " << std::hex << ShaderProgram::hashSource(source);
+		std::string key = os.str();
+		for (size_t i = 0; i < key.size(); i++) {
+			if (key[i] == '\t' || key[i] == '\n' || key[i] == '\r') key[i] = ' ';
+		}
+		return key;
+	}
+
+	// one "<key>\t<x> <y>" line per tuned shader
+	bool lookup(const std::string& key, WorkgroupSize& size) const
+	{
+		std::ifstream is(m_cachePath.c_str());
+		std::string line;
+		while (std::getline(is, line)) {
+			size_t tab = line.rfind('\t');
+			if (tab == std::string::npos || line.compare(0, tab, key) != 0 || tab != key.size()) continue;
+			std::istringstream fields(line.substr(tab + 1));
+			if (fields >> size.x >> size.y && size.x > 0 && size.y > 0) return true;
+		}
+		return false;
+	}
+
+	void store(const std::string& key, WorkgroupSize size) const
+	{
+		// keep the entries of other GPUs and shaders, replace this one and the ones of earlier
+		// versions of the shader on this GPU, which no key will ask for again
+		std::string shader = key.substr(0, key.rfind(" | ") + 3);
+		std::vector<std::string> lines;
+		std::ifstream is(m_cachePath.c_str());
+		std::string line;
+		while (std::getline(is, line)) {
+			if (line.compare(0, shader.size(), shader) != 0) lines.push_back(line);
+		}
+		is.close();
+
+		std::ofstream os(m_cachePath.c_str());
+		for (size_t i = 0; i < lines.size(); i++) os << lines[i] << "\n";
+		os << key << "\t" << size.x << " " << size.y << "\n";
+	}
+};
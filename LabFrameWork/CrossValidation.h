@@ -0,0 +1,242 @@
+#pragma once
+
+/*
+	Cross-validation and throughput benchmark of the CPU and GPU ray tracers.
+
+	Both tracers render one SceneDescription at the same size, with the same primary rays.
+	The GPU side is RayTracingScene and RayTracing.comp; a box without a GPU runs it through
+	Mesa's llvmpipe. The CPU side uses the GPU tracer's model (tracePhong in raytracer.h),
+	because the CPU tracer's own model (shadows, refraction, Fresnel) differs almost
+	everywhere.
+
+	Each tracer is timed over a few renders and the best one is kept. Throughput is reported
+	in millions of rays per second. tracePhong counts the rays; the GPU tracer follows the
+	same ones. The CPU's own renders (raytracer, the distributed workers) run the Whitted
+	trace() instead, so that is timed on the same scene too. It counts no rays outside
+	RT_STATS builds, its figure is primary rays per second. Only the tracePhong image is
+	compared with the GPU's, pixel by pixel. The report gives how far apart they are and
+	how many pixels differ by more than the tolerance. An optional difference image shows
+	where.
+
+	Used by labFrameWork --benchmark. Needs a current GL 4.3 context.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "GL/glew.h"
+#include "glm/glm.hpp"
+
+#include "raytracer.h"
+#include "SceneDescription.h"
+#include "RayTracingScene.h"
+
+struct CrossValidationOptions
+{
+	unsigned width, height;
+	unsigned repeat;            /// timings are the best of this many renders
+	unsigned threads;           /// CPU render threads, 0 is one per hardware thread
+	float tolerance;            /// a pixel differs when one of its channels is further apart than this
+	double minPsnr;             /// run() fails below this, the tracers disagree
+	std::string diffPath;       /// difference image, scaled so the tolerance is white; empty to skip it
+	std::string cpuPath;        /// the two images, empty to skip them
+	std::string gpuPath;
+	CrossValidationOptions() : width(400), height(300), repeat(3), threads(0), tolerance(0.01f), minPsnr(40) {}
+};
+
+class CrossValidation
+{
+public:
+	CrossValidation(const SceneDescription& scene, const CrossValidationOptions& options) : m_scene(scene), m_options(options) {}
+
+	// Spheres and settings for renderTiles: the lights become emissive spheres, the camera
+	// the one RayTracing.comp builds, one ray per pixel through its top left corner like the
+	// first sample of the GPU tracer
+	static void toCpu(const SceneDescription& scene, unsigned width, unsigned height, std::vector<Sphere>& spheres, RenderSettings& settings)
+	{
+		spheres.clear();
+		for (size_t i = 0; i < scene.spheres.size(); ++i) {
+			const SceneSphere& s = scene.spheres[i];
+			Sphere sphere(Vec3f(s.center[0], s.center[1], s.center[2]), s.radius, Vec3f(s.color[0], s.color[1], s.color[2]), s.reflect);
+			sphere.specular = s.specular;
+			sphere.shininess = s.shininess;
+			spheres.push_back(sphere);
+		}
+		for (size_t i = 0; i < scene.lights.size(); ++i) {
+			const SceneLight& l = scene.lights[i];
+			spheres.push_back(Sphere(Vec3f(l.pos[0], l.pos[1], l.pos[2]), 0.1f, Vec3f(0), 0, 0, Vec3f(l.color[0], l.color[1], l.color[2])));
+		}
+
+		settings.width = width;
+		settings.height = height;
+		settings.samples = 1;
+		settings.pixelCenter = 0;
+		settings.shading = SHADING_PHONG;
+		settings.reflectDepth = std::max(0, scene.reflectDepth);
+		// the GPU's field of view is horizontal, the CPU's vertical
+		float halfWidth = std::tan(glm::radians(scene.fov / 2));
+		settings.fov = glm::degrees(2 * std::atan(halfWidth * height / width));
+
+		// the shader's camera space has x to the left and looks down +z, the CPU's has x to
+		// the right and looks down -z: the same rays once turned half way around y
+		glm::vec3 eye(scene.eye[0], scene.eye[1], scene.eye[2]);
+		glm::vec3 columns[4];
+		viewRotation(glm::normalize(glm::vec3(scene.target[0], scene.target[1], scene.target[2]) - eye), columns);
+		columns[0] = -columns[0];
+		columns[2] = -columns[2];
+		columns[3] = eye;
+		for (int c = 0; c < 4; ++c) {
+			for (int r = 0; r < 3; ++r) settings.cameraToWorld.m[c][r] = columns[c][r];
+			settings.cameraToWorld.m[c][3] = (c == 3) ? 1.f : 0.f;
+		}
+	}
+
+	// Objects, lights and camera of the GPU tracer
+	static void toGpu(const SceneDescription& scene, RayTracingScene& gpu)
+	{
+		std::vector<Object> objects;
+		for (size_t i = 0; i < scene.spheres.size(); ++i) {
+			const SceneSphere& s = scene.spheres[i];
+			Object o = Object();
+			o.type = 0;
+			o.pos = glm::vec3(s.center[0], s.center[1], s.center[2]);
+			o.radius = s.radius;
+			o.color = glm::vec4(s.color[0], s.color[1], s.color[2], 1);
+			o.diffuse = 1;
+			o.specular = s.specular;
+			o.shininess = s.shininess;
+			o.reflect = s.reflect;
+			objects.push_back(o);
+		}
+		std::vector<Light> lights;
+		for (size_t i = 0; i < scene.lights.size(); ++i) {
+			const SceneLight& l = scene.lights[i];
+			Light light = { glm::vec3(l.pos[0], l.pos[1], l.pos[2]), glm::vec4(l.color[0], l.color[1], l.color[2], 1) };
+			lights.push_back(light);
+		}
+		gpu.setScene(objects, lights);
+		gpu.setReflectDepth(scene.reflectDepth);
+		gpu.m_viewer->centerAt(glm::vec3(scene.target[0], scene.target[1], scene.target[2]));
+		gpu.m_viewer->lookFrom(glm::vec3(scene.eye[0], scene.eye[1], scene.eye[2]));
+		gpu.m_viewer->setFieldOfView(scene.fov);
+	}
+
+	// Renders with both tracers and prints the report. False when the images disagree or
+	// one can't be saved. `gpu` must be m_options.width x m_options.height.
+	bool run(RayTracingScene& gpu)
+	{
+		const unsigned width = m_options.width, height = m_options.height;
+		const size_t pixels = (size_t)width * height;
+		unsigned threads = m_options.threads ? m_options.threads : std::max(1u, std::thread::hardware_concurrency());
+
+		std::vector<Sphere> spheres;
+		RenderSettings settings;
+		toCpu(m_scene, width, height, spheres, settings);
+		std::atomic<unsigned long long> rays(0);
+		settings.rays = &rays;
+		std::vector<Vec3f> cpu(pixels);
+		std::vector<Tile> tiles = makeTiles(settings, 32);
+		double cpuMs = best([&]() {
+			rays = 0;
+			renderTiles(spheres, settings, tiles, cpu.data(), threads);
+		});
+		RenderSettings whitted = settings;
+		whitted.shading = SHADING_WHITTED;
+		whitted.rays = NULL;
+		std::vector<Vec3f> whittedImage(pixels);
+		double whittedMs = best([&]() {
+			renderTiles(spheres, whitted, tiles, whittedImage.data(), threads);
+		});
+
+		toGpu(m_scene, gpu);
+		// the first frame builds the scene buffers and compiles its shader variant
+		gpu.draw();
+		glFinish();
+		double gpuMs = best([&]() {
+			gpu.resetAccumulation();
+			gpu.draw();
+			glFinish();
+		});
+		std::vector<GLfloat> rgba;
+		gpu.readImage(rgba);
+		std::vector<Vec3f> gpuImage(pixels);
+		for (size_t i = 0; i < pixels; ++i) gpuImage[i] = Vec3f(rgba[4 * i], rgba[4 * i + 1], rgba[4 * i + 2]);
+
+		// the largest channel difference of every pixel, PSNR over colours clamped to [0, 1]
+		std::vector<Vec3f> diff(pixels);
+		float maxError = 0;
+		double sum = 0, squared = 0;
+		size_t differing = 0;
+		for (size_t i = 0; i < pixels; ++i) {
+			const float* a = &cpu[i].x;
+			const float* b = &gpuImage[i].x;
+			float error = 0;
+			for (int c = 0; c < 3; ++c) {
+				error = std::max(error, std::fabs(a[c] - b[c]));
+				double d = std::min(1.f, std::max(0.f, a[c])) - std::min(1.f, std::max(0.f, b[c]));
+				squared += d * d;
+			}
+			maxError = std::max(maxError, error);
+			sum += error;
+			differing += error > m_options.tolerance;
+			diff[i] = Vec3f(error / m_options.tolerance);
+		}
+		double mse = squared / std::max<size_t>(1, pixels * 3);
+		double psnr = mse > 0 ? 10 * std::log10(1.0 / mse) : std::numeric_limits<double>::infinity();
+
+		unsigned long long rayCount = rays;
+		std::cout << "Scene " << m_scene.name << ": " << m_scene.spheres.size() << " spheres, " << m_scene.lights.size() << " lights, "
+			<< width << " x " << height << ", " << rayCount << " rays (" << (double)rayCount / pixels << " per pixel)" << std::endl;
+		const char* threadCount = threads == 1 ? " thread: " : " threads: ";
+		std::cout << "CPU, GPU model (tracePhong), " << threads << threadCount << cpuMs << " ms, " << rayCount / (cpuMs * 1000) << " Mrays/s" << std::endl;
+		std::cout << "CPU, Whitted (trace), " << threads << threadCount << whittedMs << " ms, " << pixels / (whittedMs * 1000) << " M primary rays/s" << std::endl;
+		std::cout << "GPU, " << glGetString(GL_RENDERER) << ": " << gpuMs << " ms, " << rayCount / (gpuMs * 1000) << " Mrays/s" << std::endl;
+		std::cout << "Per pixel difference: max " << maxError << ", mean " << sum / pixels << ", " << differing << " pixels ("
+			<< 100.0 * differing / pixels << "%) over " << m_options.tolerance << ", PSNR " << psnr << " dB" << std::endl;
+
+		bool saved = true;
+		if (!m_options.cpuPath.empty()) saved = savePPM(m_options.cpuPath.c_str(), settings, cpu.data()) && saved;
+		if (!m_options.gpuPath.empty()) saved = savePPM(m_options.gpuPath.c_str(), settings, gpuImage.data()) && saved;
+		if (!m_options.diffPath.empty()) saved = savePPM(m_options.diffPath.c_str(), settings, diff.data()) && saved;
+
+		if (psnr < m_options.minPsnr)
+			std::cout << "The tracers disagree: PSNR under " << m_options.minPsnr << " dB" << std::endl;
+		return saved && psnr >= m_options.minPsnr;
+	}
+
+private:
+	SceneDescription m_scene;
+	CrossValidationOptions m_options;
+
+	// Columns of VectorToRotationMatrix(dir) of camera.glsl: a turn around y, then one
+	// around x, multiplied out
+	static void viewRotation(const glm::vec3& dir, glm::vec3* columns)
+	{
+		float angle1 = std::atan2(-dir.x, dir.z);
+		float angle2 = std::atan2(dir.y, std::sqrt(dir.x * dir.x + dir.z * dir.z));
+		float c1 = std::cos(angle1), s1 = std::sin(angle1), c2 = std::cos(angle2), s2 = std::sin(angle2);
+		columns[0] = glm::vec3(c1, 0, s1);
+		columns[1] = glm::vec3(s2 * s1, c2, -s2 * c1);
+		columns[2] = glm::vec3(-c2 * s1, s2, c2 * c1);
+	}
+
+	// Milliseconds of the fastest of m_options.repeat calls
+	template<typename Render>
+	double best(Render render) const
+	{
+		double fastest = std::numeric_limits<double>::max();
+		for (unsigned i = 0; i < std::max(1u, m_options.repeat); ++i) {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			render();
+			fastest = std::min(fastest, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+		return fastest;
+	}
+};
@@ -0,0 +1,251 @@
+#pragma once
+
+/*
+	Edge avoiding a-trous wavelet denoiser (Dammertz et al. 2010) for low sample
+	count renders of the CPU ray tracer.
+
+	The colour is first divided by the albedo the tracer wrote next to it, so only
+	the lighting gets blurred and texture/material edges survive untouched. Then a
+	3x3 B-spline kernel is applied `iterations` times with holes of 1, 2, 4 ...
+	pixels between its taps (3x3 rather than the paper's 5x5, like SVGF: a third
+	of the taps for the same footprint once the passes are stacked). Each tap is
+	weighted by how close its colour, normal and depth are to the center pixel's;
+	the colour sigma halves every pass so detail that survived the first passes
+	is kept.
+
+	The image is stored as separate float planes so four neighbouring pixels are
+	filtered at once with SSE, borders fall back to the (identical) scalar code.
+	Rows are shared between threads.
+*/
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <atomic>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DENOISER_SSE 1
+#include <emmintrin.h>
+#endif
+
+#include "raytracer.h"
+
+struct DenoiseSettings
+{
+	unsigned iterations;
+	float sigmaColor;       /// lighting difference tolerated in the first pass
+	float sigmaNormal;      /// normal difference tolerated (the weight uses the squared distance)
+	float sigmaDepth;       /// depth difference tolerated per pixel of tap distance
+	unsigned threads;       /// 0: one per hardware thread
+	DenoiseSettings() : iterations(3), sigmaColor(0.2f), sigmaNormal(0.25f), sigmaDepth(0.05f), threads(0) {}
+};
+
+class Denoiser
+{
+public:
+	Denoiser(const DenoiseSettings& settings = DenoiseSettings()) : m_settings(settings), m_width(0), m_height(0) {}
+
+	void denoise(unsigned width, unsigned height, const std::vector<Vec3f>& color, const FeatureBuffers& features, std::vector<Vec3f>& result)
+	{
+		m_width = width;
+		m_height = height;
+		size_t count = (size_t)width * height;
+		for (int i = 0; i < 2; ++i) {
+			m_r[i].resize(count);
+			m_g[i].resize(count);
+			m_b[i].resize(count);
+		}
+		m_nx.resize(count);
+		m_ny.resize(count);
+		m_nz.resize(count);
+		m_z.resize(count);
+
+		// demodulate: filter lighting only
+		for (size_t i = 0; i < count; ++i) {
+			const Vec3f& a = features.albedo[i];
+			m_r[0][i] = color[i].x / std::max(a.x, 0.01f);
+			m_g[0][i] = color[i].y / std::max(a.y, 0.01f);
+			m_b[0][i] = color[i].z / std::max(a.z, 0.01f);
+			m_nx[i] = features.normal[i].x;
+			m_ny[i] = features.normal[i].y;
+			m_nz[i] = features.normal[i].z;
+			// misses are at infinity, keep depth differences finite
+			m_z[i] = std::min(features.depth[i], 1e8f);
+		}
+
+		unsigned threads = m_settings.threads ? m_settings.threads : std::max(1u, std::thread::hardware_concurrency());
+		int src = 0;
+		for (unsigned it = 0; it < m_settings.iterations; ++it, src ^= 1) {
+			Pass pass;
+			pass.step = 1 << it;
+			float sigmaColor = m_settings.sigmaColor / (1 << it);
+			pass.invColor = 1 / (sigmaColor * sigmaColor);
+			pass.invNormal = 1 / (m_settings.sigmaNormal * m_settings.sigmaNormal);
+			pass.invDepth = 1 / (m_settings.sigmaDepth * pass.step);
+			pass.src = src;
+
+			std::atomic<unsigned> nextRow(0);
+			auto work = [&]() {
+				const unsigned rowsPerTake = 8;
+				for (unsigned y0 = nextRow.fetch_add(rowsPerTake); y0 < m_height; y0 = nextRow.fetch_add(rowsPerTake)) {
+					for (unsigned y = y0; y < std::min(y0 + rowsPerTake, m_height); ++y) filterRow(pass, y);
+				}
+			};
+			std::vector<std::thread> pool;
+			for (unsigned i = 1; i < threads; ++i) pool.push_back(std::thread(work));
+			work();
+			for (size_t i = 0; i < pool.size(); ++i) pool[i].join();
+		}
+
+		// remodulate
+		result.resize(count);
+		for (size_t i = 0; i < count; ++i) {
+			const Vec3f& a = features.albedo[i];
+			result[i] = Vec3f(m_r[src][i] * std::max(a.x, 0.01f), m_g[src][i] * std::max(a.y, 0.01f), m_b[src][i] * std::max(a.z, 0.01f));
+		}
+	}
+
+private:
+	struct Pass
+	{
+		int step;
+		float invColor, invNormal, invDepth;
+		int src;
+	};
+
+	DenoiseSettings m_settings;
+	unsigned m_width, m_height;
+	std::vector<float> m_r[2], m_g[2], m_b[2];
+	std::vector<float> m_nx, m_ny, m_nz, m_z;
+
+	// 2^x for x <= 0 as a power of two times a polynomial, the SSE version uses the same steps
+	static float fastExp(float x)
+	{
+		x = std::max(x, -87.f) * 1.44269504f;
+		float fi = std::floor(x);
+		float f = x - fi;
+		float p = 1 + f * (0.6931472f + f * (0.2402265f + f * (0.05550411f + f * (0.009618129f + f * 0.001333355f))));
+		int bits = ((int)fi + 127) << 23;
+		float scale;
+		memcpy(&scale, &bits, sizeof(scale));
+		return p * scale;
+	}
+
+	static float kernel(int i)
+	{
+		static const float h[3] = { 1.f / 4, 1.f / 2, 1.f / 4 };
+		return h[i + 1];
+	}
+
+	void filterPixel(const Pass& pass, unsigned x, unsigned y)
+	{
+		const float* r = m_r[pass.src].data();
+		const float* g = m_g[pass.src].data();
+		const float* b = m_b[pass.src].data();
+		size_t p = (size_t)y * m_width + x;
+
+		float sumW = 0, sumR = 0, sumG = 0, sumB = 0;
+		for (int j = -1; j <= 1; ++j) {
+			int qy = std::min(std::max((int)y + j * pass.step, 0), (int)m_height - 1);
+			for (int i = -1; i <= 1; ++i) {
+				int qx = std::min(std::max((int)x + i * pass.step, 0), (int)m_width - 1);
+				size_t q = (size_t)qy * m_width + qx;
+
+				float dr = r[q] - r[p], dg = g[q] - g[p], db = b[q] - b[p];
+				float dnx = m_nx[q] - m_nx[p], dny = m_ny[q] - m_ny[p], dnz = m_nz[q] - m_nz[p];
+				float dc2 = dr * dr + dg * dg + db * db;
+				float dn2 = dnx * dnx + dny * dny + dnz * dnz;
+				float dz = std::fabs(m_z[q] - m_z[p]);
+				float w = kernel(i) * kernel(j) * fastExp(-(dc2 * pass.invColor + dn2 * pass.invNormal + dz * pass.invDepth));
+
+				sumW += w;
+				sumR += w * r[q];
+				sumG += w * g[q];
+				sumB += w * b[q];
+			}
+		}
+		float invW = 1 / sumW;
+		m_r[pass.src ^ 1][p] = sumR * invW;
+		m_g[pass.src ^ 1][p] = sumG * invW;
+		m_b[pass.src ^ 1][p] = sumB * invW;
+	}
+
+#ifdef DENOISER_SSE
+	static __m128 fastExp4(__m128 x)
+	{
+		x = _mm_mul_ps(_mm_max_ps(x, _mm_set1_ps(-87.f)), _mm_set1_ps(1.44269504f));
+		// floor of a non positive number: truncate, then step down where that rounded up
+		__m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+		__m128 fi = _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.f)));
+		__m128 f = _mm_sub_ps(x, fi);
+		__m128 p = _mm_add_ps(_mm_set1_ps(0.009618129f), _mm_mul_ps(f, _mm_set1_ps(0.001333355f)));
+		p = _mm_add_ps(_mm_set1_ps(0.05550411f), _mm_mul_ps(f, p));
+		p = _mm_add_ps(_mm_set1_ps(0.2402265f), _mm_mul_ps(f, p));
+		p = _mm_add_ps(_mm_set1_ps(0.6931472f), _mm_mul_ps(f, p));
+		p = _mm_add_ps(_mm_set1_ps(1.f), _mm_mul_ps(f, p));
+		__m128i bits = _mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(fi), _mm_set1_epi32(127)), 23);
+		return _mm_mul_ps(p, _mm_castsi128_ps(bits));
+	}
+
+	// four pixels x..x+3 whose taps are all inside the image
+	void filterPixels4(const Pass& pass, unsigned x, unsigned y)
+	{
+		const float* r = m_r[pass.src].data();
+		const float* g = m_g[pass.src].data();
+		const float* b = m_b[pass.src].data();
+		const float* nx = m_nx.data();
+		const float* ny = m_ny.data();
+		const float* nz = m_nz.data();
+		const float* z = m_z.data();
+		size_t p = (size_t)y * m_width + x;
+
+		__m128 pr = _mm_loadu_ps(r + p), pg = _mm_loadu_ps(g + p), pb = _mm_loadu_ps(b + p);
+		__m128 pnx = _mm_loadu_ps(nx + p), pny = _mm_loadu_ps(ny + p), pnz = _mm_loadu_ps(nz + p);
+		__m128 pz = _mm_loadu_ps(z + p);
+		__m128 invColor = _mm_set1_ps(pass.invColor), invNormal = _mm_set1_ps(pass.invNormal), invDepth = _mm_set1_ps(pass.invDepth);
+		__m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+		__m128 sumW = _mm_setzero_ps(), sumR = _mm_setzero_ps(), sumG = _mm_setzero_ps(), sumB = _mm_setzero_ps();
+		for (int j = -1; j <= 1; ++j) {
+			for (int i = -1; i <= 1; ++i) {
+				size_t q = p + (ptrdiff_t)(j * pass.step) * m_width + i * pass.step;
+
+				__m128 qr = _mm_loadu_ps(r + q), qg = _mm_loadu_ps(g + q), qb = _mm_loadu_ps(b + q);
+				__m128 dr = _mm_sub_ps(qr, pr), dg = _mm_sub_ps(qg, pg), db = _mm_sub_ps(qb, pb);
+				__m128 dnx = _mm_sub_ps(_mm_loadu_ps(nx + q), pnx);
+				__m128 dny = _mm_sub_ps(_mm_loadu_ps(ny + q), pny);
+				__m128 dnz = _mm_sub_ps(_mm_loadu_ps(nz + q), pnz);
+				__m128 dc2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+				__m128 dn2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dnx, dnx), _mm_mul_ps(dny, dny)), _mm_mul_ps(dnz, dnz));
+				__m128 dz = _mm_and_ps(_mm_sub_ps(_mm_loadu_ps(z + q), pz), absMask);
+
+				__m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dc2, invColor), _mm_mul_ps(dn2, invNormal)), _mm_mul_ps(dz, invDepth));
+				__m128 w = _mm_mul_ps(_mm_set1_ps(kernel(i) * kernel(j)), fastExp4(_mm_sub_ps(_mm_setzero_ps(), e)));
+
+				sumW = _mm_add_ps(sumW, w);
+				sumR = _mm_add_ps(sumR, _mm_mul_ps(w, qr));
+				sumG = _mm_add_ps(sumG, _mm_mul_ps(w, qg));
+				sumB = _mm_add_ps(sumB, _mm_mul_ps(w, qb));
+			}
+		}
+		__m128 invW = _mm_div_ps(_mm_set1_ps(1.f), sumW);
+		_mm_storeu_ps(m_r[pass.src ^ 1].data() + p, _mm_mul_ps(sumR, invW));
+		_mm_storeu_ps(m_g[pass.src ^ 1].data() + p, _mm_mul_ps(sumG, invW));
+		_mm_storeu_ps(m_b[pass.src ^ 1].data() + p, _mm_mul_ps(sumB, invW));
+	}
+#endif
+
+	void filterRow(const Pass& pass, unsigned y)
+	{
+		unsigned x = 0;
+#ifdef DENOISER_SSE
+		unsigned reach = pass.step;
+		if (y >= reach && y + reach < m_height && m_width > 2 * reach + 4) {
+			for (; x < reach; ++x) filterPixel(pass, x, y);
+			for (; x + 4 + reach <= m_width; x += 4) filterPixels4(pass, x, y);
+		}
+#endif
+		for (; x < m_width; ++x) filterPixel(pass, x, y);
+	}
+};
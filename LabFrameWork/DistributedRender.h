@@ -0,0 +1,739 @@
+#pragma once
+
+/*
+	Coordinator / worker tile rendering for the CPU ray tracer.
+
+	The coordinator owns the scene and the final image. Workers connect over TCP,
+	receive the scene once and then keep asking for tiles:
+
+		worker                              coordinator
+		HELLO(threads)               ->
+		                             <-     SCENE(settings, camera, spheres)
+		REQUEST(pixels per second)   ->
+		                             <-     TILES(id, rect ...) | WAIT | DONE
+		RESULT(id, pixels)           ->     (one per tile, in any order)
+		                             <-     CANCEL(id ...)   (while the batch renders)
+		REQUEST(...)                 ->     ...
+
+	Every message is a (type, word count) header followed by 32 bit words in
+	network byte order, floats are sent as their bit pattern.
+
+	Tiles are handed out in batches sized from the throughput each worker reports,
+	so faster nodes get more tiles. Once the pending pool runs dry an idle worker
+	steals the last queued tile of the worker with the longest backlog: that worker
+	gets a CANCEL for it and skips it, unless it already started the tile. Workers
+	look for CANCELs before each tile they start. A tile which has been out for
+	longer than the timeout goes back to the pool. When a tile comes back twice
+	only the first result is kept.
+*/
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <memory>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+typedef SOCKET socket_t;
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+typedef int socket_t;
+#define INVALID_SOCKET (-1)
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define NET_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define NET_SEND_FLAGS 0
+#endif
+
+#include "raytracer.h"
+
+namespace net
+{
+	enum MessageType
+	{
+		MSG_HELLO = 1,
+		MSG_SCENE,
+		MSG_REQUEST,
+		MSG_TILES,
+		MSG_WAIT,
+		MSG_RESULT,
+		MSG_DONE,
+		MSG_CANCEL
+	};
+
+	enum RecvStatus
+	{
+		RECV_OK, RECV_TIMEOUT, RECV_CLOSED
+	};
+
+	inline void startup()
+	{
+#ifdef _WIN32
+		static bool started = false;
+		if (!started) {
+			WSADATA data;
+			WSAStartup(MAKEWORD(2, 2), &data);
+			started = true;
+		}
+#endif
+	}
+
+	inline void closeSocket(socket_t s)
+	{
+#ifdef _WIN32
+		closesocket(s);
+#else
+		close(s);
+#endif
+	}
+
+	// receive timeout so blocked reads wake up and can check for shutdown
+	inline void setRecvTimeout(socket_t s, unsigned milliseconds)
+	{
+#ifdef _WIN32
+		DWORD tv = milliseconds;
+#else
+		timeval tv;
+		tv.tv_sec = milliseconds / 1000;
+		tv.tv_usec = (milliseconds % 1000) * 1000;
+#endif
+		setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+	}
+
+	inline bool wouldBlock()
+	{
+#ifdef _WIN32
+		return WSAGetLastError() == WSAETIMEDOUT || WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+	}
+
+	// A message is a type and a list of 32 bit words
+	class Message
+	{
+	public:
+		uint32_t type;
+		std::vector<uint32_t> words;
+
+		Message(uint32_t t = 0) : type(t), cursor(0) {}
+
+		void push(uint32_t w) { words.push_back(w); }
+		void pushFloat(float f) { uint32_t w; memcpy(&w, &f, sizeof(w)); words.push_back(w); }
+		void pushVec(const Vec3f& v) { pushFloat(v.x); pushFloat(v.y); pushFloat(v.z); }
+
+		bool remaining(size_t n) const { return cursor + n <= words.size(); }
+		uint32_t next() { return remaining(1) ? words[cursor++] : 0; }
+		float nextFloat() { uint32_t w = next(); float f; memcpy(&f, &w, sizeof(f)); return f; }
+		Vec3f nextVec() { float x = nextFloat(); float y = nextFloat(); float z = nextFloat(); return Vec3f(x, y, z); }
+
+	private:
+		size_t cursor;
+	};
+
+	// True when a read wouldn't block
+	inline bool readable(socket_t s)
+	{
+		fd_set set;
+		FD_ZERO(&set);
+		FD_SET(s, &set);
+		timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+		return select((int)s + 1, &set, NULL, NULL, &tv) > 0;
+	}
+
+	inline bool sendAll(socket_t s, const char* data, size_t size)
+	{
+		while (size > 0) {
+			int sent = send(s, data, (int)std::min(size, (size_t)1 << 20), NET_SEND_FLAGS);
+			if (sent <= 0) return false;
+			data += sent;
+			size -= sent;
+		}
+		return true;
+	}
+
+	// Reads exactly `size` bytes. A timeout is only reported while nothing has
+	// been read yet, once a message has started we wait for the rest of it.
+	inline RecvStatus recvAll(socket_t s, char* data, size_t size)
+	{
+		size_t got = 0;
+		while (got < size) {
+			int n = recv(s, data + got, (int)(size - got), 0);
+			if (n == 0) return RECV_CLOSED;
+			if (n < 0) {
+				if (!wouldBlock()) return RECV_CLOSED;
+				if (got == 0) return RECV_TIMEOUT;
+				continue;
+			}
+			got += n;
+		}
+		return RECV_OK;
+	}
+
+	inline bool sendMessage(socket_t s, const Message& msg)
+	{
+		std::vector<uint32_t> buffer(2 + msg.words.size());
+		buffer[0] = htonl(msg.type);
+		buffer[1] = htonl((uint32_t)msg.words.size());
+		for (size_t i = 0; i < msg.words.size(); ++i) buffer[2 + i] = htonl(msg.words[i]);
+		return sendAll(s, (const char*)buffer.data(), buffer.size() * sizeof(uint32_t));
+	}
+
+	inline RecvStatus recvMessage(socket_t s, Message& msg)
+	{
+		uint32_t header[2];
+		RecvStatus status = recvAll(s, (char*)header, sizeof(header));
+		if (status != RECV_OK) return status;
+		msg = Message(ntohl(header[0]));
+		msg.words.resize(ntohl(header[1]));
+		if (!msg.words.empty()) {
+			do {
+				status = recvAll(s, (char*)msg.words.data(), msg.words.size() * sizeof(uint32_t));
+			} while (status == RECV_TIMEOUT);
+			if (status != RECV_OK) return status;
+		}
+		for (size_t i = 0; i < msg.words.size(); ++i) msg.words[i] = ntohl(msg.words[i]);
+		return RECV_OK;
+	}
+
+	// Everything renderTile reads, except the output buffers (features, rays, stats)
+	inline void encodeScene(Message& msg, const RenderSettings& settings, const std::vector<Sphere>& spheres)
+	{
+		msg.push(settings.width);
+		msg.push(settings.height);
+		msg.pushFloat(settings.fov);
+		msg.push(settings.samples);
+		msg.pushFloat(settings.pixelCenter);
+		msg.push((uint32_t)settings.shading);
+		msg.push(settings.reflectDepth);
+		for (int c = 0; c < 4; ++c)
+			for (int r = 0; r < 4; ++r) msg.pushFloat(settings.cameraToWorld.m[c][r]);
+		msg.push((uint32_t)spheres.size());
+		for (size_t i = 0; i < spheres.size(); ++i) {
+			const Sphere& s = spheres[i];
+			msg.pushVec(s.center);
+			msg.pushFloat(s.radius);
+			msg.pushVec(s.surfaceColor);
+			msg.pushFloat(s.reflection);
+			msg.pushFloat(s.transparency);
+			msg.pushVec(s.emissionColor);
+			msg.pushFloat(s.specular);
+			msg.pushFloat(s.shininess);
+		}
+	}
+
+	inline bool decodeScene(Message& msg, RenderSettings& settings, std::vector<Sphere>& spheres)
+	{
+		if (!msg.remaining(24)) return false;
+		settings.width = msg.next();
+		settings.height = msg.next();
+		settings.fov = msg.nextFloat();
+		settings.samples = msg.next();
+		settings.pixelCenter = msg.nextFloat();
+		settings.shading = msg.next() == SHADING_PHONG ? SHADING_PHONG : SHADING_WHITTED;
+		settings.reflectDepth = msg.next();
+		for (int c = 0; c < 4; ++c)
+			for (int r = 0; r < 4; ++r) settings.cameraToWorld.m[c][r] = msg.nextFloat();
+		uint32_t count = msg.next();
+		if (!msg.remaining((size_t)count * 14)) return false;
+		spheres.clear();
+		for (uint32_t i = 0; i < count; ++i) {
+			Vec3f center = msg.nextVec();
+			float radius = msg.nextFloat();
+			Vec3f surfaceColor = msg.nextVec();
+			float reflection = msg.nextFloat();
+			float transparency = msg.nextFloat();
+			Vec3f emissionColor = msg.nextVec();
+			spheres.push_back(Sphere(center, radius, surfaceColor, reflection, transparency, emissionColor));
+			spheres.back().specular = msg.nextFloat();
+			spheres.back().shininess = msg.nextFloat();
+		}
+		return true;
+	}
+}
+
+// Shared tile bookkeeping of the coordinator, every method is thread safe.
+class TileScheduler
+{
+public:
+	typedef std::chrono::steady_clock clock;
+
+	TileScheduler(const std::vector<Tile>& tiles, double timeoutSeconds, unsigned tilesPerThread)
+		: m_tiles(tiles), m_state(tiles.size()), m_timeout(timeoutSeconds), m_tilesPerThread(tilesPerThread), m_doneCount(0)
+	{
+		for (unsigned i = 0; i < tiles.size(); ++i) m_pending.push_back(i);
+	}
+
+	const Tile& tile(unsigned id) const { return m_tiles[id]; }
+	unsigned tileCount() const { return (unsigned)m_tiles.size(); }
+
+	bool finished()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_doneCount == m_tiles.size();
+	}
+
+	void addWorker(int worker, unsigned threads)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_workers[worker].threads = std::max(1u, threads);
+	}
+
+	// Worker disconnected: everything it still held goes back to the pool
+	void removeWorker(int worker)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		WorkerState& state = m_workers[worker];
+		while (!state.assigned.empty()) {
+			requeue(state.assigned.back());
+			state.assigned.pop_back();
+		}
+		m_workers.erase(worker);
+	}
+
+	// Next batch for `worker`, empty when there is nothing to hand out right now
+	std::vector<unsigned> acquire(int worker, float pixelsPerSecond)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		WorkerState& state = m_workers[worker];
+		if (pixelsPerSecond > 0) state.pixelsPerSecond = pixelsPerSecond;
+
+		// a worker only asks again once its last batch is through, anything left was lost
+		while (!state.assigned.empty()) {
+			requeue(state.assigned.back());
+			state.assigned.pop_back();
+		}
+		state.revoked.clear();
+		requeueExpired();
+
+		std::vector<unsigned> batch;
+		unsigned size = batchSize(state);
+		while (batch.size() < size && !m_pending.empty()) {
+			unsigned id = m_pending.front();
+			m_pending.pop_front();
+			if (!m_state[id].done) batch.push_back(id);
+		}
+
+		// Pool is empty: steal the last queued tile of the worker with the longest backlog
+		if (batch.empty()) {
+			int victim = -1;
+			size_t backlog = 0;
+			for (std::map<int, WorkerState>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+				if (it->first == worker) continue;
+				size_t queued = it->second.assigned.size();
+				if (queued > it->second.threads && queued - it->second.threads > backlog) {
+					backlog = queued - it->second.threads;
+					victim = it->first;
+				}
+			}
+			if (victim >= 0) {
+				WorkerState& victimState = m_workers[victim];
+				batch.push_back(victimState.assigned.back());
+				victimState.revoked.push_back(victimState.assigned.back());
+				victimState.assigned.pop_back();
+			}
+		}
+
+		clock::time_point now = clock::now();
+		for (size_t i = 0; i < batch.size(); ++i) {
+			m_state[batch[i]].owner = worker;
+			m_state[batch[i]].issuedAt = now;
+			state.assigned.push_back(batch[i]);
+		}
+		return batch;
+	}
+
+	// Tiles stolen from `worker` since the last call, to cancel on its side
+	std::vector<unsigned> takeRevoked(int worker)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::vector<unsigned> revoked;
+		std::map<int, WorkerState>::iterator it = m_workers.find(worker);
+		if (it != m_workers.end()) revoked.swap(it->second.revoked);
+		return revoked;
+	}
+
+	// Returns true the first time a tile comes back, the caller then stores its pixels
+	bool complete(unsigned id)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (id >= m_tiles.size() || m_state[id].done) return false;
+		m_state[id].done = true;
+		m_doneCount++;
+
+		std::map<int, WorkerState>::iterator owner = m_workers.find(m_state[id].owner);
+		if (owner != m_workers.end()) {
+			std::deque<unsigned>& assigned = owner->second.assigned;
+			assigned.erase(std::remove(assigned.begin(), assigned.end(), id), assigned.end());
+		}
+		return true;
+	}
+
+private:
+	struct TileState
+	{
+		bool done;
+		int owner;
+		clock::time_point issuedAt;
+		TileState() : done(false), owner(-1) {}
+	};
+
+	struct WorkerState
+	{
+		unsigned threads;
+		float pixelsPerSecond;
+		std::deque<unsigned> assigned;
+		std::vector<unsigned> revoked;      /// stolen, the worker has yet to hear of it
+		WorkerState() : threads(1), pixelsPerSecond(0) {}
+	};
+
+	std::vector<Tile> m_tiles;
+	std::vector<TileState> m_state;
+	std::deque<unsigned> m_pending;
+	std::map<int, WorkerState> m_workers;
+	double m_timeout;
+	unsigned m_tilesPerThread;
+	size_t m_doneCount;
+	std::mutex m_mutex;
+
+	void requeue(unsigned id)
+	{
+		if (m_state[id].done) return;
+		m_state[id].owner = -1;
+		m_pending.push_front(id);
+	}
+
+	void requeueExpired()
+	{
+		clock::time_point now = clock::now();
+		for (std::map<int, WorkerState>::iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+			std::deque<unsigned>& assigned = it->second.assigned;
+			for (std::deque<unsigned>::iterator t = assigned.begin(); t != assigned.end();) {
+				if (std::chrono::duration<double>(now - m_state[*t].issuedAt).count() > m_timeout) {
+					std::cout << "Tile " << *t << " timed out on worker " << it->first << ", re-issuing" << std::endl;
+					requeue(*t);
+					t = assigned.erase(t);
+				}
+				else {
+					++t;
+				}
+			}
+		}
+	}
+
+	// Batches scale with the worker's share of the total reported throughput
+	unsigned batchSize(const WorkerState& state) const
+	{
+		float total = 0;
+		unsigned reporting = 0;
+		for (std::map<int, WorkerState>::const_iterator it = m_workers.begin(); it != m_workers.end(); ++it) {
+			if (it->second.pixelsPerSecond > 0) {
+				total += it->second.pixelsPerSecond;
+				reporting++;
+			}
+		}
+
+		unsigned base = state.threads * m_tilesPerThread;
+		float share = 1.0f / std::max<size_t>(1, m_workers.size());
+		if (state.pixelsPerSecond > 0 && total > 0) {
+			float scale = state.pixelsPerSecond / (total / reporting);
+			base = (unsigned)std::max(1.0f, std::min(4.0f * base, std::floor(base * scale + 0.5f)));
+			share = state.pixelsPerSecond / total;
+		}
+
+		// near the end keep the remaining tiles spread over all the workers
+		unsigned fair = (unsigned)std::ceil(m_pending.size() * share);
+		return std::max(1u, std::min(base, fair));
+	}
+};
+
+// Worker side: connect, take the scene, render tiles until the coordinator says done
+inline bool runWorker(const std::string& host, unsigned short port, unsigned threads = 0)
+{
+	net::startup();
+	if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+
+	addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo* addresses = NULL;
+	if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) {
+		std::cerr << "Worker: cannot resolve " << host << std::endl;
+		return false;
+	}
+
+	// the coordinator may still be starting up, retry for a few seconds
+	socket_t s = INVALID_SOCKET;
+	for (int attempt = 0; attempt < 50 && s == INVALID_SOCKET; ++attempt) {
+		for (addrinfo* a = addresses; a != NULL; a = a->ai_next) {
+			s = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+			if (s == INVALID_SOCKET) continue;
+			if (connect(s, a->ai_addr, (int)a->ai_addrlen) == 0) break;
+			net::closeSocket(s);
+			s = INVALID_SOCKET;
+		}
+		if (s == INVALID_SOCKET) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+	freeaddrinfo(addresses);
+	if (s == INVALID_SOCKET) {
+		std::cerr << "Worker: cannot connect to " << host << ":" << port << std::endl;
+		return false;
+	}
+	int noDelay = 1;
+	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+
+	net::Message hello(net::MSG_HELLO);
+	hello.push(threads);
+	net::sendMessage(s, hello);
+
+	net::Message msg;
+	RenderSettings settings;
+	std::vector<Sphere> spheres;
+	if (net::recvMessage(s, msg) != net::RECV_OK || msg.type != net::MSG_SCENE || !net::decodeScene(msg, settings, spheres)) {
+		std::cerr << "Worker: no scene received" << std::endl;
+		net::closeSocket(s);
+		return false;
+	}
+
+	std::mutex sendMutex, recvMutex;
+	float pixelsPerSecond = 0;
+	unsigned rendered = 0, cancelledCount = 0;
+	std::atomic<bool> ok(true);
+
+	while (ok) {
+		net::Message request(net::MSG_REQUEST);
+		request.pushFloat(pixelsPerSecond);
+		if (!net::sendMessage(s, request)) break;
+		// a CANCEL can arrive after its batch is through, there's nothing left to skip
+		net::RecvStatus status;
+		while ((status = net::recvMessage(s, msg)) == net::RECV_OK && msg.type == net::MSG_CANCEL) {}
+		if (status != net::RECV_OK) break;
+
+		if (msg.type == net::MSG_DONE) break;
+		if (msg.type == net::MSG_WAIT) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			continue;
+		}
+		if (msg.type != net::MSG_TILES) break;
+
+		std::vector<std::pair<unsigned, Tile> > batch(msg.next());
+		unsigned pixelCount = 0;
+		for (size_t i = 0; i < batch.size(); ++i) {
+			batch[i].first = msg.next();
+			batch[i].second.x0 = msg.next();
+			batch[i].second.y0 = msg.next();
+			batch[i].second.x1 = msg.next();
+			batch[i].second.y1 = msg.next();
+			pixelCount += batch[i].second.pixelCount();
+		}
+
+		// render the batch in order with all local threads, each tile is sent back as soon as it is done.
+		// Only CANCELs come in meanwhile: the tiles they name went to an idle worker and are skipped.
+		std::vector<unsigned> cancelled;
+		auto isCancelled = [&](unsigned id) {
+			std::lock_guard<std::mutex> lock(recvMutex);
+			while (ok && net::readable(s)) {
+				net::Message cancel;
+				if (net::recvMessage(s, cancel) != net::RECV_OK) {
+					ok = false;
+					break;
+				}
+				if (cancel.type != net::MSG_CANCEL) continue;
+				for (uint32_t n = cancel.next(); n > 0; --n) cancelled.push_back(cancel.next());
+			}
+			return std::find(cancelled.begin(), cancelled.end(), id) != cancelled.end();
+		};
+		TileScheduler::clock::time_point start = TileScheduler::clock::now();
+		std::atomic<unsigned> next(0), skippedPixels(0), skipped(0);
+		auto work = [&]() {
+			std::vector<Vec3f> pixels;
+			for (unsigned i = next++; i < batch.size(); i = next++) {
+				const Tile& tile = batch[i].second;
+				if (isCancelled(batch[i].first)) {
+					skippedPixels += tile.pixelCount();
+					skipped++;
+					continue;
+				}
+				pixels.resize(tile.pixelCount());
+				renderTile(spheres, settings, tile, pixels.data());
+
+				net::Message result(net::MSG_RESULT);
+				result.words.reserve(1 + pixels.size() * 3);
+				result.push(batch[i].first);
+				for (size_t p = 0; p < pixels.size(); ++p) result.pushVec(pixels[p]);
+
+				std::lock_guard<std::mutex> lock(sendMutex);
+				if (!net::sendMessage(s, result)) ok = false;
+			}
+		};
+		std::vector<std::thread> pool;
+		for (unsigned i = 1; i < std::min<size_t>(threads, batch.size()); ++i) pool.push_back(std::thread(work));
+		work();
+		for (size_t i = 0; i < pool.size(); ++i) pool[i].join();
+
+		double seconds = std::chrono::duration<double>(TileScheduler::clock::now() - start).count();
+		if (seconds > 0 && pixelCount > skippedPixels) pixelsPerSecond = (float)((pixelCount - skippedPixels) / seconds);
+		rendered += (unsigned)batch.size() - skipped;
+		cancelledCount += skipped;
+	}
+
+	std::cout << "Worker: rendered " << rendered << " tiles, " << cancelledCount << " cancelled" << std::endl;
+	net::closeSocket(s);
+	return true;
+}
+
+// Coordinator side: one thread per connected worker
+inline void serveWorker(socket_t s, int worker, TileScheduler& scheduler, const RenderSettings& settings, const std::vector<Sphere>& spheres, Vec3f* image)
+{
+	// short, a stolen tile's CANCEL goes out when this wakes up
+	net::setRecvTimeout(s, 20);
+
+	net::Message msg;
+	net::RecvStatus status;
+	while ((status = net::recvMessage(s, msg)) == net::RECV_TIMEOUT) {
+		if (scheduler.finished()) break;
+	}
+	if (status != net::RECV_OK || msg.type != net::MSG_HELLO) {
+		net::closeSocket(s);
+		return;
+	}
+	scheduler.addWorker(worker, msg.next());
+
+	net::Message scene(net::MSG_SCENE);
+	net::encodeScene(scene, settings, spheres);
+	bool ok = net::sendMessage(s, scene);
+
+	while (ok) {
+		std::vector<unsigned> revoked = scheduler.takeRevoked(worker);
+		if (!revoked.empty()) {
+			net::Message cancel(net::MSG_CANCEL);
+			cancel.push((uint32_t)revoked.size());
+			for (size_t i = 0; i < revoked.size(); ++i) cancel.push(revoked[i]);
+			ok = net::sendMessage(s, cancel);
+		}
+
+		status = net::recvMessage(s, msg);
+		if (status == net::RECV_TIMEOUT) {
+			// a worker still busy with a duplicate tile is not waited for
+			if (scheduler.finished()) break;
+			continue;
+		}
+		if (status == net::RECV_CLOSED) break;
+
+		if (msg.type == net::MSG_REQUEST) {
+			std::vector<unsigned> batch = scheduler.acquire(worker, msg.nextFloat());
+			if (!batch.empty()) {
+				net::Message tiles(net::MSG_TILES);
+				tiles.push((uint32_t)batch.size());
+				for (size_t i = 0; i < batch.size(); ++i) {
+					const Tile& tile = scheduler.tile(batch[i]);
+					tiles.push(batch[i]);
+					tiles.push(tile.x0);
+					tiles.push(tile.y0);
+					tiles.push(tile.x1);
+					tiles.push(tile.y1);
+				}
+				ok = net::sendMessage(s, tiles);
+			}
+			else if (scheduler.finished()) {
+				net::sendMessage(s, net::Message(net::MSG_DONE));
+				break;
+			}
+			else {
+				ok = net::sendMessage(s, net::Message(net::MSG_WAIT));
+			}
+		}
+		else if (msg.type == net::MSG_RESULT) {
+			unsigned id = msg.next();
+			if (id >= scheduler.tileCount()) continue;
+			const Tile& tile = scheduler.tile(id);
+			if (!msg.remaining((size_t)tile.pixelCount() * 3)) continue;
+			std::vector<Vec3f> pixels(tile.pixelCount());
+			for (size_t p = 0; p < pixels.size(); ++p) pixels[p] = msg.nextVec();
+			// only the first copy of a tile is written, tiles never overlap
+			if (scheduler.complete(id)) storeTile(settings, tile, pixels.data(), image);
+		}
+	}
+
+	scheduler.removeWorker(worker);
+	net::closeSocket(s);
+}
+
+// Render the image with remote workers. `localWorkers` spawns that many
+// in-process workers talking to us over localhost, handy for testing.
+inline bool runCoordinator(const std::vector<Sphere>& spheres, const RenderSettings& settings, Vec3f* image,
+	unsigned short port, unsigned tileSize = 32, double timeoutSeconds = 30, unsigned localWorkers = 0)
+{
+	net::startup();
+
+	socket_t listener = socket(AF_INET, SOCK_STREAM, 0);
+	if (listener == INVALID_SOCKET) {
+		std::cerr << "Coordinator: cannot create socket" << std::endl;
+		return false;
+	}
+	int reuse = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+		std::cerr << "Coordinator: cannot listen on port " << port << std::endl;
+		net::closeSocket(listener);
+		return false;
+	}
+
+	TileScheduler scheduler(makeTiles(settings, tileSize), timeoutSeconds, 2);
+	std::cout << "Coordinator: " << scheduler.tileCount() << " tiles, listening on port " << port << std::endl;
+
+	std::vector<std::thread> locals;
+	for (unsigned i = 0; i < localWorkers; ++i) {
+		locals.push_back(std::thread([port]() { runWorker("127.0.0.1", port, 1); }));
+	}
+
+	std::vector<std::thread> connections;
+	int workerCount = 0;
+	while (!scheduler.finished()) {
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET(listener, &readable);
+		timeval tv;
+		tv.tv_sec = 0;
+		tv.tv_usec = 20000;
+		if (select((int)listener + 1, &readable, NULL, NULL, &tv) <= 0) continue;
+
+		socket_t s = accept(listener, NULL, NULL);
+		if (s == INVALID_SOCKET) continue;
+		int noDelay = 1;
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+		std::cout << "Coordinator: worker " << workerCount << " connected" << std::endl;
+		connections.push_back(std::thread(serveWorker, s, workerCount++, std::ref(scheduler), std::cref(settings), std::cref(spheres), image));
+	}
+
+	net::closeSocket(listener);
+	for (size_t i = 0; i < connections.size(); ++i) connections[i].join();
+	for (size_t i = 0; i < locals.size(); ++i) locals[i].join();
+	return true;
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+/*
+	Buffer for data the CPU rewrites while frames are in flight, e.g. scene objects or
+	instance flags.
+
+	The storage holds REGIONS copies of the data and is allocated once with glBufferStorage and
+	mapped persistently and coherently, so an update is a plain write into mapped memory: no
+	glBufferData, no driver reallocation, no map call per update. Every update goes to the next
+	region while the GPU may still be reading the earlier ones. A region is fenced when the
+	writes move on from it and is only written again once that fence has passed, which with
+	three regions practically never waits. bind() binds the region written last.
+
+	The storage is only replaced when an update outgrows it. Without GL 4.4 the regions are
+	filled with glBufferSubData from a copy in memory instead of being mapped.
+
+		DynamicBuffer flags;
+		flags.write(data, size);                 // or fill beginWrite(size), then endWrite()
+		flags.bind(3);
+*/
+
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include "GL/glew.h"
+
+class DynamicBuffer
+{
+public:
+	static const int REGIONS = 3;
+
+	DynamicBuffer(GLenum target = GL_SHADER_STORAGE_BUFFER)
+		: m_target(target), m_buffer(0), m_mapped(NULL), m_capacity(0), m_stride(0), m_region(-1), m_size(0), m_stalls(0)
+	{
+		for (int i = 0; i < REGIONS; i++)
+			m_fences[i] = 0;
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		m_persistent = major > 4 || (major == 4 && minor >= 4);
+		// regions are bound with glBindBufferRange, their offsets need the target's alignment
+		GLint alignment = 4;
+		if (target == GL_SHADER_STORAGE_BUFFER) glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		else if (target == GL_UNIFORM_BUFFER) glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		m_alignment = std::max(alignment, 4);
+	}
+
+	~DynamicBuffer() { release(); }
+
+	void write(const void* data, size_t size)
+	{
+		memcpy(beginWrite(size), data, size);
+		endWrite();
+	}
+
+	// The next region, to be filled with `size` bytes up to endWrite(). Mapped memory is
+	// write combined: write it front to back and don't read it.
+	void* beginWrite(size_t size)
+	{
+		size = std::max<size_t>(size, 1);
+		if (size > m_capacity)
+			allocate(size + size / 2);
+
+		// the GPU commands issued so far are the last ones to read the current region
+		if (m_region >= 0)
+			m_fences[m_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		m_region = (m_region + 1) % REGIONS;
+		if (m_fences[m_region]) {
+			if (glClientWaitSync(m_fences[m_region], 0, 0) == GL_TIMEOUT_EXPIRED) {
+				m_stalls++;
+				glClientWaitSync(m_fences[m_region], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			}
+			glDeleteSync(m_fences[m_region]);
+			m_fences[m_region] = 0;
+		}
+		m_size = size;
+
+		if (m_persistent)
+			return m_mapped + m_region * m_stride;
+		m_staging.resize(size);
+		return m_staging.data();
+	}
+
+	void endWrite()
+	{
+		if (m_persistent || m_region < 0)
+			return;
+		glBindBuffer(m_target, m_buffer);
+		glBufferSubData(m_target, m_region * m_stride, m_size, m_staging.data());
+		glBindBuffer(m_target, 0);
+	}
+
+	// Binds the region written last to the indexed binding `index`
+	void bind(GLuint index) const
+	{
+		if (m_region >= 0)
+			glBindBufferRange(m_target, index, m_buffer, m_region * m_stride, m_size);
+	}
+
+	GLuint id() const { return m_buffer; }
+	GLintptr offset() const { return std::max(m_region, 0) * m_stride; }
+	size_t size() const { return m_size; }
+	// Updates that had to wait for the GPU to finish reading their region
+	int stalls() const { return m_stalls; }
+
+private:
+	GLenum m_target;
+	GLuint m_buffer;
+	unsigned char* m_mapped;
+	bool m_persistent;
+	GLint m_alignment;
+	size_t m_capacity;          /// bytes per region
+	size_t m_stride;            /// region offsets, the capacity aligned
+	GLsync m_fences[REGIONS];   /// set once the writes moved on from a region
+	int m_region;               /// written last, -1 before the first write
+	size_t m_size;              /// of the last write
+	std::vector<unsigned char> m_staging;
+	int m_stalls;
+
+	void allocate(size_t capacity)
+	{
+		// the old storage goes once the GPU is done with it, the fences were for it
+		release();
+		m_capacity = capacity;
+		m_stride = (capacity + m_alignment - 1) / m_alignment * m_alignment;
+		glGenBuffers(1, &m_buffer);
+		glBindBuffer(m_target, m_buffer);
+		if (m_persistent) {
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(m_target, REGIONS * m_stride, NULL, flags);
+			m_mapped = (unsigned char*)glMapBufferRange(m_target, 0, REGIONS * m_stride, flags);
+			if (!m_mapped) {
+				std::cout << "Could not map a persistent buffer, falling back to glBufferSubData" << std::endl;
+				glDeleteBuffers(1, &m_buffer);
+				glGenBuffers(1, &m_buffer);
+				glBindBuffer(m_target, m_buffer);
+				m_persistent = false;
+			}
+		}
+		if (!m_persistent)
+			glBufferData(m_target, REGIONS * m_stride, NULL, GL_DYNAMIC_DRAW);
+		glBindBuffer(m_target, 0);
+	}
+
+	void release()
+	{
+		for (int i = 0; i < REGIONS; i++) {
+			if (m_fences[i]) glDeleteSync(m_fences[i]);
+			m_fences[i] = 0;
+		}
+		if (m_buffer) {
+			if (m_mapped) {
+				glBindBuffer(m_target, m_buffer);
+				glUnmapBuffer(m_target);
+				glBindBuffer(m_target, 0);
+			}
+			glDeleteBuffers(1, &m_buffer);
+		}
+		m_buffer = 0;
+		m_mapped = NULL;
+		m_region = -1;
+	}
+
+	DynamicBuffer(const DynamicBuffer&);
+	DynamicBuffer& operator=(const DynamicBuffer&);
+};
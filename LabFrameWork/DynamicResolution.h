@@ -0,0 +1,140 @@
+#pragma once
+
+/*
+	Keeps the ray tracing dispatch inside a frame time budget by scaling its resolution.
+
+	The work between beginWork() and endWork() is timed with a GL_TIME_ELAPSED query from a
+	ring of QUERY_LATENCY, read back only once it is available so the CPU never waits on
+	the GPU. Drivers whose timer queries report nonsense (llvmpipe answers 1 ns, see
+	ComputeTuner) are timed instead by the CPU interval between two frames that both did
+	the work, which on those is dominated by it.
+
+	The cost is taken as proportional to the pixel count, so every time is first brought
+	to the current scale (a sample taken at 0.5 costs four times as much at 1.0). update()
+	then keeps a smoothed time and moves the scale by the square root of budget / time,
+	at most 15% per update, and only when the time leaves [0.8, 1] x budget so it settles
+	instead of hunting. The scale stays in [0.25, 1].
+*/
+
+#include <cmath>
+#include <chrono>
+#include <algorithm>
+
+#include "GL/glew.h"
+
+class DynamicResolution
+{
+public:
+	static const int QUERY_LATENCY = 3;
+
+	// budget in ms, 0 keeps the full resolution
+	DynamicResolution(float budget = 16.7f) : m_budget(budget), m_scale(1), m_time(0), m_next(0),
+		m_timerBroken(false), m_lastBegin(-1), m_lastScale(1), m_cpuTime(0), m_cpuScale(0)
+	{
+		for (int i = 0; i < QUERY_LATENCY; i++) {
+			m_queries[i] = 0;
+			m_pending[i] = false;
+			m_queryScale[i] = 1;
+		}
+	}
+
+	~DynamicResolution()
+	{
+		if (m_queries[0]) glDeleteQueries(QUERY_LATENCY, m_queries);
+	}
+
+	void setBudget(float budget) { m_budget = std::max(0.0f, budget); if (m_budget == 0) m_scale = 1; }
+	float budget() const { return m_budget; }
+	float scale() const { return m_scale; }
+	float time() const { return m_time; }   /// smoothed ms of the work at the current scale
+
+	// Around the timed work, `scale` is the resolution scale it runs at
+	void beginWork(float scale)
+	{
+		if (!m_queries[0]) glGenQueries(QUERY_LATENCY, m_queries);
+
+		double now = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		if (m_lastBegin >= 0) {
+			m_cpuTime = (float)(now - m_lastBegin);
+			m_cpuScale = m_lastScale;
+		}
+		m_lastBegin = now;
+		m_lastScale = scale;
+
+		// a slot whose result never showed up is reused, its time is lost
+		m_pending[m_next] = false;
+		m_queryScale[m_next] = scale;
+		glBeginQuery(GL_TIME_ELAPSED, m_queries[m_next]);
+	}
+
+	void endWork()
+	{
+		glEndQuery(GL_TIME_ELAPSED);
+		m_pending[m_next] = true;
+		m_next = (m_next + 1) % QUERY_LATENCY;
+	}
+
+	// A frame without the work: the next CPU interval isn't a frame time
+	void idle() { m_lastBegin = -1; }
+
+	// Reads the finished timings and adjusts the scale, true when it changed
+	bool update()
+	{
+		float sample = -1;
+		for (int i = 0; i < QUERY_LATENCY; i++) {
+			int slot = (m_next + i) % QUERY_LATENCY;     // oldest first
+			if (!m_pending[slot]) continue;
+			GLint available = 0;
+			glGetQueryObjectiv(m_queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) continue;
+			GLuint64 ns = 0;
+			glGetQueryObjectui64v(m_queries[slot], GL_QUERY_RESULT, &ns);
+			m_pending[slot] = false;
+			// a dispatch over a whole image can't take under a microsecond
+			if (ns < 1000) m_timerBroken = true;
+			else sample = atScale((float)(ns / 1e6), m_queryScale[slot]);
+		}
+		if (m_timerBroken) {
+			sample = m_cpuScale > 0 ? atScale(m_cpuTime, m_cpuScale) : -1;
+			m_cpuScale = 0;
+		}
+		if (sample < 0 || m_budget == 0)
+			return false;
+
+		const float minScale = 0.25f, lowWater = 0.8f, maxStep = 1.15f;
+		m_time = m_time == 0 ? sample : m_time + 0.3f * (sample - m_time);
+		if (m_time <= m_budget && (m_time >= lowWater * m_budget || m_scale == 1))
+			return false;
+
+		// aim for the middle of the band
+		float step = std::sqrt((1 + lowWater) * 0.5f * m_budget / m_time);
+		float scale = std::max(minScale, std::min(1.0f, m_scale * std::max(1 / maxStep, std::min(maxStep, step))));
+		if (scale == m_scale)
+			return false;
+		m_time *= (scale / m_scale) * (scale / m_scale);
+		m_scale = scale;
+		return true;
+	}
+
+private:
+	float m_budget;
+	float m_scale;
+	float m_time;
+
+	GLuint m_queries[QUERY_LATENCY];
+	bool m_pending[QUERY_LATENCY];          /// ended, result not read yet
+	float m_queryScale[QUERY_LATENCY];
+	int m_next;
+
+	bool m_timerBroken;
+	double m_lastBegin;                     /// ms, -1 after a frame without the work
+	float m_lastScale;
+	float m_cpuTime;                        /// last interval between two frames with the work
+	float m_cpuScale;                       /// scale of that interval's frame, 0 once used
+
+	// `time` measured at `scale`, brought to the current one
+	float atScale(float time, float scale) const
+	{
+		return time * (m_scale / scale) * (m_scale / scale);
+	}
+};
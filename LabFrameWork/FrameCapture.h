@@ -0,0 +1,350 @@
+#pragma once
+
+/*
+	Captures rendered frames to disk without stalling the GL pipeline.
+
+	capture() only queues a glReadPixels of the current read framebuffer into the next of
+	RING_SIZE pixel pack buffers and fences it. The copy is mapped RING_SIZE - 1 frames later,
+	when its fence has long passed, so the CPU never waits on the GPU unless the ring comes
+	around before the GPU got there (counted as GPU waits). The mapped pixels are copied into
+	a frame from a small pool and handed to a writer thread, which flips, converts and writes
+	them as a PPM sequence, one raw RGB24 stream or a YUV4MPEG2 (4:4:4) stream, picked by the
+	output name.
+
+	The writer queue holds at most `maxQueued` frames. When the disk can't keep up a new frame
+	either waits for room (BLOCK, the render loop slows down to the disk's pace) or is dropped
+	(DROP, the render loop keeps its pace). Either is counted and report() sums it up.
+*/
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+
+#include "GL/glew.h"
+
+class FrameCapture
+{
+public:
+	static const int RING_SIZE = 3;
+
+	enum Format { PPM_SEQUENCE, RAW_RGB, Y4M };
+	enum Backpressure { BLOCK, DROP };
+
+	// `path` is a printf pattern taking the frame number for a PPM sequence, a file name
+	// ending in .y4m or .raw otherwise; `fps` only goes into the Y4M header
+	FrameCapture(const std::string& path, Backpressure backpressure = BLOCK, int maxQueued = 8, int fps = 30)
+		: m_path(path), m_format(formatOf(path)), m_backpressure(backpressure), m_maxQueued(std::max(1, maxQueued)), m_fps(fps),
+		m_width(0), m_height(0), m_next(0), m_frameNumber(0), m_stop(false), m_failed(false),
+		m_captured(0), m_written(0), m_dropped(0), m_gpuWaits(0), m_blockedMs(0), m_maxBacklog(0)
+	{
+		for (int i = 0; i < RING_SIZE; i++) {
+			m_buffers[i] = 0;
+			m_fences[i] = 0;
+		}
+		m_writer = std::thread(&FrameCapture::writeLoop, this);
+	}
+
+	~FrameCapture()
+	{
+		finish();
+		if (m_buffers[0]) glDeleteBuffers(RING_SIZE, m_buffers);
+	}
+
+	static Format formatOf(const std::string& path)
+	{
+		std::string ext = path.substr(path.find_last_of('.') == std::string::npos ? path.size() : path.find_last_of('.'));
+		if (ext == ".y4m") return Y4M;
+		if (ext == ".raw" || ext == ".rgb") return RAW_RGB;
+		return PPM_SEQUENCE;
+	}
+
+	// Reads back the current read framebuffer, `width` by `height` from the lower left corner.
+	// Every frame of a Y4M or raw stream has the size of the first one.
+	void capture(int width, int height)
+	{
+		if (m_failed || width <= 0 || height <= 0)
+			return;
+		if (!m_buffers[0]) glGenBuffers(RING_SIZE, m_buffers);
+		if (m_format != PPM_SEQUENCE && m_width != 0 && (width != m_width || height != m_height)) {
+			std::cout << "Frame capture: a " << width << " x " << height << " frame doesn't fit the " << m_width << " x " << m_height << " stream, skipped" << std::endl;
+			return;
+		}
+
+		// the oldest copies are due first, the one in the slot about to be reused has to be
+		collect(false);
+		if (m_fences[m_next]) {
+			m_gpuWaits++;
+			retire(m_next, true);
+		}
+
+		Slot& slot = m_slots[m_next];
+		slot.width = width;
+		slot.height = height;
+		slot.number = m_frameNumber++;
+		if (m_width == 0) {
+			m_width = width;
+			m_height = height;
+		}
+
+		size_t size = 4 * (size_t)width * height;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, m_buffers[m_next]);
+		if (slot.capacity < size) {
+			glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+			slot.capacity = size;
+		}
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		m_fences[m_next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		m_next = (m_next + 1) % RING_SIZE;
+		m_captured++;
+	}
+
+	// Frames waiting for the writer
+	int backlog()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return (int)m_queue.size();
+	}
+
+	bool failed() const { return m_failed; }
+
+	// Reads back the frames still in flight and waits until the writer stored everything
+	void finish()
+	{
+		if (!m_writer.joinable())
+			return;
+		for (int i = 0; i < RING_SIZE; i++)
+			retire((m_next + i) % RING_SIZE, true);
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_queued.notify_all();
+		m_writer.join();
+	}
+
+	std::string report()
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::ostringstream os;
+		os << "Frame capture: " << m_captured << " captured, " << m_written << " written to " << m_path;
+		if (m_dropped > 0) os << ", " << m_dropped << " dropped (disk too slow)";
+		if (m_blockedMs > 0) os << ", " << m_blockedMs << " ms waiting for the disk";
+		if (m_gpuWaits > 0) os << ", " << m_gpuWaits << " waits on the GPU";
+		os << ", backlog peaked at " << m_maxBacklog << " of " << m_maxQueued;
+		if (m_failed) os << ", FAILED writing";
+		return os.str();
+	}
+
+private:
+	struct Slot {
+		int width, height;
+		int number;
+		size_t capacity;
+		Slot() : width(0), height(0), number(0), capacity(0) {}
+	};
+
+	struct Frame {
+		int width, height;
+		int number;
+		std::vector<unsigned char> rgba;    /// bottom row first, as read
+	};
+
+	std::string m_path;
+	Format m_format;
+	Backpressure m_backpressure;
+	int m_maxQueued;
+	int m_fps;
+	int m_width, m_height;                  /// of the first frame, the size of a stream
+
+	GLuint m_buffers[RING_SIZE];
+	GLsync m_fences[RING_SIZE];             /// 0 once the slot's frame went to the writer
+	Slot m_slots[RING_SIZE];
+	int m_next;
+	int m_frameNumber;
+
+	std::thread m_writer;
+	std::mutex m_mutex;
+	std::condition_variable m_queued;       /// a frame was queued or the capture stopped
+	std::condition_variable m_taken;        /// the writer took a frame off the queue
+	std::deque<Frame*> m_queue;
+	std::vector<Frame*> m_pool;             /// written frames, their memory is reused
+	bool m_stop;
+	volatile bool m_failed;
+
+	int m_captured, m_written, m_dropped, m_gpuWaits;
+	double m_blockedMs;
+	int m_maxBacklog;
+
+	// Hands every finished copy to the writer, oldest first
+	void collect(bool wait)
+	{
+		for (int i = 0; i < RING_SIZE; i++) {
+			int slot = (m_next + i) % RING_SIZE;
+			if (!m_fences[slot])
+				continue;
+			GLenum status = glClientWaitSync(m_fences[slot], 0, 0);
+			if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED && !wait)
+				break;      // keeps the frames in order
+			retire(slot, true);
+		}
+	}
+
+	void retire(int index, bool wait)
+	{
+		if (!m_fences[index])
+			return;
+		if (wait)
+			glClientWaitSync(m_fences[index], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(m_fences[index]);
+		m_fences[index] = 0;
+
+		const Slot& slot = m_slots[index];
+		Frame* frame = takeFrame();
+		if (!frame) {
+			m_dropped++;
+			return;
+		}
+		frame->width = slot.width;
+		frame->height = slot.height;
+		frame->number = slot.number;
+		size_t size = 4 * (size_t)slot.width * slot.height;
+		frame->rgba.resize(size);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, m_buffers[index]);
+		const void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+		if (pixels) {
+			memcpy(frame->rgba.data(), pixels, size);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_queue.push_back(frame);
+			m_maxBacklog = std::max(m_maxBacklog, (int)m_queue.size());
+		}
+		m_queued.notify_one();
+	}
+
+	// A free frame, NULL when the queue is full and frames are dropped
+	Frame* takeFrame()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		if ((int)m_queue.size() >= m_maxQueued) {
+			if (m_backpressure == DROP)
+				return NULL;
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			m_taken.wait(lock, [this] { return (int)m_queue.size() < m_maxQueued; });
+			m_blockedMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+		if (m_pool.empty())
+			return new Frame();
+		Frame* frame = m_pool.back();
+		m_pool.pop_back();
+		return frame;
+	}
+
+	void writeLoop()
+	{
+		std::ofstream stream;
+		std::vector<unsigned char> row;
+		for (;;) {
+			Frame* frame;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_queued.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+				if (m_queue.empty())
+					break;
+				frame = m_queue.front();
+				m_queue.pop_front();
+			}
+			m_taken.notify_one();
+
+			bool ok = !m_failed && write(*frame, stream, row);
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (ok) m_written++;
+				else m_failed = true;
+				m_pool.push_back(frame);
+			}
+		}
+		for (size_t i = 0; i < m_pool.size(); i++)
+			delete m_pool[i];
+		m_pool.clear();
+	}
+
+	bool write(const Frame& frame, std::ofstream& stream, std::vector<unsigned char>& row)
+	{
+		std::ofstream single;
+		std::ofstream* os = &stream;
+		if (m_format == PPM_SEQUENCE) {
+			char name[1024];
+			snprintf(name, sizeof(name), m_path.c_str(), frame.number);
+			single.open(name, std::ios::out | std::ios::binary);
+			os = &single;
+			if (!single.good()) {
+				std::cout << "Failed to open file: " << name << std::endl;
+				return false;
+			}
+			single << "P6\n" << frame.width << " " << frame.height << "\n255\n";
+		}
+		else if (!stream.is_open()) {
+			stream.open(m_path.c_str(), std::ios::out | std::ios::binary);
+			if (!stream.good()) {
+				std::cout << "Failed to open file: " << m_path << std::endl;
+				return false;
+			}
+			if (m_format == Y4M)
+				stream << "YUV4MPEG2 W" << frame.width << " H" << frame.height << " F" << m_fps << ":1 Ip A1:1 C444 XCOLORRANGE=FULL\n";
+		}
+		if (m_format == Y4M)
+			*os << "FRAME\n";
+
+		// top row first
+		int width = frame.width;
+		if (m_format == Y4M) {
+			// planar full range BT.601 YCbCr, which the header's XCOLORRANGE=FULL tells readers
+			row.resize(width);
+			for (int plane = 0; plane < 3; plane++) {
+				for (int y = frame.height - 1; y >= 0; y--) {
+					const unsigned char* p = &frame.rgba[4 * (size_t)y * width];
+					for (int x = 0; x < width; x++, p += 4) {
+						float r = p[0], g = p[1], b = p[2];
+						float v = plane == 0 ? 0.299f * r + 0.587f * g + 0.114f * b
+							: plane == 1 ? 128 - 0.168736f * r - 0.331264f * g + 0.5f * b
+							: 128 + 0.5f * r - 0.418688f * g - 0.081312f * b;
+						row[x] = (unsigned char)std::max(0.0f, std::min(255.0f, v + 0.5f));
+					}
+					os->write((const char*)row.data(), width);
+				}
+			}
+		}
+		else {
+			row.resize(3 * width);
+			for (int y = frame.height - 1; y >= 0; y--) {
+				const unsigned char* p = &frame.rgba[4 * (size_t)y * width];
+				for (int x = 0; x < width; x++, p += 4) {
+					row[3 * x] = p[0];
+					row[3 * x + 1] = p[1];
+					row[3 * x + 2] = p[2];
+				}
+				os->write((const char*)row.data(), row.size());
+			}
+		}
+		return os->good();
+	}
+
+	FrameCapture(const FrameCapture&);
+	FrameCapture& operator=(const FrameCapture&);
+};
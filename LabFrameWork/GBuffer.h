@@ -0,0 +1,125 @@
+#pragma once
+
+/*
+	G-buffer of the hybrid renderer.
+
+	Primary rays are the most coherent rays there are, and rasterizing them is cheaper than
+	tracing them: gbuffer.vert / gbuffer.frag draw the scene objects into this framebuffer,
+	each fragment running the ray test of its object for the pixel's primary ray, so every
+	pixel ends up with what the tracer's first intersectScene() would have found. The compute
+	tracer then starts from there (HYBRID in RayTracing.comp) and only traces reflections.
+
+	Mesh objects are drawn a triangle per BLAS leaf slot from the scene mesh's position
+	buffer. For the skinned instances (labFrameWork --headless --crowd) that is the pose
+	SkinnedMesh wrote for the frame.
+
+	Per pixel: the normal of the hit and its distance along the ray (RGBA32F), the object hit
+	or -1 (R32I), and a depth of 1 / (1 + distance) that keeps the closest hit.
+*/
+
+#include <iostream>
+
+#include "GL/glew.h"
+
+// Image units RayTracing.comp reads the G-buffer from, 0 is its output and 1, 2 are Reconstruct.comp's
+enum GBufferUnit {
+	GBUFFER_HIT_UNIT = 3,
+	GBUFFER_OBJECT_UNIT = 4
+};
+
+class GBuffer
+{
+public:
+	GBuffer() : m_framebuffer(0), m_hit(0), m_object(0), m_depth(0), m_width(0), m_height(0), m_previous(0) {}
+
+	~GBuffer()
+	{
+		if (m_framebuffer) {
+			glDeleteFramebuffers(1, &m_framebuffer);
+			glDeleteTextures(1, &m_hit);
+			glDeleteTextures(1, &m_object);
+			glDeleteTextures(1, &m_depth);
+		}
+	}
+
+	// Sized like the traced image, passes draw into the bottom left w x h of it
+	void resize(int w, int h)
+	{
+		if (w == m_width && h == m_height)
+			return;
+		if (!m_framebuffer) {
+			glGenFramebuffers(1, &m_framebuffer);
+			glGenTextures(1, &m_hit);
+			glGenTextures(1, &m_object);
+			glGenTextures(1, &m_depth);
+		}
+		m_width = w;
+		m_height = h;
+		// the scene presents the texture left bound
+		GLint texture = 0;
+		glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+		glBindTexture(GL_TEXTURE_2D, m_hit);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, w, h, 0, GL_RGBA, GL_FLOAT, NULL);
+		glBindTexture(GL_TEXTURE_2D, m_object);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32I, w, h, 0, GL_RED_INTEGER, GL_INT, NULL);
+		glBindTexture(GL_TEXTURE_2D, m_depth);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, w, h, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glBindTexture(GL_TEXTURE_2D, texture);
+
+		GLint previous = 0;
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_hit, 0);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, m_object, 0);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_depth, 0);
+		const GLenum buffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+		glDrawBuffers(2, buffers);
+		if (glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "G-buffer framebuffer incomplete" << std::endl;
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, previous);
+	}
+
+	// Draws go to the G-buffer, cleared to no hit, until end(). Restores the framebuffer
+	// bound before, the window's or an offscreen one.
+	void begin(int w, int h)
+	{
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_previous);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_framebuffer);
+		glViewport(0, 0, w, h);
+
+		const GLfloat noHit[4] = { 0, 0, 0, -1 };
+		const GLint noObject[4] = { -1, 0, 0, 0 };
+		const GLfloat farthest = 0;
+		glClearBufferfv(GL_COLOR, 0, noHit);
+		glClearBufferiv(GL_COLOR, 1, noObject);
+		glClearBufferfv(GL_DEPTH, 0, &farthest);
+		glEnable(GL_DEPTH_TEST);
+		glDepthFunc(GL_GREATER);
+	}
+
+	void end()
+	{
+		// the depth function RayTracingScene sets up
+		glDepthFunc(GL_LEQUAL);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_previous);
+	}
+
+	// For RayTracing.comp built with HYBRID
+	void bindImages() const
+	{
+		glBindImageTexture(GBUFFER_HIT_UNIT, m_hit, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+		glBindImageTexture(GBUFFER_OBJECT_UNIT, m_object, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32I);
+	}
+
+private:
+	GLuint m_framebuffer;
+	GLuint m_hit;
+	GLuint m_object;
+	GLuint m_depth;
+	int m_width;
+	int m_height;
+	GLint m_previous;
+
+	GBuffer(const GBuffer&);
+	GBuffer& operator=(const GBuffer&);
+};
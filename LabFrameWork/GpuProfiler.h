@@ -0,0 +1,299 @@
+#pragma once
+
+/*
+	Frame profiler for the GL passes.
+
+	Scopes nest and time both sides: the CPU with std::chrono and the GPU with a pair of
+	GL_TIMESTAMP queries (GL_TIME_ELAPSED queries can't nest). Queries are taken from one
+	pool per frame in a ring of FRAME_LATENCY frames and only read back when their slot
+	comes around again, so reading never waits on the GPU; a frame whose queries still
+	aren't done by then keeps its CPU times only.
+
+	Resolved frames feed a rolling average per scope, printed by summary() about once a
+	second, and the last TRACE_FRAMES frames can be written as Chrome trace JSON
+	(chrome://tracing or ui.perfetto.dev), CPU and GPU on separate tracks.
+
+	Use GpuProfiler::get().beginFrame() / endFrame() around a frame and a ProfileScope
+	object per block. Scopes outside a frame cost nothing. release() the queries before
+	the context is destroyed.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <chrono>
+
+#include "GL/glew.h"
+
+class GpuProfiler
+{
+public:
+	static const int FRAME_LATENCY = 4;
+	static const size_t TRACE_FRAMES = 300;
+
+	static GpuProfiler& get()
+	{
+		static GpuProfiler profiler;
+		return profiler;
+	}
+
+	// Deletes the queries. The profiler lives until static destruction, after the context
+	// is gone, so call this while the context is still current. The frames not read back
+	// yet lose their GPU times; a later frame starts over with new queries.
+	void release()
+	{
+		for (int i = 0; i < FRAME_LATENCY; i++) {
+			Frame& frame = m_frames[i];
+			if (!frame.queries.empty())
+				glDeleteQueries((GLsizei)frame.queries.size(), frame.queries.data());
+			frame.queries.clear();
+			frame.scopes.clear();
+			frame.usedQueries = 0;
+			frame.pending = false;
+		}
+		m_open.clear();
+		m_inFrame = false;
+		m_calibrated = false;
+	}
+
+	void beginFrame()
+	{
+		m_current = (m_current + 1) % FRAME_LATENCY;
+		Frame& frame = m_frames[m_current];
+		if (frame.pending)
+			resolve(frame);
+
+		frame.scopes.clear();
+		frame.usedQueries = 0;
+		frame.pending = false;
+		m_open.clear();
+		m_inFrame = true;
+
+		if (!m_calibrated) {
+			// maps GPU timestamps onto the CPU clock of the trace
+			GLint64 gpuNow = 0;
+			glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+			m_gpuToCpu = now() - gpuNow / 1e6;
+			m_calibrated = true;
+		}
+	}
+
+	void endFrame()
+	{
+		if (!m_inFrame)
+			return;
+		while (!m_open.empty())
+			endScope();
+		m_frames[m_current].pending = true;
+		m_inFrame = false;
+	}
+
+	// `gpu` false for blocks that issue no GL work
+	void beginScope(const char* name, bool gpu = true)
+	{
+		if (!m_inFrame)
+			return;
+		Frame& frame = m_frames[m_current];
+		Scope scope;
+		scope.name = name;
+		scope.depth = (int)m_open.size();
+		scope.cpuBegin = now();
+		scope.cpuEnd = scope.cpuBegin;
+		scope.query = gpu ? takeQueries(frame) : -1;
+		if (scope.query >= 0)
+			glQueryCounter(frame.queries[scope.query], GL_TIMESTAMP);
+		m_open.push_back(frame.scopes.size());
+		frame.scopes.push_back(scope);
+	}
+
+	void endScope()
+	{
+		if (!m_inFrame || m_open.empty())
+			return;
+		Frame& frame = m_frames[m_current];
+		Scope& scope = frame.scopes[m_open.back()];
+		m_open.pop_back();
+		if (scope.query >= 0)
+			glQueryCounter(frame.queries[scope.query + 1], GL_TIMESTAMP);
+		scope.cpuEnd = now();
+	}
+
+	// Average CPU and GPU milliseconds of every scope since the last call that returned
+	// something, one line per scope indented by depth, or only the scopes right under the
+	// outermost one on a single line. Empty until a second went by.
+	std::string summary(bool oneLine = false)
+	{
+		double elapsed = now() - m_windowStart;
+		if (m_windowFrames == 0 || elapsed < 1000.0)
+			return "";
+
+		std::ostringstream os;
+		os << std::fixed << std::setprecision(2);
+		os << m_windowFrames * 1000.0 / elapsed << " fps";
+		for (size_t i = 0; i < m_order.size(); i++) {
+			const Stat& stat = m_stats[m_order[i]];
+			if (stat.cpuCount == 0) continue;
+			if (oneLine) {
+				if (stat.depth != 1) continue;
+				os << " | " << m_order[i];
+			}
+			else {
+				os << "\n" << std::string(2 * stat.depth, ' ') << m_order[i];
+			}
+			os << " cpu " << stat.cpuSum / stat.cpuCount << " ms";
+			if (stat.gpuCount > 0) os << " gpu " << stat.gpuSum / stat.gpuCount << " ms";
+		}
+		if (m_droppedFrames > 0) os << (oneLine ? " | " : "\n") << m_droppedFrames << " frames without GPU times";
+
+		m_stats.clear();
+		m_order.clear();
+		m_windowFrames = 0;
+		m_droppedFrames = 0;
+		m_windowStart = now();
+		return os.str();
+	}
+
+	bool writeChromeTrace(const std::string& path) const
+	{
+		std::ofstream os(path.c_str());
+		if (!os) {
+			std::cout << "Could not write profile trace " << path << std::endl;
+			return false;
+		}
+		os << std::fixed << std::setprecision(3) << "{\"traceEvents\":[\n"
+			<< "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n"
+			<< "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+		for (size_t f = 0; f < m_trace.size(); f++) {
+			for (size_t i = 0; i < m_trace[f].size(); i++) {
+				const TraceEvent& e = m_trace[f][i];
+				os << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << (e.gpu ? 2 : 1)
+					<< ",\"ts\":" << e.begin * 1000.0 << ",\"dur\":" << (e.end - e.begin) * 1000.0 << "}";
+			}
+		}
+		os << "\n]}\n";
+		std::cout << "Profile trace of " << m_trace.size() << " frames written to " << path << std::endl;
+		return true;
+	}
+
+private:
+	struct Scope {
+		std::string name;
+		int depth;
+		double cpuBegin, cpuEnd;    /// ms on the steady clock
+		int query;                  /// first of two timestamp queries, -1 for CPU only scopes
+	};
+
+	struct Frame {
+		std::vector<Scope> scopes;
+		std::vector<GLuint> queries;
+		size_t usedQueries;
+		bool pending;               /// ended, results not read yet
+		Frame() : usedQueries(0), pending(false) {}
+	};
+
+	struct Stat {
+		int depth;
+		double cpuSum, gpuSum;
+		int cpuCount, gpuCount;
+		Stat() : depth(0), cpuSum(0), gpuSum(0), cpuCount(0), gpuCount(0) {}
+	};
+
+	struct TraceEvent {
+		std::string name;
+		double begin, end;          /// ms on the steady clock
+		bool gpu;
+	};
+
+	Frame m_frames[FRAME_LATENCY];
+	int m_current;
+	bool m_inFrame;
+	std::vector<size_t> m_open;     /// indices of the open scopes of the current frame
+
+	std::map<std::string, Stat> m_stats;
+	std::vector<std::string> m_order; /// scope names in first seen order, for the summary
+	int m_windowFrames;
+	int m_droppedFrames;
+	double m_windowStart;
+
+	std::deque<std::vector<TraceEvent> > m_trace;
+	bool m_calibrated;
+	double m_gpuToCpu;              /// ms to add to a GPU timestamp in ms
+
+	GpuProfiler() : m_current(0), m_inFrame(false), m_windowFrames(0), m_droppedFrames(0), m_calibrated(false), m_gpuToCpu(0)
+	{
+		m_windowStart = now();
+	}
+	GpuProfiler(const GpuProfiler&);
+	GpuProfiler& operator=(const GpuProfiler&);
+
+	static double now()
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	int takeQueries(Frame& frame)
+	{
+		if (frame.usedQueries + 2 > frame.queries.size()) {
+			size_t first = frame.queries.size();
+			frame.queries.resize(first + 16);
+			glGenQueries(16, &frame.queries[first]);
+		}
+		frame.usedQueries += 2;
+		return (int)frame.usedQueries - 2;
+	}
+
+	// Reads a frame that ended FRAME_LATENCY - 1 frames ago, without waiting
+	void resolve(const Frame& frame)
+	{
+		bool gpuReady = true;
+		for (size_t i = 0; i < frame.scopes.size() && gpuReady; i++) {
+			if (frame.scopes[i].query < 0) continue;
+			GLint available = 0;
+			glGetQueryObjectiv(frame.queries[frame.scopes[i].query + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+			gpuReady = available != 0;
+		}
+		if (!gpuReady) m_droppedFrames++;
+
+		std::vector<TraceEvent> events;
+		for (size_t i = 0; i < frame.scopes.size(); i++) {
+			const Scope& scope = frame.scopes[i];
+			if (m_stats.find(scope.name) == m_stats.end()) m_order.push_back(scope.name);
+			Stat& stat = m_stats[scope.name];
+			stat.depth = scope.depth;
+			stat.cpuSum += scope.cpuEnd - scope.cpuBegin;
+			stat.cpuCount++;
+			TraceEvent cpu = { scope.name, scope.cpuBegin, scope.cpuEnd, false };
+			events.push_back(cpu);
+
+			if (scope.query < 0 || !gpuReady) continue;
+			GLuint64 begin = 0, end = 0;
+			glGetQueryObjectui64v(frame.queries[scope.query], GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(frame.queries[scope.query + 1], GL_QUERY_RESULT, &end);
+			stat.gpuSum += (end - begin) / 1e6;
+			stat.gpuCount++;
+			TraceEvent gpu = { scope.name, begin / 1e6 + m_gpuToCpu, end / 1e6 + m_gpuToCpu, true };
+			events.push_back(gpu);
+		}
+		m_windowFrames++;
+
+		m_trace.push_back(events);
+		if (m_trace.size() > TRACE_FRAMES) m_trace.pop_front();
+	}
+};
+
+// Times the enclosing block
+class ProfileScope
+{
+public:
+	ProfileScope(const char* name, bool gpu = true) { GpuProfiler::get().beginScope(name, gpu); }
+	~ProfileScope() { GpuProfiler::get().endScope(); }
+
+private:
+	ProfileScope(const ProfileScope&);
+	ProfileScope& operator=(const ProfileScope&);
+};
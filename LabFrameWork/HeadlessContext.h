@@ -0,0 +1,184 @@
+#pragma once
+
+/*
+	Offscreen GL context for rendering without a display.
+
+	On Linux the context comes from EGL with no surface at all (EGL_MESA_platform_surfaceless,
+	else the default display with EGL_KHR_surfaceless_context), which works on render nodes
+	without X or Wayland and without a GPU through Mesa's llvmpipe. Elsewhere it falls back to
+	a hidden GLFW window. Either way frames are drawn into an FBO of the requested size, bound
+	as the default framebuffer for as long as the context lives, and saveFrame() writes it out
+	as a PPM.
+
+	Link with -lEGL on Linux.
+*/
+
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "GL/glew.h"
+
+#ifdef _WIN32
+#include <GLFW/glfw3.h>
+#else
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+class HeadlessContext
+{
+public:
+	HeadlessContext() : m_width(0), m_height(0), m_framebuffer(0), m_color(0), m_depth(0)
+	{
+#ifdef _WIN32
+		m_window = NULL;
+#else
+		m_display = EGL_NO_DISPLAY;
+		m_context = EGL_NO_CONTEXT;
+#endif
+	}
+
+	~HeadlessContext() { destroy(); }
+
+	// Makes a GL 4.3 core context current, call glewInit() next and then createFramebuffer()
+	bool create()
+	{
+#ifdef _WIN32
+		if (!glfwInit()) {
+			std::cout << "GLFW Initialization has failed" << std::endl;
+			return false;
+		}
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		m_window = glfwCreateWindow(16, 16, "headless", NULL, NULL);
+		if (!m_window) {
+			std::cout << "Hidden GLFW window create failed" << std::endl;
+			return false;
+		}
+		glfwMakeContextCurrent(m_window);
+		return true;
+#else
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay)
+			m_display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		EGLint major, minor;
+		if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, &major, &minor)) {
+			m_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+			if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, &major, &minor)) {
+				std::cout << "EGL initialization has failed" << std::endl;
+				return false;
+			}
+		}
+		if (!eglBindAPI(EGL_OPENGL_API)) {
+			std::cout << "EGL has no desktop OpenGL" << std::endl;
+			return false;
+		}
+
+		// no surface, so no config is needed either
+		const EGLint attributes[] = {
+			EGL_CONTEXT_MAJOR_VERSION, 4,
+			EGL_CONTEXT_MINOR_VERSION, 3,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE
+		};
+		m_context = eglCreateContext(m_display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+		if (m_context == EGL_NO_CONTEXT || !eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_context)) {
+			std::cout << "EGL " << major << "." << minor << " could not make a surfaceless GL 4.3 core context current" << std::endl;
+			return false;
+		}
+		return true;
+#endif
+	}
+
+	// The frames' target, RGBA8 colour and a depth buffer for the rasterized passes
+	bool createFramebuffer(int width, int height)
+	{
+		m_width = width;
+		m_height = height;
+		glGenRenderbuffers(1, &m_color);
+		glBindRenderbuffer(GL_RENDERBUFFER, m_color);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glGenRenderbuffers(1, &m_depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, m_depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glGenFramebuffers(1, &m_framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_color);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depth);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			std::cout << "Headless framebuffer is incomplete" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+
+	// Writes the framebuffer as a binary PPM, top row first
+	bool saveFrame(const std::string& path)
+	{
+		std::vector<unsigned char> pixels(3 * m_width * m_height);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, m_width, m_height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+
+		std::ofstream ofs(path.c_str(), std::ios::out | std::ios::binary);
+		if (!ofs.good()) {
+			std::cout << "Failed to open file: " << path << std::endl;
+			return false;
+		}
+		ofs << "P6\n" << m_width << " " << m_height << "\n255\n";
+		for (int y = m_height - 1; y >= 0; y--)
+			ofs.write((const char*)&pixels[3 * y * m_width], 3 * m_width);
+		return ofs.good();
+	}
+
+	void destroy()
+	{
+		if (m_framebuffer) {
+			glDeleteFramebuffers(1, &m_framebuffer);
+			glDeleteRenderbuffers(1, &m_color);
+			glDeleteRenderbuffers(1, &m_depth);
+			m_framebuffer = m_color = m_depth = 0;
+		}
+#ifdef _WIN32
+		if (m_window) {
+			glfwDestroyWindow(m_window);
+			glfwTerminate();
+			m_window = NULL;
+		}
+#else
+		if (m_context != EGL_NO_CONTEXT) {
+			eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			eglDestroyContext(m_display, m_context);
+			m_context = EGL_NO_CONTEXT;
+		}
+		if (m_display != EGL_NO_DISPLAY) {
+			eglTerminate(m_display);
+			m_display = EGL_NO_DISPLAY;
+		}
+#endif
+	}
+
+private:
+	int m_width, m_height;
+	GLuint m_framebuffer, m_color, m_depth;
+#ifdef _WIN32
+	GLFWwindow* m_window;
+#else
+	EGLDisplay m_display;
+	EGLContext m_context;
+#endif
+
+	HeadlessContext(const HeadlessContext&);
+	HeadlessContext& operator=(const HeadlessContext&);
+};
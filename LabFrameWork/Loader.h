@@ -10,6 +10,14 @@ version : 0.3 - 15 / 01 / 2014
 			via calls to addAttribute(<name - of - attribute>) and then the attribute
 			index can be obtained via myProgram.attribute(<name - of - attribute>) - Uniforms
 			work in the exact same way.
+
+		Linked programs are kept in an on-disk binary cache (glGetProgramBinary), one file
+			per program named after a hash of the GL vendor, renderer and version and of the
+			sources after defines were inserted. A later start with the same driver loads the
+			binary instead of compiling; when the driver rejects it, the program is compiled
+			and the file replaced. Nothing removes the files of earlier shader versions or
+			drivers, the directory grows until it is deleted, which is always safe. Set
+			binaryCacheDir() to "" to turn the cache off.
 */
 
 
@@ -20,7 +28,15 @@ version : 0.3 - 15 / 01 / 2014
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <iomanip>
 #include <map>
+#include <vector>
+#include <algorithm>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 
 #include "GL/glew.h"
 #include <GL/gl.h>
@@ -120,11 +136,113 @@ private:
 		return shaderId;
 	}
 
+	// Private method to get the cache file of a program from its sources, empty when the cache is off
+	std::string binaryCachePath(const std::string& sources)
+	{
+		if (binaryCacheDir().empty())
+			return "";
+
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		if (formats == 0)
+			return "";
+
+		std::ostringstream name;
+		name << binaryCacheDir() << "/" << std::hex << std::setw(16) << std::setfill('0') << hashSource(driverString() + "\n" + sources) << ".bin";
+		return name.str();
+	}
+
+	// Private method to load a cached binary into the program, false when there is none or the driver refuses it
+	bool loadBinary(const std::string& cachePath)
+	{
+		if (cachePath.empty())
+			return false;
+
+		std::ifstream file(cachePath.c_str(), std::ios::binary);
+		std::string magic, driver;
+		if (!std::getline(file, magic) || magic != "GLPROGRAMBINARY 1" || !std::getline(file, driver) || driver != driverString())
+			return false;
+
+		GLenum format = 0;
+		GLint length = 0;
+		file.read((char*)&format, sizeof(format));
+		file.read((char*)&length, sizeof(length));
+		if (!file || length <= 0)
+			return false;
+		std::vector<char> binary(length);
+		if (!file.read(binary.data(), length))
+			return false;
+
+		glProgramBinary(programId, format, binary.data(), length);
+		GLint programLinkSuccess = GL_FALSE;
+		glGetProgramiv(programId, GL_LINK_STATUS, &programLinkSuccess);
+		if (programLinkSuccess != GL_TRUE)
+		{
+			std::cout << "Cached program binary " << cachePath << " was rejected, compiling." << std::endl;
+			return false;
+		}
+
+		if (DEBUG)
+		{
+			std::cout << "Shader program loaded from " << cachePath << "." << std::endl;
+		}
+		return true;
+	}
+
+	// Private method to write the linked program to the cache
+	void storeBinary(const std::string& cachePath)
+	{
+		GLint programLinkSuccess = GL_FALSE, length = 0;
+		glGetProgramiv(programId, GL_LINK_STATUS, &programLinkSuccess);
+		glGetProgramiv(programId, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (cachePath.empty() || programLinkSuccess != GL_TRUE || length <= 0)
+			return;
+
+		std::vector<char> binary(length);
+		GLenum format = 0;
+		glGetProgramBinary(programId, length, &length, &format, binary.data());
+
+#ifdef _WIN32
+		_mkdir(binaryCacheDir().c_str());
+#else
+		mkdir(binaryCacheDir().c_str(), 0755);
+#endif
+		std::ofstream file(cachePath.c_str(), std::ios::binary);
+		file << "GLPROGRAMBINARY 1\n" << driverString() << "\n";
+		file.write((const char*)&format, sizeof(format));
+		file.write((const char*)&length, sizeof(length));
+		file.write(binary.data(), length);
+		if (!file)
+		{
+			std::cout << "Could not write program binary cache " << cachePath << std::endl;
+		}
+	}
+
+	// Private method to describe the driver a binary belongs to, on one line
+	static std::string driverString()
+	{
+		std::ostringstream os;
+		os << glGetString(GL_VENDOR) << " | " << glGetString(GL_RENDERER) << " | " << glGetString(GL_VERSION);
+		std::string driver = os.str();
+		for (size_t i = 0; i < driver.size(); i++)
+		{
+			if (driver[i] == '\n' || driver[i] == '\r') driver[i] = ' ';
+		}
+		return driver;
+	}
+
 	// Private method to compile/attach/link/verify the shaders.
 	// Note: Rather than returning a boolean as a success/fail status we'll just consider
 	// a failure here to be an unrecoverable error and throw a runtime_error.
 	void initialise(std::string vertexShaderSource, std::string fragmentShaderSource)
 	{
+		std::string cachePath = binaryCachePath(vertexShaderSource + '\0' + fragmentShaderSource);
+		if (loadBinary(cachePath))
+		{
+			initialised = true;
+			return;
+		}
+
 		// Compile the shaders and return their id values
 		vertexShaderId = compileShader(vertexShaderSource, GL_VERTEX_SHADER);
 		fragmentShaderId = compileShader(fragmentShaderSource, GL_FRAGMENT_SHADER);
@@ -134,6 +252,7 @@ private:
 		glAttachShader(programId, fragmentShaderId);
 
 		// Link the shader program - details are placed in the program info log
+		glProgramParameteri(programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 		glLinkProgram(programId);
 
 		// Once the shader program has the shaders attached and linked, the shaders are no longer required.
@@ -174,12 +293,21 @@ private:
 			std::cout << "Shader program validation failed: " << getInfoLog(ObjectType::PROGRAM, programId) << std::endl;
 		}
 
+		storeBinary(cachePath);
+
 		// Finally, the shader program is initialised
 		initialised = true;
 	}
 
 	void initialise(std::string computeShaderSource)
 	{
+		std::string cachePath = binaryCachePath(computeShaderSource);
+		if (loadBinary(cachePath))
+		{
+			initialised = true;
+			return;
+		}
+
 		// Compile the shaders and return their id values
 		computeShaderId = compileShader(computeShaderSource, GL_COMPUTE_SHADER);
 
@@ -187,6 +315,7 @@ private:
 		glAttachShader(programId, computeShaderId);
 
 		// Link the shader program - details are placed in the program info log
+		glProgramParameteri(programId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 		glLinkProgram(programId);
 
 		// Once the shader program has the shaders attached and linked, the shaders are no longer required.
@@ -226,12 +355,14 @@ private:
 			 std::cout << "Shader program validation failed: "  << getInfoLog(ObjectType::PROGRAM, programId) << std::endl;
 		}
 
+		storeBinary(cachePath);
+
 		// Finally, the shader program is initialised
 		initialised = true;
 	}
 
-	// Private method to load the shader source code from a file
-	std::string loadShaderFromFile(const std::string filename)
+	// Private method behind loadShaderFromFile, `included` lists the files read so far
+	static std::string loadShaderFromFile(const std::string& filename, std::vector<std::string>& included)
 	{
 		// Create an input filestream and attempt to open the specified file
 		std::ifstream file(filename.c_str());
@@ -242,16 +373,40 @@ private:
 			std::cout << "Failed to open file: "  <<  filename << std::endl;
 		}
 
-		// Otherwise, create a string stream...
-		std::stringstream stream;
+		size_t slash = filename.find_last_of("/\\");
+		std::string directory = (slash == std::string::npos) ? "" : filename.substr(0, slash + 1);
+		int sourceNumber = (int)included.size() - 1;
 
-		// ...and dump the contents of the file into it.
-		stream << file.rdbuf();
+		std::stringstream stream;
+		std::string line;
+		int lineNumber = 0;
+		while (std::getline(file, line))
+		{
+			lineNumber++;
+			size_t directive = line.find_first_not_of(" \t");
+			if (directive == std::string::npos || line.compare(directive, 8, "#include") != 0)
+			{
+				stream << line << "\n";
+				continue;
+			}
 
-		// Now that we've read the file we can close it
-		file.close();
+			size_t open = line.find('"', directive);
+			size_t close = (open == std::string::npos) ? open : line.find('"', open + 1);
+			if (close == std::string::npos)
+			{
+				std::cout << filename << ":" << lineNumber << ": malformed #include" << std::endl;
+				stream << "\n";
+				continue;
+			}
 
-		// Finally, convert the stringstream into a string and return it
+			std::string path = directory + line.substr(open + 1, close - open - 1);
+			if (std::find(included.begin(), included.end(), path) == included.end())
+			{
+				included.push_back(path);
+				stream << "#line 1 " << included.size() - 1 << "\n" << loadShaderFromFile(path, included);
+			}
+			stream << "#line " << lineNumber + 1 << " " << sourceNumber << "\n";
+		}
 		return stream.str();
 	}
 
@@ -289,6 +444,34 @@ private:
 	}
 
 public:
+	// Directory of the program binary cache, relative to the working directory; "" turns it off
+	static std::string& binaryCacheDir()
+	{
+		static std::string dir = "shader_cache";
+		return dir;
+	}
+
+	// FNV-1a, stable across compilers unlike std::hash
+	static unsigned long long hashSource(const std::string& text)
+	{
+		unsigned long long hash = 14695981039346656037ULL;
+		for (size_t i = 0; i < text.size(); i++)
+		{
+			hash ^= (unsigned char)text[i];
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	// Reads a shader file. A line #include "file" is replaced by that file, looked up next to
+	// the one including it, wrapped in #line directives so errors in it report the include's
+	// number (1, 2, ... in order of appearance) as source string. Every file is included once.
+	static std::string loadShaderFromFile(const std::string filename)
+	{
+		std::vector<std::string> included(1, filename);
+		return loadShaderFromFile(filename, included);
+	}
+
 	// Constructor
 	ShaderProgram()
 	{
@@ -299,7 +482,6 @@ public:
 		// Generate a unique Id / handle for the shader program
 		// Note: We MUST have a valid rendering context before generating the programId or we'll segfault!
 		programId = glCreateProgram();
-		glUseProgram(programId);
 
 		// Initially, we have zero shaders attached to the program
 		shaderCount = 0;
@@ -332,6 +514,20 @@ public:
 		initialise(computeShaderSource);
 	}
 
+	// Method to initialise a compute shader program from a file, with #defines inserted right after its #version line
+	// (not an initFromFiles overload: that signature is taken by the vertex + fragment version)
+	void initComputeFromFile(std::string computeShaderFilename, std::string defines)
+	{
+		std::string computeShaderSource = loadShaderFromFile(computeShaderFilename);
+
+		size_t versionLine = computeShaderSource.find("#version");
+		size_t insertAt = (versionLine == std::string::npos) ? 0 : computeShaderSource.find('\n', versionLine);
+		insertAt = (insertAt == std::string::npos) ? computeShaderSource.size() : insertAt + 1;
+		computeShaderSource.insert(insertAt, defines);
+
+		initialise(computeShaderSource);
+	}
+
 	// Method to initialise a shader program from shaders provided as strings
 	void initFromStrings(std::string vertexShaderSource, std::string fragmentShaderSource)
 	{
@@ -468,6 +664,13 @@ public:
 		return uniformMap[uniformName];
 	}
 
+	// Whether addUniform found the uniform, i.e. the program reads it
+	bool hasUniform(const std::string& uniformName) const
+	{
+		std::map<std::string, int>::const_iterator uniformIter = uniformMap.find(uniformName);
+		return uniformIter != uniformMap.end() && uniformIter->second != -1;
+	}
+
 }; // End of class
 
 #endif // SHADER_PROGRAM_HPP
\ No newline at end of file
@@ -0,0 +1,273 @@
+#pragma once
+
+/*
+	Built-in mesh scenes for the compute ray tracer, labFrameWork --headless --meshes <n>
+	and --crowd <n>.
+
+	Model3D needs assimp and a model file, the headless build has neither, so the geometry
+	is made here, laid out the way Model3D lays out its meshes: submeshes in one position
+	and one index buffer, indices counted from each submesh's base vertex.
+
+	build() places a uv sphere and a cube, a static BLAS handed to RayTracingScene::setMesh,
+	as mesh objects (type 3) next to the scene's spheres and triangles.
+
+	buildCrowd() places animated instances of a two bone figure. Its bone palette, frames
+	and instance transforms sit in ModelManager's storage buffers 1 to 6, modelAnim.comp
+	advances the frames as it does for the rasterized models, and SkinnedMesh poses the
+	instances and refits their BLAS every frame. Model3D::setupSkinnedRayTracing is the
+	same hook for the assimp models, which are not part of this build.
+
+	The ray traced and the G-buffer paths both draw the meshes.
+*/
+
+#include <cmath>
+#include <vector>
+
+#include "GL/glew.h"
+#include "glm/glm.hpp"
+#include "glm/gtc/constants.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+#include "Loader.h"
+#include "RayTracingScene.h"
+#include "TriangleMesh.h"
+#include "SkinnedMesh.h"
+
+class MeshScene
+{
+public:
+	MeshScene() : m_positionBuffer(0), m_indexBuffer(0), m_boneIdBuffer(0), m_boneWeightBuffer(0), m_animationShader(NULL), m_instanceNum(0)
+	{
+		for (int i = 0; i < ANIMATION_BUFFERS; i++) m_animationBuffers[i] = 0;
+	}
+	~MeshScene()
+	{
+		if (m_positionBuffer) glDeleteBuffers(1, &m_positionBuffer);
+		if (m_indexBuffer) glDeleteBuffers(1, &m_indexBuffer);
+		if (m_boneIdBuffer) glDeleteBuffers(1, &m_boneIdBuffer);
+		if (m_boneWeightBuffer) glDeleteBuffers(1, &m_boneWeightBuffer);
+		if (m_animationBuffers[0]) glDeleteBuffers(ANIMATION_BUFFERS, m_animationBuffers);
+		delete m_animationShader;
+	}
+
+	// Adds `count` mesh objects to `scene`, spheres and cubes by turns, in rows on its floor
+	// behind the spheres
+	void build(RayTracingScene& scene, int count)
+	{
+		std::vector<glm::vec3> positions;
+		std::vector<GLuint> indices;
+		std::vector<SubMeshRange> submeshes;
+		addSphere(positions, indices, submeshes);
+		addCube(positions, indices, submeshes);
+		upload(positions, indices);
+		m_mesh.build(m_positionBuffer, m_indexBuffer, positions, indices, submeshes);
+		scene.setMesh(&m_mesh);
+
+		std::vector<Object> objects;
+		const int perRow = 8;
+		for (int i = 0; i < count; i++) {
+			Object o = Object();
+			o.type = 3;
+			o.mesh = i % 2;
+			o.radius = 0.8f;
+			o.pos = glm::vec3(-7 - 2.5f * (i / perRow), -2.2f, -8.75f + 2.5f * (i % perRow));
+			o.color = o.mesh == 0 ? glm::vec4(1, 0.6f, 0.2f, 1) : glm::vec4(0.8f, 0.8f, 0.8f, 1);
+			o.diffuse = 1;
+			o.specular = 2;
+			o.shininess = 20;
+			o.reflect = o.mesh == 0 ? 0.1f : 0.3f;
+			objects.push_back(o);
+		}
+		scene.addObjects(objects);
+	}
+
+	// Adds `count` animated figures to `scene`, in rows on its floor behind the spheres, each
+	// bending at a speed and phase of its own
+	void buildCrowd(RayTracingScene& scene, int count)
+	{
+		std::vector<glm::vec3> positions;
+		std::vector<GLuint> indices;
+		std::vector<SubMeshRange> submeshes;
+		std::vector<glm::ivec4> boneIds;
+		std::vector<glm::vec4> boneWeights;
+		addFigure(positions, indices, submeshes, boneIds, boneWeights);
+		upload(positions, indices);
+		if (!m_boneIdBuffer) glGenBuffers(1, &m_boneIdBuffer);
+		if (!m_boneWeightBuffer) glGenBuffers(1, &m_boneWeightBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, m_boneIdBuffer);
+		glBufferData(GL_ARRAY_BUFFER, boneIds.size() * sizeof(glm::ivec4), boneIds.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, m_boneWeightBuffer);
+		glBufferData(GL_ARRAY_BUFFER, boneWeights.size() * sizeof(glm::vec4), boneWeights.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		// the bind pose BLAS is only the template of the instances' copies
+		m_mesh.build(m_positionBuffer, m_indexBuffer, positions, indices, submeshes);
+		m_instanceNum = count;
+		uploadAnimation();
+		m_skinned.build(m_mesh, m_positionBuffer, m_boneIdBuffer, m_boneWeightBuffer, (int)positions.size(), count);
+		scene.setMesh(&m_skinned.mesh);
+
+		if (!m_animationShader) {
+			m_animationShader = new ShaderProgram();
+			m_animationShader->initFromFiles("shaders/modelAnim.comp");
+			m_animationShader->addUniform("animMaxFrame");
+			m_animationShader->addUniform("transMaxFrame");
+		}
+
+		// the skinned vertices are in world space already
+		std::vector<Object> objects;
+		for (int i = 0; i < count; i++) {
+			Object o = Object();
+			o.type = 3;
+			o.mesh = i;
+			o.radius = 1;
+			o.color = glm::vec4(0.3f + 0.7f * (i % 3) / 2, 0.8f, 0.3f + 0.7f * (i % 5) / 4, 1);
+			o.diffuse = 1;
+			o.specular = 2;
+			o.shininess = 20;
+			o.reflect = 0.1f;
+			objects.push_back(o);
+		}
+		scene.addObjects(objects);
+	}
+
+	// Advances the crowd's animation and poses it for the next frame; nothing to do for the
+	// static meshes
+	void update()
+	{
+		if (m_instanceNum == 0)
+			return;
+
+		// ModelManager::BindInstancingData's binding points
+		for (int i = 0; i < ANIMATION_BUFFERS; i++)
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i + 1, m_animationBuffers[i]);
+
+		m_animationShader->use();
+		glUniform1f(m_animationShader->uniform("animMaxFrame"), (float)FRAME_NUM);
+		glUniform1f(m_animationShader->uniform("transMaxFrame"), 1.f);
+		glDispatchCompute(paddedInstances() / 256, 1, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		m_animationShader->disable();
+
+		m_skinned.update(glm::mat4(1), BONE_NUM, 0, (float)FRAME_NUM, 1.f);
+	}
+
+private:
+	// the figure's animation: BONE_NUM bones over FRAME_NUM frames, the last one the same
+	// as the first so the loop doesn't jump
+	static const int BONE_NUM = 2;
+	static const int FRAME_NUM = 17;
+	// gBones, currentAnimFrame, isAnimating, animationSpeed, transform, currentTransFrame
+	static const int ANIMATION_BUFFERS = 6;
+
+	TriangleMesh m_mesh;
+	GLuint m_positionBuffer;
+	GLuint m_indexBuffer;
+	GLuint m_boneIdBuffer;
+	GLuint m_boneWeightBuffer;
+	GLuint m_animationBuffers[ANIMATION_BUFFERS];   /// storage buffers 1 to 6
+	SkinnedMesh m_skinned;
+	ShaderProgram* m_animationShader;
+	int m_instanceNum;
+
+	// modelAnim.comp runs whole workgroups of 256 without a bounds check, the instances
+	// past the crowd are padding that never animates
+	int paddedInstances() const { return (m_instanceNum + 255) / 256 * 256; }
+
+	// Storage buffers 1 to 6 for `m_instanceNum` instances of the figure. Bone 0 holds the
+	// lower half still, bone 1 bends the upper half sideways around the middle and back.
+	void uploadAnimation()
+	{
+		std::vector<glm::mat4> bones;
+		for (int f = 0; f < FRAME_NUM; f++) {
+			float angle = glm::radians(40.f) * std::sin(2 * glm::pi<float>() * f / (FRAME_NUM - 1));
+			glm::mat4 bend = glm::translate(glm::mat4(1), glm::vec3(0, 1, 0));
+			bend = glm::rotate(bend, angle, glm::vec3(0, 0, 1));
+			bend = glm::translate(bend, glm::vec3(0, -1, 0));
+			bones.push_back(glm::mat4(1));
+			bones.push_back(bend);
+		}
+
+		const int perRow = 8;
+		int padded = paddedInstances();
+		std::vector<float> animFrame(padded, 0), speed(padded, 0), transFrame(padded, 0);
+		std::vector<int> animating(padded, 0);
+		std::vector<glm::mat4> transforms(padded, glm::mat4(1));
+		for (int i = 0; i < m_instanceNum; i++) {
+			animFrame[i] = (float)(i * 5 % (FRAME_NUM - 1));
+			speed[i] = 0.25f + 0.25f * (i % 3);
+			animating[i] = 1;
+			transforms[i] = glm::translate(glm::mat4(1), glm::vec3(-7 - 2.5f * (i / perRow), -3, -8.75f + 2.5f * (i % perRow)));
+		}
+
+		const void* data[ANIMATION_BUFFERS] = { bones.data(), animFrame.data(), animating.data(), speed.data(), transforms.data(), transFrame.data() };
+		size_t sizes[ANIMATION_BUFFERS] = { bones.size() * sizeof(glm::mat4), padded * sizeof(float), padded * sizeof(int),
+			padded * sizeof(float), padded * sizeof(glm::mat4), padded * sizeof(float) };
+		if (!m_animationBuffers[0]) glGenBuffers(ANIMATION_BUFFERS, m_animationBuffers);
+		for (int i = 0; i < ANIMATION_BUFFERS; i++) {
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_animationBuffers[i]);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sizes[i], data[i], GL_DYNAMIC_DRAW);
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// Unit sphere, `stacks` rings of `slices` quads
+	static void addSphere(std::vector<glm::vec3>& positions, std::vector<GLuint>& indices, std::vector<SubMeshRange>& submeshes)
+	{
+		const int stacks = 24, slices = 48;
+		SubMeshRange range = { (GLuint)positions.size(), (GLuint)indices.size(), 0 };
+		for (int a = 0; a <= stacks; a++) {
+			for (int b = 0; b <= slices; b++) {
+				float theta = glm::pi<float>() * a / stacks, phi = 2 * glm::pi<float>() * b / slices;
+				positions.push_back(glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)));
+			}
+		}
+		for (int a = 0; a < stacks; a++) {
+			for (int b = 0; b < slices; b++) {
+				GLuint v0 = a * (slices + 1) + b, v1 = v0 + 1, v2 = v0 + slices + 1, v3 = v2 + 1;
+				GLuint quad[6] = { v0, v1, v2, v1, v3, v2 };
+				indices.insert(indices.end(), quad, quad + 6);
+			}
+		}
+		range.numIndices = (GLuint)indices.size() - range.baseIndex;
+		submeshes.push_back(range);
+	}
+
+	// Cube of half size 1, corner k at (+-1, +-1, +-1) by the bits of k
+	static void addCube(std::vector<glm::vec3>& positions, std::vector<GLuint>& indices, std::vector<SubMeshRange>& submeshes)
+	{
+		SubMeshRange range = { (GLuint)positions.size(), (GLuint)indices.size(), 36 };
+		for (int k = 0; k < 8; k++)
+			positions.push_back(glm::vec3(k & 1 ? 1 : -1, k & 2 ? 1 : -1, k & 4 ? 1 : -1));
+		const GLuint faces[36] = { 0, 2, 1, 1, 2, 3,  4, 5, 6, 5, 7, 6,  0, 1, 4, 1, 5, 4,
+			2, 6, 3, 3, 6, 7,  0, 4, 2, 2, 4, 6,  1, 3, 5, 3, 7, 5 };
+		indices.insert(indices.end(), faces, faces + 36);
+		submeshes.push_back(range);
+	}
+
+	// A body 2 high standing on y = 0: an ellipsoid whose lower half follows bone 0 and upper
+	// half bone 1, blended over the band around its middle
+	static void addFigure(std::vector<glm::vec3>& positions, std::vector<GLuint>& indices, std::vector<SubMeshRange>& submeshes,
+		std::vector<glm::ivec4>& boneIds, std::vector<glm::vec4>& boneWeights)
+	{
+		addSphere(positions, indices, submeshes);
+		for (size_t v = 0; v < positions.size(); v++) {
+			glm::vec3& p = positions[v];
+			float upper = glm::clamp(p.y * 2.5f + 0.5f, 0.f, 1.f);
+			p = glm::vec3(0.4f * p.x, 1 + p.y, 0.4f * p.z);
+			boneIds.push_back(glm::ivec4(0, 1, 0, 0));
+			boneWeights.push_back(glm::vec4(1 - upper, upper, 0, 0));
+		}
+	}
+
+	void upload(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices)
+	{
+		if (!m_positionBuffer) glGenBuffers(1, &m_positionBuffer);
+		if (!m_indexBuffer) glGenBuffers(1, &m_indexBuffer);
+		glBindBuffer(GL_ARRAY_BUFFER, m_positionBuffer);
+		glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+		// no vertex array is bound to take an element buffer, any target fills it
+		glBindBuffer(GL_ARRAY_BUFFER, m_indexBuffer);
+		glBufferData(GL_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+};
@@ -267,6 +267,22 @@ void Model3D::setup()
 	glBindVertexArray(0);
 }
 
+// The ray tracer reads the same position and index buffers, it only needs the BLAS on top
+const TriangleMesh& Model3D::rayTracingMesh()
+{
+	if (!rayTracingBLAS.roots.empty() || meshDatum.empty())
+		return rayTracingBLAS;
+
+	std::vector<SubMeshRange> submeshes(meshDatum.size());
+	for (size_t i = 0; i < meshDatum.size(); i++) {
+		submeshes[i].baseVertex = meshDatum[i].baseVertex;
+		submeshes[i].baseIndex = meshDatum[i].baseIndex;
+		submeshes[i].numIndices = meshDatum[i].numIndices;
+	}
+	rayTracingBLAS.build(VBO_position, EBO, data_positions, data_indices, submeshes);
+	return rayTracingBLAS;
+}
+
 // Checks all material textures of a given type and loads the textures if they're not loaded yet.
 // The required info is returned as a Texture struct.
 std::vector<Texture> Model3D::loadMaterialTextures(aiMaterial* mat, aiTextureType type, std::string typeName)
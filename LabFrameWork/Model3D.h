@@ -14,6 +14,8 @@
 #include "Mesh.h"
 #include "Loader.h"
 #include "ModelView.h"
+#include "TriangleMesh.h"
+#include "SkinnedMesh.h"
 
 class Timer {
 	typedef std::chrono::high_resolution_clock high_resolution_clock;
@@ -49,7 +51,7 @@ public:
 	const aiScene* animScene;
 
 	GLuint VAO;
-	GLuint VBO_offset, SSBO_animationFrame, SSBO_isAnimating, SSBO_animationSpeed, SSBO_transformMatrix, SSBO_transformFrame;
+	GLuint VBO_offset, SSBO_animationFrame, SSBO_transformMatrix, SSBO_transformFrame;
 	std::vector<MeshData> meshDatum;
 	std::vector<Texture> textures_loaded;
 	std::vector<GLuint> data_indices;
@@ -85,6 +87,16 @@ public:
 	}
 
 	void AddAnimationData(std::string path);
+
+	// BLAS per mesh over VBO_position / EBO, hand it to RayTracingScene::setMesh. Built on
+	// the first call, models that are only rasterized never pay for it.
+	const TriangleMesh& rayTracingMesh();
+
+	// Ray traced copies of `instances` animated instances, posed every frame by SkinnedMesh::update
+	void setupSkinnedRayTracing(SkinnedMesh& skinned, int instances)
+	{
+		skinned.build(rayTracingMesh(), VBO_position, VBO_boneId, VBO_boneWeight, (int)data_positions.size(), instances);
+	}
 	
 private:
 	Assimp::Importer importer, animImporter;
@@ -101,6 +113,7 @@ private:
 	std::vector<aiMatrix4x4> data_boneTransforms;
 
 	GLuint EBO, VBO_position, VBO_normal, VBO_texcoord, VBO_boneId, VBO_boneWeight, SSBO_boneTransform;
+	TriangleMesh rayTracingBLAS;
 
 	/* Functions */
 	void loadModel(std::string path);
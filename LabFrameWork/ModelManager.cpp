@@ -94,8 +94,6 @@ void ModelManager::SetInstancingData(int index)
 
 	glBindVertexArray(data->model->VAO);
 	glGenBuffers(1, &data->model->SSBO_animationFrame);
-	glGenBuffers(1, &data->model->SSBO_isAnimating);
-	glGenBuffers(1, &data->model->SSBO_animationSpeed);
 	glGenBuffers(1, &data->model->SSBO_transformMatrix);
 	glGenBuffers(1, &data->model->SSBO_transformFrame);
 
@@ -105,14 +103,14 @@ void ModelManager::SetInstancingData(int index)
 	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, data->model->SSBO_animationFrame);
 
 	// is Animating
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, data->model->SSBO_isAnimating);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, data->instancingCount * sizeof(int), data->isAnimating, GL_DYNAMIC_DRAW);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, data->model->SSBO_isAnimating);
+	data->isAnimatingBuffer = new DynamicBuffer();
+	data->isAnimatingBuffer->write(data->isAnimating, data->instancingCount * sizeof(int));
+	data->isAnimatingBuffer->bind(3);
 
 	// Animation Speed
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, data->model->SSBO_animationSpeed);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, data->instancingCount * sizeof(float), data->animationSpeed, GL_DYNAMIC_DRAW);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, data->model->SSBO_animationSpeed);
+	data->speedBuffer = new DynamicBuffer();
+	data->speedBuffer->write(data->animationSpeed, data->instancingCount * sizeof(float));
+	data->speedBuffer->bind(4);
 
 	// transform matrix
 	glBindBuffer(GL_SHADER_STORAGE_BUFFER, data->model->SSBO_transformMatrix);
@@ -141,15 +139,19 @@ void ModelManager::SwitchisAnimating()
 		{
 			data->isAnimating[i] = -data->isAnimating[i];
 		}
-	}
-
-	glGenBuffers(1, &m_AnimatedModelData[0]->model->SSBO_isAnimating);
-	glBindVertexArray(m_AnimatedModelData[0]->model->VAO);
 
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_AnimatedModelData[0]->model->SSBO_isAnimating);
-	glBufferData(GL_SHADER_STORAGE_BUFFER, m_AnimatedModelData[0]->instancingCount * sizeof(int), m_AnimatedModelData[0]->isAnimating, GL_DYNAMIC_DRAW);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_AnimatedModelData[0]->model->SSBO_isAnimating);
-	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+		// the frames in flight keep reading the old flags, BindInstancingData picks up these
+		data->isAnimatingBuffer->write(data->isAnimating, data->instancingCount * sizeof(int));
+	}
+}
 
-	glBindVertexArray(0);
+// Binding points as in SetInstancingData. The flags move to another region of their buffer
+// on every switch, so they are bound again before every use.
+void ModelManager::BindInstancingData(AnimatedModelData* data)
+{
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, data->model->SSBO_animationFrame);
+	data->isAnimatingBuffer->bind(3);
+	data->speedBuffer->bind(4);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, data->model->SSBO_transformMatrix);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, data->model->SSBO_transformFrame);
 }
\ No newline at end of file
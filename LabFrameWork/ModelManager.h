@@ -1,6 +1,7 @@
 #pragma once
 #include <vector>
 #include "Model3D.h"
+#include "DynamicBuffer.h"
 
 // ִϸ̼   
 struct AnimatedModelData {
@@ -33,6 +34,10 @@ struct AnimatedModelData {
 
 	//ġ, ȸ ִ 
 	float transMaxFrame;
+
+	// isAnimating, animationSpeed as the shaders read them, rewritten in place on changes
+	DynamicBuffer* isAnimatingBuffer;
+	DynamicBuffer* speedBuffer;
 };
 
 class ModelManager
@@ -52,6 +57,9 @@ public:
 	// Animation on, off
 	void SwitchisAnimating();
 
+	// Bind a model's instancing data for the animation compute shader and the draw
+	void BindInstancingData(AnimatedModelData* data);
+
 private:
 	// Model Index
 	int dataIndex;
@@ -113,11 +113,15 @@ void MyGlWindow::setupModel3D()
 
 void MyGlWindow::draw(glm::mat4 view, glm::mat4 projection)
 {
+	ProfileScope scope("MyGlWindow::draw");
 	glViewport(0, 0, m_width, m_height);
 
 	float time = (clock() - startTime) / 1000.0f;
 
-	drawFloor(m_floorShader, view, projection);
+	{
+		ProfileScope floor("floor");
+		drawFloor(m_floorShader, view, projection);
+	}
 
 	for (unsigned int i = 0; i< m_ModelManager->m_AnimatedModelData.size(); i++)
 	{
@@ -162,9 +166,12 @@ void MyGlWindow::drawCube(ShaderProgram * shader, glm::mat4 & view, glm::mat4 &
 
 void MyGlWindow::drawAnimatedModel3D(AnimatedModelData* modelData, ShaderProgram * shader, glm::mat4 & view, glm::mat4 & projection)
 {
+	m_ModelManager->BindInstancingData(modelData);
+
 	// set uniforms in compute shader
 	m_model3DComputeShader->use();
 	{
+		ProfileScope animation("animation compute");
 		glUniform1f(m_model3DComputeShader->uniform("animMaxFrame"), modelData->animMaxFrame);
 		glUniform1f(m_model3DComputeShader->uniform("transMaxFrame"), modelData->transMaxFrame);
 		glDispatchCompute(modelData->instancingCount, 1, 1);
@@ -172,6 +179,7 @@ void MyGlWindow::drawAnimatedModel3D(AnimatedModelData* modelData, ShaderProgram
 	}
 	m_model3DComputeShader->disable();
 
+	ProfileScope skinning("skinned draw");
 	m_model.glPushMatrix();
 
 	m_model3DShader->use();
@@ -17,6 +17,7 @@
 #include "ModelManager.h"
 #include "Viewer.h"
 #include "ModelView.h"
+#include "GpuProfiler.h"
 
 #pragma warning(pop)
 
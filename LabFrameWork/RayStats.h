@@ -0,0 +1,140 @@
+#pragma once
+
+/*
+	Per pixel ray statistics for the CPU ray tracer.
+
+	Build with -DRT_STATS to turn them on. Without it RT_STAT() expands to nothing
+	and RenderSettings carries no stats buffer, so the tracer compiles exactly as
+	before.
+
+	When on, trace() bumps counters that live in thread local storage, so threads
+	never share a cache line. renderTile() snapshots them around every primary ray
+	and stores the difference, plus the time spent, in a RayStatsBuffer. Tiles never
+	overlap so every pixel is written by one thread only.
+*/
+
+#ifdef RT_STATS
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+
+enum RayStat
+{
+	STAT_PRIMARY_RAYS,
+	STAT_REFLECTION_RAYS,
+	STAT_REFRACTION_RAYS,
+	STAT_SHADOW_RAYS,
+	STAT_INTERSECTION_TESTS,
+	STAT_BVH_NODES,         // stays 0 until the CPU tracer gets a BVH, the spheres are tested one by one
+	STAT_COUNTER_COUNT
+};
+
+static const char* const RAY_STAT_NAMES[STAT_COUNTER_COUNT + 1] = {
+	"primary_rays", "reflection_rays", "refraction_rays", "shadow_rays", "intersection_tests", "bvh_nodes", "nanoseconds"
+};
+
+struct RayCounters
+{
+	uint32_t count[STAT_COUNTER_COUNT];
+	RayCounters() { memset(count, 0, sizeof(count)); }
+};
+
+inline RayCounters& rayCounters()
+{
+	static thread_local RayCounters counters;
+	return counters;
+}
+
+#define RT_STAT(stat) (++rayCounters().count[stat])
+
+struct PixelStats
+{
+	uint32_t count[STAT_COUNTER_COUNT];
+	float nanoseconds;
+};
+
+class RayStatsBuffer
+{
+public:
+	RayStatsBuffer(unsigned w, unsigned h) : width(w), height(h), pixels(w * h) {}
+
+	unsigned width, height;
+	std::vector<PixelStats> pixels;
+
+	// channel STAT_COUNTER_COUNT is the time spent in the pixel
+	float value(size_t pixel, unsigned channel) const
+	{
+		return channel < STAT_COUNTER_COUNT ? (float)pixels[pixel].count[channel] : pixels[pixel].nanoseconds;
+	}
+
+	// One single channel float image (PFM) per counter: <prefix><name>.pfm
+	bool writeHeatmaps(const std::string& prefix) const
+	{
+		std::vector<float> row(width);
+		for (unsigned channel = 0; channel <= STAT_COUNTER_COUNT; ++channel) {
+			std::string path = prefix + RAY_STAT_NAMES[channel] + ".pfm";
+			std::ofstream ofs(path.c_str(), std::ios::out | std::ios::binary);
+			if (!ofs.good()) {
+				std::cerr << "Failed to open file: " << path << std::endl;
+				return false;
+			}
+			// negative scale means little endian, rows go from the bottom up
+			ofs << "Pf\n" << width << " " << height << "\n-1.0\n";
+			for (unsigned y = height; y-- > 0;) {
+				for (unsigned x = 0; x < width; ++x) row[x] = value(y * width + x, channel);
+				ofs.write((const char*)row.data(), row.size() * sizeof(float));
+			}
+		}
+		return true;
+	}
+
+	// Totals, averages and a 16 bin histogram of every counter: <prefix>histograms.txt
+	bool writeHistograms(const std::string& prefix, unsigned bins = 16) const
+	{
+		std::string path = prefix + "histograms.txt";
+		std::ofstream ofs(path.c_str());
+		if (!ofs.good()) {
+			std::cerr << "Failed to open file: " << path << std::endl;
+			return false;
+		}
+
+		for (unsigned channel = 0; channel <= STAT_COUNTER_COUNT; ++channel) {
+			double total = 0;
+			float lo = 0, hi = 0;
+			for (size_t i = 0; i < pixels.size(); ++i) {
+				float v = value(i, channel);
+				total += v;
+				lo = (i == 0) ? v : std::min(lo, v);
+				hi = (i == 0) ? v : std::max(hi, v);
+			}
+
+			std::vector<size_t> histogram(bins, 0);
+			float binWidth = (hi > lo) ? (hi - lo) / bins : 1;
+			for (size_t i = 0; i < pixels.size(); ++i) {
+				unsigned bin = (unsigned)((value(i, channel) - lo) / binWidth);
+				histogram[std::min(bin, bins - 1)]++;
+			}
+
+			ofs << RAY_STAT_NAMES[channel] << ": total " << std::fixed << std::setprecision(0) << total
+				<< " mean " << std::setprecision(3) << total / std::max<size_t>(1, pixels.size())
+				<< " min " << lo << " max " << hi << "\n";
+			for (unsigned b = 0; b < bins; ++b) {
+				ofs << "  [" << std::setw(12) << lo + b * binWidth << ", " << std::setw(12) << lo + (b + 1) * binWidth << ") "
+					<< histogram[b] << "\n";
+			}
+		}
+		return true;
+	}
+};
+
+#else
+
+#define RT_STAT(stat) ((void)0)
+
+#endif
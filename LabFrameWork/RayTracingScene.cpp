@@ -1,4 +1,11 @@
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <array>
+#include <map>
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 
 #include "RayTracingScene.h"
 
@@ -24,6 +31,32 @@ RayTracingScene::RayTracingScene(int w, int h)
 
 	glActiveTexture(GL_TEXTURE0);
 
+	m_objectBuffer = m_materialBuffer = m_lightBuffer = m_bvhBuffer = m_sphereBuffer = m_triangleBuffer = NULL;
+	m_sceneDirty = true;
+	m_objectNum = m_unboundedNum = m_unboundedSpheres = m_unboundedTriangles = m_nodeNum = 0;
+	m_reflectDepth = 10;
+	m_maxBounces = 0;
+	m_mesh = NULL;
+	m_sampleCount = 0;
+	m_maxSamples = 64;
+	m_lastRevision = 0;
+	m_lastWidth = m_lastHeight = 0;
+	m_renderWidth = m_width;
+	m_renderHeight = m_height;
+	m_renderMode = RENDER_FULL_RATE;
+	m_historyIndex = 0;
+	m_historyValid = false;
+	m_frameIndex = 0;
+	m_historyFov = 0;
+	m_historyWidth = m_historyHeight = 0;
+	m_wavefront = false;
+	m_queues = new WavefrontQueues();
+	m_hybrid = false;
+	m_gbuffer = new GBuffer();
+	m_reflectionScale = 1;
+	m_reflections = new ReflectionBuffer();
+	m_variants = new ShaderVariants([this](const std::string& defines) { return createRayTracingShader(defines); });
+
 	initialize();
 	initShader();
 	initTexture();
@@ -32,8 +65,7 @@ RayTracingScene::RayTracingScene(int w, int h)
 
 void RayTracingScene::initialize()
 {
-	objectNum = 7;
-	objects = new Object[objectNum];
+	objects.resize(7);
 
 	objects[0].type = 1; // plane
 	objects[0].pos = glm::vec3(0, -3, 0);
@@ -108,8 +140,7 @@ void RayTracingScene::initialize()
 	objects[6].shininess = 20;
 	objects[6].reflect = 0.1;
 
-	lightNum = 2;
-	lights = new Light[lightNum];
+	lights.resize(2);
 
 	lights[0].pos = glm::vec3(10, 10, 0);
 	lights[0].color = glm::vec4(1, 1, 1, 1);
@@ -142,6 +173,31 @@ void RayTracingScene::initShader()
 	m_RayTracingShader->initFromFiles("shaders/RayTracing.vert", "shaders/RayTracing.frag");
 	m_RayTracingShader->addAttribute("aPosition");
 	m_RayTracingShader->addAttribute("aTexCoord");
+	m_RayTracingShader->addUniform("uRenderScale");
+
+	m_reconstructShader = new ShaderProgram();
+	m_reconstructShader->initFromFiles("shaders/Reconstruct.comp");
+	m_reconstructShader->addUniform("uSize");
+	m_reconstructShader->addUniform("uCamera.pos");
+	m_reconstructShader->addUniform("uCamera.rot");
+	m_reconstructShader->addUniform("uCamera.fov");
+	m_reconstructShader->addUniform("uPrevSize");
+	m_reconstructShader->addUniform("uPrevCamera.pos");
+	m_reconstructShader->addUniform("uPrevCamera.rot");
+	m_reconstructShader->addUniform("uPrevCamera.fov");
+	m_reconstructShader->addUniform("uPattern");
+	m_reconstructShader->addUniform("uFrameIndex");
+	m_reconstructShader->addUniform("uHistoryValid");
+
+	m_gbufferShader = new ShaderProgram();
+	m_gbufferShader->initFromFiles("shaders/gbuffer.vert", "shaders/gbuffer.frag");
+	m_gbufferShader->addUniform("uCamera.pos");
+	m_gbufferShader->addUniform("uCamera.rot");
+	m_gbufferShader->addUniform("uCamera.fov");
+	m_gbufferShader->addUniform("uSize");
+	m_gbufferShader->addUniform("uJitter");
+	m_gbufferShader->addUniform("uObject");
+	m_gbufferShader->addUniform("uFirstSlot");
 
 	// Bind vertices
 	glGenVertexArrays(1, &VAO);
@@ -171,93 +227,734 @@ void RayTracingScene::initTexture()
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_width, m_height, 0, GL_RGBA, GL_FLOAT, NULL);
-	glBindImageTexture(0, texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+	// read back by the shader to average the samples of a still view
+	glBindImageTexture(0, texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+
+	// only ever accessed as images
+	glGenTextures(2, m_historyTexture);
+	for (int i = 0; i < 2; i++) {
+		glBindTexture(GL_TEXTURE_2D, m_historyTexture[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_width, m_height, 0, GL_RGBA, GL_FLOAT, NULL);
+	}
+	glBindTexture(GL_TEXTURE_2D, texture);
+	m_gbuffer->resize(m_width, m_height);
+	m_reflections->resize(m_width, m_height);
+}
+
+// Follows the window, the texture holds a full resolution image
+void RayTracingScene::setSize(int w, int h)
+{
+	// a minimized window reports 0 x 0
+	if ((w == m_width && h == m_height) || w <= 0 || h <= 0)
+		return;
+	m_width = w;
+	m_height = h;
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_width, m_height, 0, GL_RGBA, GL_FLOAT, NULL);
+	glBindImageTexture(0, texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+	for (int i = 0; i < 2; i++) {
+		glBindTexture(GL_TEXTURE_2D, m_historyTexture[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_width, m_height, 0, GL_RGBA, GL_FLOAT, NULL);
+	}
+	glBindTexture(GL_TEXTURE_2D, texture);
+	m_gbuffer->resize(m_width, m_height);
+	m_reflections->resize(m_width, m_height);
+	m_historyValid = false;
+	m_viewer->setAspectRatio(w / (float)h);
 }
 
 void RayTracingScene::setupRayTracing()
 {
-	m_RayTracingComputeShader = new ShaderProgram();
-	m_RayTracingComputeShader->initFromFiles("shaders/RayTracing.comp");
-
-	m_RayTracingComputeShader->addUniform("uSize");
-	m_RayTracingComputeShader->addUniform("uCamera.pos");
-	m_RayTracingComputeShader->addUniform("uCamera.rot");
-	m_RayTracingComputeShader->addUniform("uCamera.fov");
-	m_RayTracingComputeShader->addUniform("uCamera.reflectDepth");
-
-	m_RayTracingComputeShader->addUniform("uObjectNum");
-
-	for (int i = 0; i < objectNum; i++) {
-		std::ostringstream os;
-		os << "uObjects[" << i << "]";
-		m_RayTracingComputeShader->addUniform(os.str().append(".type").c_str());
-		m_RayTracingComputeShader->addUniform(os.str().append(".pos").c_str());
-		m_RayTracingComputeShader->addUniform(os.str().append(".rot").c_str());
-		m_RayTracingComputeShader->addUniform(os.str().append(".color").c_str());
-		m_RayTracingComputeShader->addUniform(os.str().append(".vert1").c_str());
-		m_RayTracingComputeShader->addUniform(os.str().append(".vert2").c_str());
-		m_RayTracingComputeShader->addUniform(os.str().append(".vert3").c_str());
-		m_RayTracingComputeShader->addUniform(os.str().append(".radius").c_str());
-		m_RayTracingComputeShader->addUniform(os.str().append(".diffuse").c_str());
-		m_RayTracingComputeShader->addUniform(os.str().append(".specular").c_str());
-		m_RayTracingComputeShader->addUniform(os.str().append(".shininess").c_str());
-		m_RayTracingComputeShader->addUniform(os.str().append(".reflect").c_str());
+	m_objectBuffer = new DynamicBuffer();
+	m_materialBuffer = new DynamicBuffer();
+	m_lightBuffer = new DynamicBuffer();
+	m_bvhBuffer = new DynamicBuffer();
+	m_sphereBuffer = new DynamicBuffer();
+	m_triangleBuffer = new DynamicBuffer();
+
+	// time every tile size on this scene with the unspecialised shader, or reuse what an earlier
+	// run found on this GPU. draw() then switches to the variant built for the scene.
+	ComputeTuner tuner;
+	m_RayTracingComputeShader = tuner.tune("shaders/RayTracing.comp",
+		[this](WorkgroupSize size) { return createRayTracingShader(ComputeTuner::defines(size)); },
+		[this](ShaderProgram* program, WorkgroupSize size) {
+			m_RayTracingComputeShader = program;
+			m_localSize = size;
+			dispatchRayTracing();
+		},
+		m_localSize);
+	m_variants->add(ComputeTuner::defines(m_localSize), m_RayTracingComputeShader);
+}
+
+ShaderProgram* RayTracingScene::createRayTracingShader(const std::string& defines)
+{
+	ShaderProgram* program = new ShaderProgram();
+	program->initComputeFromFile("shaders/RayTracing.comp", defines);
+
+	// a wavefront pass only has the uniforms of its part of the tracer, see setTraceUniforms
+	int pass = WAVEFRONT_OFF;
+	size_t at = defines.find("WAVEFRONT_PASS ");
+	if (at != std::string::npos)
+		pass = atoi(defines.c_str() + at + strlen("WAVEFRONT_PASS "));
+	bool generates = pass == WAVEFRONT_OFF || pass == WAVEFRONT_GENERATE;
+	bool intersects = pass == WAVEFRONT_OFF || pass == WAVEFRONT_INTERSECT;
+	bool shades = pass == WAVEFRONT_OFF || pass == WAVEFRONT_SHADE;
+	// so does a reflection pass, the low resolution one keeps no running mean
+	int reflectionPass = REFLECTION_FULL;
+	at = defines.find("REFLECTION_PASS ");
+	if (at != std::string::npos)
+		reflectionPass = atoi(defines.c_str() + at + strlen("REFLECTION_PASS "));
+
+	if (generates) {
+		program->addUniform("uSize");
+		program->addUniform("uCamera.rot");
+		program->addUniform("uCamera.fov");
+		program->addUniform("uJitter");
+		// only read to pick the pixels of a checkerboard frame
+		if (defines.find("CHECKERBOARD") != std::string::npos)
+			program->addUniform("uFrameIndex");
+	}
+	if (generates || shades)
+		program->addUniform("uCamera.pos");
+	if (intersects) {
+		// intersectRange() only reads the counts up to the last object type the variant keeps
+		// (an undefined HAS_ is 1)
+		auto has = [&defines](const std::string& type) {
+			size_t found = defines.find(type + " ");
+			return found == std::string::npos || atoi(defines.c_str() + found + type.size() + 1) != 0;
+		};
+		bool others = has("HAS_PLANES") || has("HAS_MESHES");
+		program->addUniform("uUnboundedSpheres");
+		if (others || has("HAS_TRIANGLES"))
+			program->addUniform("uUnboundedTriangles");
+		if (others)
+			program->addUniform("uUnboundedNum");
+		program->addUniform("uNodeNum");
+	}
+	if (shades) {
+		program->addUniform("uCamera.reflectDepth");
+		// compiled out when the variant fixes LIGHT_NUM
+		if (defines.find("LIGHT_NUM ") == std::string::npos)
+			program->addUniform("uLightNum");
+		if (reflectionPass != REFLECTION_TRACE)
+			program->addUniform("uSampleIndex");
+	}
+	if (pass == WAVEFRONT_SHADE)
+		program->addUniform("uBounce");
+	if (reflectionPass != REFLECTION_FULL)
+		program->addUniform("uReflectionScale");
+	return program;
+}
+
+// The variant of RayTracing.comp for the uploaded scene, one of its wavefront passes or all
+// of the tracer (WAVEFRONT_OFF)
+ShaderDefines RayTracingScene::traceDefines(int pattern, int pass)
+{
+	ShaderDefines defines = m_sceneDefines;
+	// the queue passes have their own group size, the pixel ones are tiled as tuned
+	if (pass == WAVEFRONT_OFF || pass == WAVEFRONT_GENERATE) {
+		defines.set("LOCAL_SIZE_X", m_localSize.x);
+		defines.set("LOCAL_SIZE_Y", m_localSize.y);
 	}
+	if (pattern != RENDER_FULL_RATE && pass != WAVEFRONT_INTERSECT)
+		defines.set("CHECKERBOARD", pattern);
+	if (pass != WAVEFRONT_OFF)
+		defines.set("WAVEFRONT_PASS", pass);
+	// the primary hits come from the G-buffer, the passes after them don't know the difference
+	if (m_hybrid && (pass == WAVEFRONT_OFF || pass == WAVEFRONT_GENERATE))
+		defines.set("HYBRID", 1);
+	return defines;
+}
 
-	m_RayTracingComputeShader->addUniform("uLightNum");
+// Where intersectRange() in RayTracing.comp wants an object among the ones it tests together:
+// spheres first, then triangles, then planes and meshes
+static int typeOrder(const Object& o)
+{
+	int type = (int)o.type;
+	return type == 0 ? 0 : type == 2 ? 1 : 2;
+}
 
-	for (int i = 0; i < lightNum; i++) {
-		std::ostringstream os;
-		os << "uLights[" << i << "]";
-		m_RayTracingComputeShader->addUniform(os.str().append(".pos").c_str());
-		m_RayTracingComputeShader->addUniform(os.str().append(".color").c_str());
+// Packs the scene into the std430 buffers. Objects with the same material share one entry.
+// Planes and skinned meshes (and every object of small scenes) come first and are tested one
+// by one, the other objects follow in BVH leaf order; both sorted by type within a leaf and
+// within the unbounded objects. Only runs when the scene changed; objects and lights are
+// written straight into the mapped buffers.
+void RayTracingScene::uploadScene()
+{
+	std::vector<GPUMaterial> gpuMaterials;
+	std::map<std::array<float, 8>, int> materialIndex;
+
+	std::vector<int> unbounded, bounded;
+	std::vector<AABB> boxes;
+	for (size_t i = 0; i < objects.size(); i++) {
+		const Object& o = objects[i];
+		if ((int)o.type == 0) {
+			bounded.push_back((int)i);
+			boxes.push_back(AABB(o.pos - glm::vec3(o.radius), o.pos + glm::vec3(o.radius)));
+		}
+		else if ((int)o.type == 2) {
+			AABB box;
+			box.grow(o.pos + o.vert1);
+			box.grow(o.pos + o.vert2);
+			box.grow(o.pos + o.vert3);
+			// flat boxes of axis aligned triangles would be missed by rays grazing them
+			box.min -= glm::vec3(1e-4f);
+			box.max += glm::vec3(1e-4f);
+			bounded.push_back((int)i);
+			boxes.push_back(box);
+		}
+		else if ((int)o.type == 3) {
+			if (!m_mesh || o.mesh < 0 || o.mesh >= (int)m_mesh->roots.size() || m_mesh->roots[o.mesh] < 0) {
+				std::cout << "Object " << i << " places submesh " << o.mesh << " the scene mesh doesn't have, skipped" << std::endl;
+				continue;
+			}
+			// skinned meshes move every frame, the box test on their refit BLAS root culls them
+			if (m_mesh->dynamic) {
+				unbounded.push_back((int)i);
+				continue;
+			}
+			const AABB& bounds = m_mesh->bounds[o.mesh];
+			bounded.push_back((int)i);
+			boxes.push_back(AABB(o.pos + bounds.min * o.radius, o.pos + bounds.max * o.radius));
+		}
+		else {
+			unbounded.push_back((int)i);
+		}
 	}
+
+	// a handful of objects is faster to test one by one than to traverse
+	const size_t minBVHObjects = 8;
+	if (bounded.size() < minBVHObjects) {
+		unbounded.insert(unbounded.end(), bounded.begin(), bounded.end());
+		bounded.clear();
+		boxes.clear();
+	}
+
+	// a leaf's count also says how many of its objects are spheres and triangles, 8 bits
+	// each, see RayTracing.comp. The SAH keeps leaves at 16 objects or less, but a leaf at
+	// BVH::MAX_DEPTH takes every object left under it: the objects of leaves that don't fit
+	// are tested one by one instead, and the rest built again.
+	const int maxLeafObjects = 255;
+	BVH bvh;
+	for (;;) {
+		bvh.build(boxes);
+		std::vector<bool> oversized(bounded.size(), false);
+		bool rebuild = false;
+		for (size_t i = 0; i < bvh.nodes.size(); i++) {
+			const BVHNode& node = bvh.nodes[i];
+			if (node.count <= maxLeafObjects)
+				continue;
+			for (int j = node.leftFirst; j < node.leftFirst + node.count; j++) oversized[bvh.order[j]] = true;
+			rebuild = true;
+		}
+		if (!rebuild)
+			break;
+
+		std::vector<int> keptObjects;
+		std::vector<AABB> keptBoxes;
+		for (size_t i = 0; i < bounded.size(); i++) {
+			if (oversized[i]) {
+				unbounded.push_back(bounded[i]);
+				continue;
+			}
+			keptObjects.push_back(bounded[i]);
+			keptBoxes.push_back(boxes[i]);
+		}
+		std::cout << "BVH: " << bounded.size() - keptObjects.size() << " objects of leaves over " << maxLeafObjects << " objects tested unbounded" << std::endl;
+		bounded.swap(keptObjects);
+		boxes.swap(keptBoxes);
+	}
+
+	std::stable_sort(unbounded.begin(), unbounded.end(), [this](int a, int b) { return typeOrder(objects[a]) < typeOrder(objects[b]); });
+	int unboundedType[3] = { 0, 0, 0 };
+	for (size_t i = 0; i < unbounded.size(); i++) unboundedType[typeOrder(objects[unbounded[i]])]++;
+
+	for (size_t i = 0; i < bvh.nodes.size(); i++) {
+		BVHNode& node = bvh.nodes[i];
+		if (node.count == 0)
+			continue;
+		assert(node.count <= maxLeafObjects);
+		std::vector<int>::iterator first = bvh.order.begin() + node.leftFirst;
+		std::stable_sort(first, first + node.count, [&](int a, int b) { return typeOrder(objects[bounded[a]]) < typeOrder(objects[bounded[b]]); });
+		int leafType[3] = { 0, 0, 0 };
+		for (int j = 0; j < node.count; j++) leafType[typeOrder(objects[bounded[first[j]]])]++;
+		node.leftFirst += (int)unbounded.size();
+		node.count |= leafType[0] << 8 | leafType[1] << 16;
+	}
+
+	std::vector<int> gpuOrder(unbounded);
+	for (size_t i = 0; i < bvh.order.size(); i++) gpuOrder.push_back(bounded[bvh.order[i]]);
+
+	// the shader variant only keeps the object types present and follows reflections only
+	// when something reflects, at most as many as the unspecialised shader (16)
+	bool hasType[4] = { false, false, false, false };
+	bool reflects = false;
+	for (size_t i = 0; i < gpuOrder.size(); i++) {
+		const Object& o = objects[gpuOrder[i]];
+		if ((int)o.type >= 0 && (int)o.type < 4) hasType[(int)o.type] = true;
+		reflects = reflects || o.reflect != 0;
+	}
+	m_sceneDefines = ShaderDefines();
+	m_sceneDefines.set("HAS_SPHERES", hasType[0]);
+	m_sceneDefines.set("HAS_PLANES", hasType[1]);
+	m_sceneDefines.set("HAS_TRIANGLES", hasType[2]);
+	m_sceneDefines.set("HAS_MESHES", hasType[3]);
+	m_maxBounces = reflects ? std::min(m_reflectDepth, 16) : 0;
+	m_sceneDefines.set("MAX_BOUNCES", m_maxBounces);
+	if (!lights.empty()) m_sceneDefines.set("LIGHT_NUM", (int)lights.size());
+
+	// never allocate an empty buffer, a scene without lights is still valid
+	GPUObject* gpuObjects = (GPUObject*)m_objectBuffer->beginWrite(std::max<size_t>(gpuOrder.size(), 1) * sizeof(GPUObject));
+	glm::vec4* gpuSpheres = (glm::vec4*)m_sphereBuffer->beginWrite(std::max<size_t>(gpuOrder.size(), 1) * sizeof(glm::vec4));
+	GPUTriangle* gpuTriangles = (GPUTriangle*)m_triangleBuffer->beginWrite(std::max<size_t>(gpuOrder.size(), 1) * sizeof(GPUTriangle));
+	for (size_t i = 0; i < gpuOrder.size(); i++) {
+		const Object& o = objects[gpuOrder[i]];
+		std::array<float, 8> key = { o.color.r, o.color.g, o.color.b, o.color.a, o.diffuse, o.specular, o.shininess, o.reflect };
+		std::map<std::array<float, 8>, int>::iterator it = materialIndex.find(key);
+		if (it == materialIndex.end()) {
+			GPUMaterial m = { o.color, o.diffuse, o.specular, o.shininess, o.reflect };
+			it = materialIndex.insert(std::make_pair(key, (int)gpuMaterials.size())).first;
+			gpuMaterials.push_back(m);
+		}
+
+		GPUObject& g = gpuObjects[i];
+		g.pos = o.pos;
+		g.type = (int)o.type;
+		g.vert1 = o.vert1;
+		g.radius = o.radius;
+		g.vert2 = o.vert2;
+		g.material = it->second;
+		g.vert3 = o.vert3;
+		g.mesh = (int)o.type == 3 ? m_mesh->roots[o.mesh] : 0;
+
+		if ((int)o.type == 0)
+			gpuSpheres[i] = glm::vec4(o.pos, o.radius);
+		else if ((int)o.type == 2) {
+			GPUTriangle& t = gpuTriangles[i];
+			t.vert = o.pos + o.vert1;
+			t.edge1 = o.vert2 - o.vert1;
+			t.edge2 = o.vert3 - o.vert1;
+		}
+	}
+
+	m_objectBuffer->endWrite();
+	m_sphereBuffer->endWrite();
+	m_triangleBuffer->endWrite();
+
+	m_meshDraws.clear();
+	for (size_t i = 0; i < gpuOrder.size(); i++) {
+		const Object& o = objects[gpuOrder[i]];
+		if ((int)o.type != 3)
+			continue;
+		MeshDraw draw = { (int)i, 0, 0 };
+		m_mesh->slotRange(m_mesh->roots[o.mesh], draw.firstSlot, draw.slotCount);
+		m_meshDraws.push_back(draw);
+	}
+
+	GPULight* gpuLights = (GPULight*)m_lightBuffer->beginWrite(std::max<size_t>(lights.size(), 1) * sizeof(GPULight));
+	for (size_t i = 0; i < lights.size(); i++) {
+		gpuLights[i].pos = glm::vec4(lights[i].pos, 1);
+		gpuLights[i].color = lights[i].color;
+	}
+	m_lightBuffer->endWrite();
+
+	gpuMaterials.resize(std::max<size_t>(gpuMaterials.size(), 1));
+	m_objectNum = (int)gpuOrder.size();
+	m_unboundedNum = (int)unbounded.size();
+	m_unboundedSpheres = unboundedType[0];
+	m_unboundedTriangles = unboundedType[1];
+	m_nodeNum = (int)bvh.nodes.size();
+	bvh.nodes.resize(std::max<size_t>(bvh.nodes.size(), 1));
+
+	m_materialBuffer->write(gpuMaterials.data(), gpuMaterials.size() * sizeof(GPUMaterial));
+	m_bvhBuffer->write(bvh.nodes.data(), bvh.nodes.size() * sizeof(BVHNode));
+
+	m_sceneDirty = false;
+	m_sampleCount = 0;
+	// the last frame shows the old scene
+	m_historyValid = false;
 }
 
-void RayTracingScene::draw ()
+// Radical inverse of `index` in `base`, the Halton sequence the sample jitter follows
+static float halton(int index, int base)
 {
-	glViewport(0, 0, m_width, m_height);
+	float result = 0, fraction = 1.0f / base;
+	for (; index > 0; index /= base, fraction /= base)
+		result += fraction * (index % base);
+	return result;
+}
 
+// Traces the image into the image bound to unit 0 with the current compute program, every
+// pixel or, for a program built with CHECKERBOARD = `pattern`, one pixel out of `pattern`
+void RayTracingScene::dispatchRayTracing(int pattern)
+{
 	m_RayTracingComputeShader->use();
 
-	glDispatchCompute(m_width, m_height, 1);
-	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
-
-	glUniform2fv(m_RayTracingComputeShader->uniform("uSize"), 1, glm::value_ptr(glm::vec2(m_width, m_height)));
-	glUniform3fv(m_RayTracingComputeShader->uniform("uCamera.pos"), 1, glm::value_ptr(m_viewer->getViewPoint()));
-	glUniform3fv(m_RayTracingComputeShader->uniform("uCamera.rot"), 1, glm::value_ptr(m_viewer->getViewDir()));
-	glUniform1f(m_RayTracingComputeShader->uniform("uCamera.fov"), m_viewer->getFieldOfView());
-	glUniform1f(m_RayTracingComputeShader->uniform("uCamera.reflectDepth"), 10);
-
-	glUniform1i(m_RayTracingComputeShader->uniform("uObjectNum"), objectNum);
-	glUniform1i(m_RayTracingComputeShader->uniform("uLightNum"), lightNum);
-
-	for (int i = 0; i < objectNum; i++) {
-		std::ostringstream os;
-		os << "uObjects[" << i << "]";
-		glUniform1f(m_RayTracingComputeShader->uniform(os.str().append(".type")), objects[i].type);
-		glUniform3fv(m_RayTracingComputeShader->uniform(os.str().append(".pos")), 1, glm::value_ptr(objects[i].pos));
-		glUniform3fv(m_RayTracingComputeShader->uniform(os.str().append(".rot")), 1, glm::value_ptr(objects[i].rot));
-		glUniform4fv(m_RayTracingComputeShader->uniform(os.str().append(".color")), 1, glm::value_ptr(objects[i].color));
-		glUniform3fv(m_RayTracingComputeShader->uniform(os.str().append(".vert1")), 1, glm::value_ptr(objects[i].vert1));
-		glUniform3fv(m_RayTracingComputeShader->uniform(os.str().append(".vert2")), 1, glm::value_ptr(objects[i].vert2));
-		glUniform3fv(m_RayTracingComputeShader->uniform(os.str().append(".vert3")), 1, glm::value_ptr(objects[i].vert3));
-		glUniform1f(m_RayTracingComputeShader->uniform(os.str().append(".radius")), objects[i].radius);
-		glUniform1f(m_RayTracingComputeShader->uniform(os.str().append(".diffuse")), objects[i].diffuse);
-		glUniform1f(m_RayTracingComputeShader->uniform(os.str().append(".specular")), objects[i].specular);
-		glUniform1f(m_RayTracingComputeShader->uniform(os.str().append(".shininess")), objects[i].shininess);
-		glUniform1f(m_RayTracingComputeShader->uniform(os.str().append(".reflect")), objects[i].reflect);
+	if (m_sceneDirty)
+		uploadScene();
+	bindSceneBuffers();
+	setTraceUniforms(m_RayTracingComputeShader, pattern, WAVEFRONT_OFF);
+	dispatchGrid(pattern);
+
+	m_RayTracingComputeShader->disable();
+}
+
+// Traces like dispatchRayTracing, a pass at a time: a ray per traced pixel is queued, then
+// each bounce intersects the queued rays and shades them, which queues their reflections for
+// the next one. Rays whose chain ended leave the queues, so the later bounces only dispatch
+// groups for the live ones. The CPU doesn't learn how many are left, it issues every bounce
+// the scene can have and the empty ones dispatch no groups.
+void RayTracingScene::dispatchWavefront(int pattern)
+{
+	if (m_sceneDirty)
+		uploadScene();
+	m_queues->reserve(m_width * m_height, m_maxBounces);
+	bindSceneBuffers();
+	ShaderProgram* generate = m_variants->get(traceDefines(pattern, WAVEFRONT_GENERATE));
+	ShaderProgram* intersect = m_variants->get(traceDefines(pattern, WAVEFRONT_INTERSECT));
+	ShaderProgram* shade = m_variants->get(traceDefines(pattern, WAVEFRONT_SHADE));
+
+	m_queues->clear(0);
+	m_queues->bind(-1, 0);
+	generate->use();
+	setTraceUniforms(generate, pattern, WAVEFRONT_GENERATE);
+	dispatchGrid(pattern);
+
+	intersect->use();
+	setTraceUniforms(intersect, pattern, WAVEFRONT_INTERSECT);
+	shade->use();
+	setTraceUniforms(shade, pattern, WAVEFRONT_SHADE);
+
+	int reflectDepth = std::min(m_reflectDepth, m_maxBounces);
+	for (int bounce = 0; bounce <= reflectDepth; bounce++) {
+		int in = bounce % 2;
+		m_queues->bind(in, 1 - in);
+		// hybrid primary rays were queued with their G-buffer hit
+		if (bounce > 0 || !m_hybrid) {
+			intersect->use();
+			m_queues->dispatch(in);
+		}
+
+		m_queues->clear(1 - in);
+		shade->use();
+		glUniform1i(shade->uniform("uBounce"), bounce);
+		m_queues->dispatch(in);
 	}
+	shade->disable();
+}
 
-	for (int i = 0; i < lightNum; i++) {
-		std::ostringstream os;
-		os << "uLights[" << i << "]";
-		glUniform3fv(m_RayTracingComputeShader->uniform(os.str().append(".pos")), 1, glm::value_ptr(lights[i].pos));
-		glUniform4fv(m_RayTracingComputeShader->uniform(os.str().append(".color")), 1, glm::value_ptr(lights[i].color));
+void RayTracingScene::bindSceneBuffers()
+{
+	m_objectBuffer->bind(OBJECT_BINDING);
+	m_materialBuffer->bind(MATERIAL_BINDING);
+	m_lightBuffer->bind(LIGHT_BINDING);
+	m_bvhBuffer->bind(BVH_BINDING);
+	m_sphereBuffer->bind(SPHERE_BINDING);
+	m_triangleBuffer->bind(TRIANGLE_BINDING);
+	if (m_mesh) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_POSITION_BINDING, m_mesh->positionBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_INDEX_BINDING, m_mesh->indexBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_NODE_BINDING, m_mesh->nodeBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_TRIANGLE_BINDING, m_mesh->triangleBuffer);
+	}
+}
+
+// The uniforms `program`, the current one, reads; as registered by createRayTracingShader
+void RayTracingScene::setTraceUniforms(ShaderProgram* program, int pattern, int pass, int reflectionPass)
+{
+	bool generates = pass == WAVEFRONT_OFF || pass == WAVEFRONT_GENERATE;
+	bool intersects = pass == WAVEFRONT_OFF || pass == WAVEFRONT_INTERSECT;
+	bool shades = pass == WAVEFRONT_OFF || pass == WAVEFRONT_SHADE;
+
+	if (generates) {
+		glUniform2fv(program->uniform("uSize"), 1, glm::value_ptr(glm::vec2(m_renderWidth, m_renderHeight)));
+		glUniform3fv(program->uniform("uCamera.rot"), 1, glm::value_ptr(m_viewer->getViewDir()));
+		glUniform1f(program->uniform("uCamera.fov"), m_viewer->getFieldOfView());
+		glUniform2fv(program->uniform("uJitter"), 1, glm::value_ptr(sampleJitter()));
+		if (pattern != RENDER_FULL_RATE)
+			glUniform1i(program->uniform("uFrameIndex"), m_frameIndex);
+	}
+	if (generates || shades)
+		glUniform3fv(program->uniform("uCamera.pos"), 1, glm::value_ptr(m_viewer->getViewPoint()));
+	if (intersects) {
+		glUniform1i(program->uniform("uUnboundedSpheres"), m_unboundedSpheres);
+		if (program->hasUniform("uUnboundedTriangles"))
+			glUniform1i(program->uniform("uUnboundedTriangles"), m_unboundedTriangles);
+		if (program->hasUniform("uUnboundedNum"))
+			glUniform1i(program->uniform("uUnboundedNum"), m_unboundedNum);
+		glUniform1i(program->uniform("uNodeNum"), m_nodeNum);
+	}
+	if (shades) {
+		glUniform1f(program->uniform("uCamera.reflectDepth"), (GLfloat)m_reflectDepth);
+		// the scene's variants define LIGHT_NUM unless there are no lights, the unspecialised
+		// shader the tuner times never does
+		if (program->hasUniform("uLightNum"))
+			glUniform1i(program->uniform("uLightNum"), (GLint)lights.size());
+		if (reflectionPass != REFLECTION_TRACE)
+			glUniform1i(program->uniform("uSampleIndex"), m_sampleCount);
+	}
+	if (reflectionPass != REFLECTION_FULL)
+		glUniform1i(program->uniform("uReflectionScale"), m_reflectionScale);
+}
+
+// Offset of this frame's primary rays in their pixels. The first sample goes through the
+// pixel corner as before, the next ones spread over the pixel.
+glm::vec2 RayTracingScene::sampleJitter() const
+{
+	return m_sampleCount == 0 ? glm::vec2(0) : glm::vec2(halton(m_sampleCount, 2), halton(m_sampleCount, 3)) - 0.5f;
+}
+
+// One invocation per traced pixel with the current program, the shader skips the ones past the edge
+void RayTracingScene::dispatchGrid(int pattern)
+{
+	int gridWidth = pattern == RENDER_FULL_RATE ? m_renderWidth : (m_renderWidth + 1) / 2;
+	int gridHeight = pattern == RENDER_QUARTER ? (m_renderHeight + 1) / 2 : m_renderHeight;
+	glDispatchCompute((gridWidth + m_localSize.x - 1) / m_localSize.x, (gridHeight + m_localSize.y - 1) / m_localSize.y, 1);
+}
+
+// Traces with the variant for the scene and `pattern`, into the image bound to unit 0
+void RayTracingScene::trace(int pattern)
+{
+	if (m_hybrid) {
+		rasterizePrimary();
+		m_gbuffer->bindImages();
+	}
+	if (m_wavefront) {
+		dispatchWavefront(pattern);
+		return;
+	}
+	// nothing to share in a scene without reflections
+	if (m_reflectionScale > 1 && m_maxBounces > 0 && m_reflectDepth > 0) {
+		dispatchReflections(pattern);
+		return;
+	}
+	m_RayTracingComputeShader = m_variants->get(traceDefines(pattern, WAVEFRONT_OFF));
+	dispatchRayTracing(pattern);
+}
+
+// Traces like dispatchRayTracing with the reflections at 1 / m_reflectionScale resolution:
+// one pass traces them for the pixel in the middle of each m_reflectionScale square, every
+// one of them even for a checkerboard frame, then the traced pixels blend them in
+void RayTracingScene::dispatchReflections(int pattern)
+{
+	ShaderDefines defines = traceDefines(RENDER_FULL_RATE, WAVEFRONT_OFF);
+	defines.set("REFLECTION_PASS", REFLECTION_TRACE);
+	ShaderProgram* low = m_variants->get(defines);
+	defines = traceDefines(pattern, WAVEFRONT_OFF);
+	defines.set("REFLECTION_PASS", REFLECTION_UPSAMPLE);
+	ShaderProgram* full = m_variants->get(defines);
+
+	if (m_sceneDirty)
+		uploadScene();
+	bindSceneBuffers();
+	m_reflections->bindImages();
+
+	low->use();
+	setTraceUniforms(low, RENDER_FULL_RATE, WAVEFRONT_OFF, REFLECTION_TRACE);
+	int gridWidth = (m_renderWidth + m_reflectionScale - 1) / m_reflectionScale;
+	int gridHeight = (m_renderHeight + m_reflectionScale - 1) / m_reflectionScale;
+	glDispatchCompute((gridWidth + m_localSize.x - 1) / m_localSize.x, (gridHeight + m_localSize.y - 1) / m_localSize.y, 1);
+
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	full->use();
+	setTraceUniforms(full, pattern, WAVEFRONT_OFF, REFLECTION_UPSAMPLE);
+	dispatchGrid(pattern);
+	full->disable();
+}
+
+// Draws the primary hits of the traced part of the image into the G-buffer: one instanced
+// draw for the spheres, planes and triangles, one draw per mesh object
+void RayTracingScene::rasterizePrimary()
+{
+	ProfileScope scope("G-buffer raster");
+	if (m_sceneDirty)
+		uploadScene();
+	bindSceneBuffers();
+	m_gbuffer->begin(m_renderWidth, m_renderHeight);
+
+	m_gbufferShader->use();
+	glUniform3fv(m_gbufferShader->uniform("uCamera.pos"), 1, glm::value_ptr(m_viewer->getViewPoint()));
+	glUniform3fv(m_gbufferShader->uniform("uCamera.rot"), 1, glm::value_ptr(m_viewer->getViewDir()));
+	glUniform1f(m_gbufferShader->uniform("uCamera.fov"), m_viewer->getFieldOfView());
+	glUniform2f(m_gbufferShader->uniform("uSize"), (GLfloat)m_renderWidth, (GLfloat)m_renderHeight);
+	glUniform2fv(m_gbufferShader->uniform("uJitter"), 1, glm::value_ptr(sampleJitter()));
+
+	// the vertices come from the scene buffers, the quad's attributes go unread
+	glBindVertexArray(VAO);
+	glUniform1i(m_gbufferShader->uniform("uObject"), -1);
+	glDrawArraysInstanced(GL_TRIANGLES, 0, 36, m_objectNum);
+	for (size_t i = 0; i < m_meshDraws.size(); i++) {
+		glUniform1i(m_gbufferShader->uniform("uObject"), m_meshDraws[i].object);
+		glUniform1i(m_gbufferShader->uniform("uFirstSlot"), m_meshDraws[i].firstSlot);
+		glDrawArrays(GL_TRIANGLES, 0, 3 * m_meshDraws[i].slotCount);
+	}
+	glBindVertexArray(0);
+
+	m_gbufferShader->disable();
+	m_gbuffer->end();
+	glViewport(0, 0, m_width, m_height);
+}
+
+// Completes the checkerboard frame traced into m_historyTexture[m_historyIndex] from the
+// previous one and writes it to the texture
+void RayTracingScene::reconstruct(int pattern)
+{
+	m_reconstructShader->use();
+	glBindImageTexture(1, m_historyTexture[m_historyIndex], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+	glBindImageTexture(2, m_historyTexture[1 - m_historyIndex], 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+
+	glUniform2f(m_reconstructShader->uniform("uSize"), (GLfloat)m_renderWidth, (GLfloat)m_renderHeight);
+	glUniform3fv(m_reconstructShader->uniform("uCamera.pos"), 1, glm::value_ptr(m_viewer->getViewPoint()));
+	glUniform3fv(m_reconstructShader->uniform("uCamera.rot"), 1, glm::value_ptr(m_viewer->getViewDir()));
+	glUniform1f(m_reconstructShader->uniform("uCamera.fov"), m_viewer->getFieldOfView());
+	glUniform2f(m_reconstructShader->uniform("uPrevSize"), (GLfloat)m_historyWidth, (GLfloat)m_historyHeight);
+	glUniform3fv(m_reconstructShader->uniform("uPrevCamera.pos"), 1, glm::value_ptr(m_historyViewPoint));
+	glUniform3fv(m_reconstructShader->uniform("uPrevCamera.rot"), 1, glm::value_ptr(m_historyViewDir));
+	glUniform1f(m_reconstructShader->uniform("uPrevCamera.fov"), m_historyFov);
+	glUniform1i(m_reconstructShader->uniform("uPattern"), pattern);
+	glUniform1i(m_reconstructShader->uniform("uFrameIndex"), m_frameIndex);
+	glUniform1i(m_reconstructShader->uniform("uHistoryValid"), m_historyValid);
+	glDispatchCompute((m_renderWidth + 7) / 8, (m_renderHeight + 7) / 8, 1);
+
+	m_reconstructShader->disable();
+
+	// the completed frame is the next one's history
+	m_historyViewPoint = m_viewer->getViewPoint();
+	m_historyViewDir = m_viewer->getViewDir();
+	m_historyFov = m_viewer->getFieldOfView();
+	m_historyWidth = m_renderWidth;
+	m_historyHeight = m_renderHeight;
+	m_historyIndex = 1 - m_historyIndex;
+	m_historyValid = true;
+	m_frameIndex++;
+}
+
+void RayTracingScene::readImage(std::vector<GLfloat>& rgba)
+{
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+	rgba.resize(4 * (size_t)m_width * m_height);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, rgba.data());
+}
+
+float RayTracingScene::compareWithFullRate()
+{
+	// the spare history image takes the reference, the next checkerboard frame overwrites it anyway
+	GLuint reference = m_historyTexture[m_historyIndex];
+	int sampleCount = m_sampleCount;
+	bool hybrid = m_hybrid;
+	int reflectionScale = m_reflectionScale;
+	m_sampleCount = 0;
+	m_hybrid = false;
+	m_reflectionScale = 1;
+	glBindImageTexture(0, reference, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+	trace(RENDER_FULL_RATE);
+	glBindImageTexture(0, texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+	m_sampleCount = sampleCount;
+	m_hybrid = hybrid;
+	m_reflectionScale = reflectionScale;
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+
+	std::vector<GLfloat> drawn(4 * m_width * m_height), traced(4 * m_width * m_height);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, drawn.data());
+	glBindTexture(GL_TEXTURE_2D, reference);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, traced.data());
+	glBindTexture(GL_TEXTURE_2D, texture);
+
+	// over the colours the screen shows, in the render region of both
+	double squared = 0;
+	float maxError = 0;
+	for (int y = 0; y < m_renderHeight; y++) {
+		for (int x = 0; x < m_renderWidth; x++) {
+			for (int c = 0; c < 3; c++) {
+				size_t i = 4 * ((size_t)y * m_width + x) + c;
+				float d = std::abs(glm::clamp(drawn[i], 0.0f, 1.0f) - glm::clamp(traced[i], 0.0f, 1.0f));
+				squared += d * d;
+				maxError = std::max(maxError, d);
+			}
+		}
+	}
+	double mse = squared / (3.0 * m_renderWidth * m_renderHeight);
+	float psnr = mse > 0 ? (float)(10 * std::log10(1 / mse)) : INFINITY;
+	std::cout << "Render mode " << m_renderMode << " at " << m_renderWidth << " x " << m_renderHeight
+		<< " against full rate: PSNR " << psnr << " dB, max error " << maxError << std::endl;
+	return psnr;
+}
+
+// True when the camera or the image size moved since the last call
+bool RayTracingScene::viewChanged()
+{
+	bool changed = m_viewer->getRevision() != m_lastRevision || m_width != m_lastWidth || m_height != m_lastHeight;
+
+	m_lastRevision = m_viewer->getRevision();
+	m_lastWidth = m_width;
+	m_lastHeight = m_height;
+	return changed;
+}
+
+bool RayTracingScene::needsRedraw(int w, int h) const
+{
+	// nothing to show in a minimized window
+	if (w <= 0 || h <= 0)
+		return false;
+	return w != m_width || h != m_height || m_viewer->getRevision() != m_lastRevision
+		|| m_sceneDirty || (m_mesh && m_mesh->dynamic) || m_sampleCount < m_maxSamples;
+}
+
+void RayTracingScene::draw ()
+{
+	ProfileScope scope("RayTracingScene::draw");
+	glViewport(0, 0, m_width, m_height);
+
+	// skinned meshes move every frame, nothing to accumulate
+	bool moving = viewChanged() || m_sceneDirty || (m_mesh && m_mesh->dynamic);
+	if (moving)
+		m_sampleCount = 0;
+
+	// the resolution only drops to keep motion smooth, the samples of a still view are traced
+	// at full resolution from the first one on
+	float scale = moving ? m_resolution.scale() : 1.0f;
+	int pattern = moving ? m_renderMode : RENDER_FULL_RATE;
+	int renderWidth = std::max(1, (int)(m_width * scale + 0.5f));
+	int renderHeight = std::max(1, (int)(m_height * scale + 0.5f));
+	if (renderWidth != m_renderWidth || renderHeight != m_renderHeight) {
+		m_renderWidth = renderWidth;
+		m_renderHeight = renderHeight;
+		m_sampleCount = 0;
+	}
+
+	// a converged image is presented again without tracing
+	if (m_sampleCount < m_maxSamples) {
+		ProfileScope dispatch("ray tracing dispatch");
+		if (m_sceneDirty)
+			uploadScene();
+		m_resolution.beginWork(scale);
+		if (pattern == RENDER_FULL_RATE) {
+			trace(pattern);
+			m_sampleCount++;
+		}
+		else {
+			// a reconstructed frame is no sample, the view refines from scratch once it stops
+			glBindImageTexture(0, m_historyTexture[m_historyIndex], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+			trace(pattern);
+			glBindImageTexture(0, texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+			reconstruct(pattern);
+		}
+		m_resolution.endWork();
+		m_resolution.update();
+
+		// the quad below samples what the compute shader wrote through the image
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+	else {
+		m_resolution.idle();
 	}
-	m_RayTracingComputeShader->disable();
 
+	ProfileScope present("present quad");
 	m_RayTracingShader->use();
+	glUniform2f(m_RayTracingShader->uniform("uRenderScale"), (float)m_renderWidth / m_width, (float)m_renderHeight / m_height);
 
 	glBindVertexArray(VAO);
 	glDrawArrays(GL_TRIANGLES, 0, 6);
@@ -268,6 +965,20 @@ void RayTracingScene::draw ()
 
 RayTracingScene::~RayTracingScene()
 {
-	delete[] m_RayTracingShader;
-	delete[] m_RayTracingComputeShader;
+	delete m_objectBuffer;
+	delete m_materialBuffer;
+	delete m_lightBuffer;
+	delete m_bvhBuffer;
+	delete m_sphereBuffer;
+	delete m_triangleBuffer;
+
+	glDeleteTextures(2, m_historyTexture);
+
+	delete m_RayTracingShader;
+	delete m_reconstructShader;
+	delete m_variants;
+	delete m_queues;
+	delete m_gbuffer;
+	delete m_gbufferShader;
+	delete m_reflections;
 }
\ No newline at end of file
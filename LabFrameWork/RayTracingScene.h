@@ -5,6 +5,7 @@
 #pragma warning(disable:4312)		// convert long to void*
 
 #include <iostream>
+#include <algorithm>
 #include <string>
 #include <vector>
 
@@ -16,6 +17,16 @@
 #include "Viewer.h"
 #include "ModelView.h"
 #include "Loader.h"
+#include "ComputeTuner.h"
+#include "ShaderVariants.h"
+#include "BVH.h"
+#include "TriangleMesh.h"
+#include "GpuProfiler.h"
+#include "DynamicResolution.h"
+#include "DynamicBuffer.h"
+#include "WavefrontQueues.h"
+#include "GBuffer.h"
+#include "ReflectionBuffer.h"
 
 #pragma warning(pop)
 
@@ -27,7 +38,8 @@ struct Object {
 	glm::vec3 vert1;
 	glm::vec3 vert2;
 	glm::vec3 vert3;
-	float radius;
+	float radius;           // sphere radius, scale of a mesh
+	int mesh;               // submesh of the scene's TriangleMesh placed by a mesh object
 	float diffuse;
 	float specular;
 	float shininess;
@@ -39,13 +51,134 @@ struct Light {
 	glm::vec4 color;
 };
 
+// std430 layouts of the scene storage buffers, kept in sync with RayTracing.comp.
+// A vec3 followed by a scalar shares one 16 byte slot.
+struct GPUObject {
+	glm::vec3 pos;
+	int type;
+	glm::vec3 vert1;
+	float radius;
+	glm::vec3 vert2;
+	int material;
+	glm::vec3 vert3;
+	int mesh;               // BLAS root node of a mesh object
+};
+
+struct GPUMaterial {
+	glm::vec4 color;
+	float diffuse;
+	float specular;
+	float shininess;
+	float reflect;
+};
+
+struct GPULight {
+	glm::vec4 pos;
+	glm::vec4 color;
+};
+
+// A triangle object as its ray test reads it, in world space. Spheres are a vec4, centre and radius.
+struct GPUTriangle {
+	glm::vec3 vert;
+	float pad0;
+	glm::vec3 edge1;
+	float pad1;
+	glm::vec3 edge2;
+	float pad2;
+};
+
+// Shader storage binding points of the scene buffers, the mesh ones are in TriangleMesh.h
+enum SceneBinding {
+	OBJECT_BINDING = 7,
+	MATERIAL_BINDING = 8,
+	LIGHT_BINDING = 9,
+	BVH_BINDING = 10,
+	SPHERE_BINDING = 18,
+	TRIANGLE_BINDING = 19
+};
+
+// Pixels traced per frame while the view moves: all of them, one of 2 (checkerboard) or one
+// of 4. Reconstruct.comp fills in the rest from the previous frame.
+enum RenderMode {
+	RENDER_FULL_RATE = 1,
+	RENDER_CHECKERBOARD = 2,
+	RENDER_QUARTER = 4
+};
+
 class RayTracingScene {
 public:
 	RayTracingScene(int w, int h);
 	~RayTracingScene();
 	void draw();
-	void setSize(int w, int h) { m_width = w; m_height = h; }
+	void setSize(int w, int h);
 	void setAspect(float r) { m_viewer->setAspectRatio(r); }
+	// Call after editing objects or lights, the buffers are uploaded again on the next draw
+	void markSceneDirty() { m_sceneDirty = true; }
+	// Replaces the objects and lights, e.g. with a scene shared with the CPU tracer (CrossValidation.h)
+	void setScene(const std::vector<Object>& sceneObjects, const std::vector<Light>& sceneLights)
+	{
+		objects = sceneObjects;
+		lights = sceneLights;
+		m_sceneDirty = true;
+	}
+	// Adds objects to the ones there are, e.g. the mesh objects of a MeshScene
+	void addObjects(const std::vector<Object>& moreObjects)
+	{
+		objects.insert(objects.end(), moreObjects.begin(), moreObjects.end());
+		m_sceneDirty = true;
+	}
+	// Reflections followed per pixel, the shader variants go up to 16
+	void setReflectDepth(int depth) { m_reflectDepth = std::max(0, depth); m_sceneDirty = true; }
+	// The image the last draw() traced, RGBA, row 0 first; its pixel (x, y) is the shader's
+	void readImage(std::vector<GLfloat>& rgba);
+	// Geometry of the mesh objects (type 3), e.g. Model3D::rayTracingMesh() or a MeshScene's. Not owned.
+	void setMesh(const TriangleMesh* mesh) { m_mesh = mesh; m_sceneDirty = true; }
+	// Frames average jittered samples while the view and scene stay put, up to maxSamples;
+	// after that draw() only presents the converged image. Changes restart the average.
+	void setMaxSamples(int maxSamples) { m_maxSamples = std::max(1, maxSamples); }
+	void resetAccumulation() { m_sampleCount = 0; }
+	int sampleCount() const { return m_sampleCount; }
+	// Whether draw() at a w x h framebuffer would show anything new: the view, the scene or
+	// the size changed, the mesh is animated or samples are still being added. Else the image
+	// on screen is final and the window can wait for events instead of drawing it again.
+	bool needsRedraw(int w, int h) const;
+	// While the view moves the image is traced at a lower resolution to stay within `ms` of
+	// GPU time and upscaled on the way to the screen; a still view refines at full resolution.
+	// 0 always traces at full resolution.
+	void setFrameBudget(float ms) { m_resolution.setBudget(ms); }
+	float renderScale() const { return (float)m_renderWidth / m_width; }
+	// A still view always refines at full rate
+	void setRenderMode(RenderMode mode) { m_renderMode = mode; }
+	RenderMode renderMode() const { return m_renderMode; }
+	// Traces the last drawn view at full rate, with traced primary rays and full resolution
+	// reflections, and prints the PSNR of the drawn image against it: the cost of the render
+	// mode, the resolution scale, the rasterized primary hits and the reflection scale.
+	// Returns the PSNR in dB.
+	float compareWithFullRate();
+	// Traces in wavefront passes over queues of live rays instead of one invocation per pixel
+	// following all its reflections, see WavefrontQueues.h. Same image either way.
+	void setWavefront(bool wavefront) { m_wavefront = wavefront; }
+	bool wavefront() const { return m_wavefront; }
+	// Rasterizes the primary hits into a G-buffer and only traces the reflections, see
+	// GBuffer.h. The same image up to the pixels on the edges of objects.
+	void setHybrid(bool hybrid)
+	{
+		if (hybrid != m_hybrid)
+			resetAccumulation();
+		m_hybrid = hybrid;
+	}
+	bool hybrid() const { return m_hybrid; }
+	// Traces the reflections of one pixel out of 2 x 2 or 4 x 4 and blends them into the
+	// pixels on the same surface, see ReflectionBuffer.h; 1 traces every pixel's own. Blurs
+	// reflections a little, costs only the reflection rays. Not used by the wavefront tracer.
+	void setReflectionScale(int scale)
+	{
+		scale = scale >= 4 ? 4 : scale >= 2 ? 2 : 1;
+		if (scale != m_reflectionScale)
+			resetAccumulation();
+		m_reflectionScale = scale;
+	}
+	int reflectionScale() const { return m_reflectionScale; }
 	Viewer* m_viewer;
 	float m_rotate;
 
@@ -63,13 +196,79 @@ private:
 	void setupRayTracing();
 	void initShader();
 	void initTexture();
+	void uploadScene();
+	ShaderProgram* createRayTracingShader(const std::string& defines);
+	ShaderDefines traceDefines(int pattern, int pass);
+	void bindSceneBuffers();
+	void setTraceUniforms(ShaderProgram* program, int pattern, int pass, int reflectionPass = REFLECTION_FULL);
+	void dispatchGrid(int pattern);
+	void trace(int pattern);
+	void dispatchRayTracing(int pattern = RENDER_FULL_RATE);
+	void dispatchWavefront(int pattern);
+	void dispatchReflections(int pattern);
+	void reconstruct(int pattern);
+	void rasterizePrimary();
+	glm::vec2 sampleJitter() const;
+	bool viewChanged();
 	
 	Model m_model;
-	Object* objects;
-	Light* lights;
-	unsigned int objectNum;
-	unsigned int lightNum;
+	std::vector<Object> objects;
+	std::vector<Light> lights;
+
+	DynamicBuffer* m_objectBuffer;  // rewritten in place when the scene changes, see uploadScene
+	DynamicBuffer* m_materialBuffer;
+	DynamicBuffer* m_lightBuffer;
+	DynamicBuffer* m_bvhBuffer;
+	DynamicBuffer* m_sphereBuffer;  // the ray test data of the spheres and triangles, indexed like the objects
+	DynamicBuffer* m_triangleBuffer;
+	bool m_sceneDirty;
+	int m_objectNum;        // objects uploaded, skipped mesh objects don't count
+	int m_unboundedNum;     // objects stored first and left out of the BVH: planes, or all of a small scene
+	int m_unboundedSpheres; // of those, stored first
+	int m_unboundedTriangles;   // stored next
+	int m_nodeNum;
+	int m_reflectDepth;
+	int m_maxBounces;       // MAX_BOUNCES of the uploaded scene's shader variants
+	const TriangleMesh* m_mesh;
+	ShaderDefines m_sceneDefines;   // what the uploaded scene needs of RayTracing.comp, see uploadScene
+	// mesh objects of the uploaded scene, the G-buffer pass draws them one by one
+	struct MeshDraw {
+		int object;
+		int firstSlot;
+		int slotCount;
+	};
+	std::vector<MeshDraw> m_meshDraws;
+
+	int m_sampleCount;      // samples averaged in `texture` since the last change
+	int m_maxSamples;
+	unsigned int m_lastRevision;    // of m_viewer, see Viewer::getRevision
+	int m_lastWidth, m_lastHeight;
+
+	DynamicResolution m_resolution;
+	int m_renderWidth;      // part of `texture` traced this frame, the rest of it is unused
+	int m_renderHeight;
+
+	// checkerboard frames trace into m_historyTexture[m_historyIndex], colour and primary hit
+	// distance, and reproject the other one, the previous frame seen from the camera below
+	RenderMode m_renderMode;
+	GLuint m_historyTexture[2];
+	int m_historyIndex;
+	bool m_historyValid;
+	int m_frameIndex;
+	glm::vec3 m_historyViewPoint, m_historyViewDir;
+	float m_historyFov;
+	int m_historyWidth, m_historyHeight;
+	ShaderProgram* m_reconstructShader;
 
 	ShaderProgram* m_RayTracingShader;
-	ShaderProgram* m_RayTracingComputeShader;
+	ShaderProgram* m_RayTracingComputeShader;   // current variant, owned by m_variants
+	ShaderVariants* m_variants;
+	WorkgroupSize m_localSize;
+	bool m_wavefront;
+	WavefrontQueues* m_queues;
+	bool m_hybrid;
+	GBuffer* m_gbuffer;
+	ShaderProgram* m_gbufferShader;
+	int m_reflectionScale;
+	ReflectionBuffer* m_reflections;
 };
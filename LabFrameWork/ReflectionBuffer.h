@@ -0,0 +1,86 @@
+#pragma once
+
+/*
+	Low resolution reflections.
+
+	Past the primary hit, the reflection rays of neighbouring pixels on one surface go the same
+	way and mostly return the same colour, and with a few bounces each they cost more than the
+	primary rays. With a reflection scale of 2 or 4, RayTracing.comp traces the reflections of
+	one pixel per 2 x 2 or 4 x 4 square only (REFLECTION_PASS 1) into these images, then the
+	full resolution pass (REFLECTION_PASS 2) shades every primary hit itself and blends in the
+	reflections of the nearby traced pixels that lie on the same surface: weighted bilinearly
+	and by how close their hit distance and normal are to its own. Pixels none of them match,
+	edges and thin objects, trace their own reflections as before.
+
+	Per traced pixel: the first reflected colour and what the later bounces leave of the pixel
+	(RGBA32F), the colour the later bounces add (RGBA32F), and the normal and distance of the
+	primary hit they start from, -1 when the primary ray missed (RGBA32F).
+*/
+
+#include "GL/glew.h"
+
+// Image units RayTracing.comp reads and writes them at, after the G-buffer's
+enum ReflectionUnit {
+	REFLECTION_FIRST_UNIT = 5,
+	REFLECTION_REST_UNIT = 6,
+	REFLECTION_SURFACE_UNIT = 7
+};
+
+// REFLECTION_PASS of RayTracing.comp
+enum ReflectionPass {
+	REFLECTION_FULL = 0,
+	REFLECTION_TRACE = 1,
+	REFLECTION_UPSAMPLE = 2
+};
+
+class ReflectionBuffer
+{
+public:
+	ReflectionBuffer() : m_width(0), m_height(0)
+	{
+		m_textures[0] = m_textures[1] = m_textures[2] = 0;
+	}
+
+	~ReflectionBuffer()
+	{
+		if (m_textures[0])
+			glDeleteTextures(3, m_textures);
+	}
+
+	// Room for the reflections of a w x h image at a scale of 2 or more
+	void resize(int w, int h)
+	{
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+		if (w == m_width && h == m_height)
+			return;
+		if (!m_textures[0])
+			glGenTextures(3, m_textures);
+		m_width = w;
+		m_height = h;
+		// the scene presents the texture left bound
+		GLint texture = 0;
+		glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+		for (int i = 0; i < 3; i++) {
+			glBindTexture(GL_TEXTURE_2D, m_textures[i]);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, w, h, 0, GL_RGBA, GL_FLOAT, NULL);
+		}
+		glBindTexture(GL_TEXTURE_2D, texture);
+	}
+
+	// For both reflection passes of RayTracing.comp
+	void bindImages() const
+	{
+		glBindImageTexture(REFLECTION_FIRST_UNIT, m_textures[0], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+		glBindImageTexture(REFLECTION_REST_UNIT, m_textures[1], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+		glBindImageTexture(REFLECTION_SURFACE_UNIT, m_textures[2], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+	}
+
+private:
+	GLuint m_textures[3];
+	int m_width;
+	int m_height;
+
+	ReflectionBuffer(const ReflectionBuffer&);
+	ReflectionBuffer& operator=(const ReflectionBuffer&);
+};
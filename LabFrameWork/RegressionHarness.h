@@ -0,0 +1,227 @@
+#pragma once
+
+/*
+	Performance regression harness for the CPU ray tracer.
+
+	Every scene of SceneLibrary.h is rendered with the single threaded reference
+	path (renderTile over the whole frame, i.e. plain trace() per pixel, or
+	tracePhong() for a scene set to the GPU tracer's model) and with
+	each optimised mode. An optimised image passes when its largest channel error
+	against the reference stays under the tolerance and its PSNR is high enough.
+	Timings (best of a few runs) are checked against a baseline file holding one
+	"<scene> <mode> <milliseconds>" line per render; a render fails when it got
+	slower than the baseline by more than the allowed fraction. Timings only mean
+	something on the box they were taken on, so no baseline is committed: each
+	reference box writes its own with --update-baseline. Without one the timings
+	can't be checked and the run ends with NO BASELINE rather than PASS.
+
+	Nothing here touches OpenGL, it runs on any headless CPU-only box.
+*/
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <map>
+#include <sstream>
+#include <chrono>
+#include <functional>
+#include <limits>
+
+#include "raytracer.h"
+#include "SceneLibrary.h"
+#include "SequenceRender.h"
+#include "DistributedRender.h"
+
+struct ImageDiff
+{
+	float maxAbsError;
+	double psnr;        /// in dB, infinite for identical images
+};
+
+// PSNR is taken on colors clamped to [0, 1], the range that ends up in the PPM
+inline ImageDiff compareImages(const std::vector<Vec3f>& reference, const std::vector<Vec3f>& image)
+{
+	ImageDiff diff;
+	diff.maxAbsError = 0;
+	double squared = 0;
+	for (size_t i = 0; i < reference.size() && i < image.size(); ++i) {
+		const float* a = &reference[i].x;
+		const float* b = &image[i].x;
+		for (int c = 0; c < 3; ++c) {
+			diff.maxAbsError = std::max(diff.maxAbsError, std::fabs(a[c] - b[c]));
+			double d = std::min(1.f, std::max(0.f, a[c])) - std::min(1.f, std::max(0.f, b[c]));
+			squared += d * d;
+		}
+	}
+	if (reference.size() != image.size()) diff.maxAbsError = std::numeric_limits<float>::infinity();
+
+	double mse = squared / std::max<size_t>(1, reference.size() * 3);
+	diff.psnr = (mse > 0) ? 10 * std::log10(1.0 / mse) : std::numeric_limits<double>::infinity();
+	return diff;
+}
+
+// Outcome of RegressionHarness::run, also the exit code of raytracer --regress
+enum RegressionResult
+{
+	REGRESSION_PASS = 0,
+	REGRESSION_FAIL = 1,            /// an image differs or a render got slower
+	REGRESSION_NO_BASELINE = 2      /// the images match, the timings had no baseline to check against
+};
+
+struct RegressionOptions
+{
+	std::string baselinePath;
+	std::string reportPath;     /// empty: report on stdout only
+	bool updateBaseline;        /// write the measured timings as the new baseline
+	float maxAbsError;
+	double minPsnr;
+	double timeTolerance;       /// allowed slow down against the baseline, 0.25 = 25%
+	unsigned repeat;            /// timings are the best of this many runs
+	unsigned short port;        /// localhost port of the distributed mode
+	RegressionOptions() : baselinePath("regression_baseline.txt"), updateBaseline(false),
+		maxAbsError(1e-5f), minPsnr(60), timeTolerance(0.25), repeat(3), port(5599) {}
+};
+
+class RegressionHarness
+{
+public:
+	typedef std::function<void(const std::vector<Sphere>&, const RenderSettings&, std::vector<Vec3f>&)> RenderMode;
+
+	RegressionHarness(const RegressionOptions& options) : m_options(options)
+	{
+		m_modes.push_back(std::make_pair(std::string("reference"), RenderMode(renderReference)));
+		m_modes.push_back(std::make_pair(std::string("tiles"), RenderMode(renderTiled)));
+		m_modes.push_back(std::make_pair(std::string("sequence"), RenderMode(renderSequence)));
+		unsigned short port = options.port;
+		m_modes.push_back(std::make_pair(std::string("distributed"), RenderMode(
+			[port](const std::vector<Sphere>& spheres, const RenderSettings& settings, std::vector<Vec3f>& image) {
+				runCoordinator(spheres, settings, image.data(), port, 32, 30, 2);
+			})));
+	}
+
+	// Renders everything, prints the report and returns how the checks went
+	RegressionResult run()
+	{
+		std::map<std::string, double> baseline;
+		bool haveBaseline = loadBaseline(baseline);
+
+		std::ostringstream report;
+		report << "scene     mode          time ms  baseline ms  speedup  max abs err      psnr  result\n";
+
+		std::map<std::string, double> timings;
+		bool pass = true;
+		std::vector<std::string> scenes = sceneNames();
+		for (size_t s = 0; s < scenes.size(); ++s) {
+			std::vector<Sphere> spheres;
+			RenderSettings settings;
+			buildScene(scenes[s], spheres, &settings);
+
+			std::vector<Vec3f> reference;
+			double referenceMs = 0;
+			for (size_t m = 0; m < m_modes.size(); ++m) {
+				std::vector<Vec3f> image(settings.width * settings.height);
+				double ms = time(m_modes[m].second, spheres, settings, image);
+				std::string key = scenes[s] + " " + m_modes[m].first;
+				timings[key] = ms;
+
+				if (m == 0) {
+					reference = image;
+					referenceMs = ms;
+				}
+				ImageDiff diff = compareImages(reference, image);
+
+				std::string result = "ok";
+				if (diff.maxAbsError > m_options.maxAbsError || diff.psnr < m_options.minPsnr) result = "FAIL image";
+
+				std::map<std::string, double>::const_iterator base = baseline.find(key);
+				if (base != baseline.end() && ms > base->second * (1 + m_options.timeTolerance)) {
+					result = (result == "ok") ? "FAIL slower" : result + ", slower";
+				}
+				if (result != "ok") pass = false;
+
+				char psnr[32];
+				snprintf(psnr, sizeof(psnr), std::isinf(diff.psnr) ? "inf" : "%.1f", diff.psnr);
+				char line[256];
+				snprintf(line, sizeof(line), "%-9s %-11s %9.1f  %11s  %6.2fx  %11.3g  %8s  %s\n",
+					scenes[s].c_str(), m_modes[m].first.c_str(), ms,
+					base != baseline.end() ? std::to_string((long long)(base->second + 0.5)).c_str() : "-",
+					referenceMs / std::max(ms, 1e-3), diff.maxAbsError, psnr, result.c_str());
+				report << line;
+			}
+		}
+
+		RegressionResult outcome = pass ? REGRESSION_PASS : REGRESSION_FAIL;
+		if (!haveBaseline && !m_options.updateBaseline) {
+			report << "no baseline at " << m_options.baselinePath << ", timings not checked; write one with --update-baseline\n";
+			if (pass) outcome = REGRESSION_NO_BASELINE;
+		}
+		report << (outcome == REGRESSION_PASS ? "PASS" : outcome == REGRESSION_FAIL ? "FAIL" : "NO BASELINE") << "\n";
+
+		std::cout << report.str();
+		if (!m_options.reportPath.empty()) {
+			std::ofstream ofs(m_options.reportPath.c_str());
+			ofs << report.str();
+		}
+		if (m_options.updateBaseline) saveBaseline(timings);
+		return outcome;
+	}
+
+private:
+	RegressionOptions m_options;
+	std::vector<std::pair<std::string, RenderMode> > m_modes;
+
+	static void renderReference(const std::vector<Sphere>& spheres, const RenderSettings& settings, std::vector<Vec3f>& image)
+	{
+		Tile full = { 0, 0, settings.width, settings.height };
+		renderTile(spheres, settings, full, image.data());
+	}
+
+	static void renderTiled(const std::vector<Sphere>& spheres, const RenderSettings& settings, std::vector<Vec3f>& image)
+	{
+		renderTiles(spheres, settings, makeTiles(settings, 32), image.data());
+	}
+
+	static void renderSequence(const std::vector<Sphere>& spheres, const RenderSettings& settings, std::vector<Vec3f>& image)
+	{
+		SequenceSettings sequence;
+		sequence.frameDone = [&image](unsigned, const RenderSettings&, const std::vector<Vec3f>& frame) { image = frame; };
+		SequenceRenderer renderer(std::make_shared<const std::vector<Sphere> >(spheres), settings, sequence);
+		renderer.run();
+	}
+
+	double time(const RenderMode& mode, const std::vector<Sphere>& spheres, const RenderSettings& settings, std::vector<Vec3f>& image) const
+	{
+		double best = std::numeric_limits<double>::infinity();
+		for (unsigned i = 0; i < std::max(1u, m_options.repeat); ++i) {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			mode(spheres, settings, image);
+			best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+		}
+		return best;
+	}
+
+	bool loadBaseline(std::map<std::string, double>& baseline) const
+	{
+		std::ifstream is(m_options.baselinePath.c_str());
+		if (!is.good()) return false;
+		std::string line;
+		while (std::getline(is, line)) {
+			if (line.empty() || line[0] == '#') continue;
+			std::istringstream fields(line);
+			std::string scene, mode;
+			double ms;
+			if (fields >> scene >> mode >> ms) baseline[scene + " " + mode] = ms;
+		}
+		return true;
+	}
+
+	void saveBaseline(const std::map<std::string, double>& timings) const
+	{
+		std::ofstream ofs(m_options.baselinePath.c_str());
+		ofs << "# scene mode milliseconds\n";
+		for (std::map<std::string, double>::const_iterator it = timings.begin(); it != timings.end(); ++it) {
+			ofs << it->first << " " << it->second << "\n";
+		}
+		std::cout << "Baseline written to " << m_options.baselinePath << std::endl;
+	}
+};
@@ -0,0 +1,183 @@
+#pragma once
+
+/*
+	Scene description shared by the CPU ray tracer (raytracer.h) and the GPU one
+	(RayTracingScene, RayTracing.comp), so that both can render the same scene.
+
+	It holds only what both tracers can show: spheres with a Phong material and a
+	reflectivity, point lights and a pinhole camera. A scene is one of the built in ones or
+	a text file with one item per line, '#' starting a comment:
+
+		camera <eye x y z> <target x y z> <horizontal field of view in degrees>
+		reflect-depth <reflections followed per pixel>
+		sphere <x y z> <radius> <r g b> <reflect> <specular> <shininess>
+		light <x y z> <r g b>
+
+	Nothing here depends on either tracer; CrossValidation.h converts a scene for both.
+*/
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+struct SceneSphere
+{
+	float center[3];
+	float radius;
+	float color[3];
+	float reflect;          /// 0: matte, 1: a mirror
+	float specular;
+	float shininess;
+};
+
+struct SceneLight
+{
+	float pos[3];
+	float color[3];
+};
+
+struct SceneDescription
+{
+	std::string name;       /// of the built in scene, or the file's path
+	float eye[3];
+	float target[3];
+	float fov;              /// horizontal, in degrees
+	int reflectDepth;
+	std::vector<SceneSphere> spheres;
+	std::vector<SceneLight> lights;
+
+	SceneDescription() : fov(45), reflectDepth(10)
+	{
+		set(eye, 0, 0, 0);
+		set(target, 0, 0, -1);
+	}
+
+	static std::vector<std::string> builtinNames()
+	{
+		std::vector<std::string> names;
+		names.push_back("default");
+		names.push_back("grid");
+		names.push_back("mirrors");
+		return names;
+	}
+
+	// A built in scene, or the scene file at `name` when there's none by that name
+	bool build(const std::string& scene)
+	{
+		*this = SceneDescription();
+		name = scene;
+		if (name == "default") {
+			// RayTracingScene's own spheres and lights, a large sphere for its ground plane
+			set(eye, 5, 5, 0);
+			set(target, 0, 0, 0);
+			addSphere(0, -103, 0, 100, 1, 1, 1, 0.05f, 1, 30);
+			addSphere(0, 0, 0, 2, 1, 0.2f, 0.2f, 0.1f, 3, 50);
+			addSphere(7, 0, 0, 2, 0.2f, 0.2f, 1, 0.1f, 3, 50);
+			addSphere(4, 0, 6, 3, 0.2f, 1, 0.2f, 0.1f, 2, 20);
+			addSphere(-4, 0, -5, 2, 0.2f, 1, 1, 0.1f, 2, 20);
+			addLight(10, 10, 0, 1, 1, 1);
+			addLight(-10, 10, 10, 0, 0.5f, 1);
+			return true;
+		}
+		if (name == "grid") {
+			// many small matte spheres, primary rays only: intersection bound
+			set(eye, 0, 8, 12);
+			set(target, 0, -3, -8);
+			fov = 60;
+			addSphere(0, -104, -10, 100, 0.6f, 0.6f, 0.6f, 0, 0.5f, 10);
+			for (int z = 0; z < 10; ++z)
+				for (int x = 0; x < 10; ++x)
+					addSphere(-9.0f + 2 * x, -3, -1.0f - 2 * z, 0.8f, 0.3f + 0.07f * x, 0.3f + 0.07f * z, 0.5f, 0, 1, 20);
+			addLight(0, 20, -10, 1, 1, 1);
+			addLight(-15, 10, 5, 0.4f, 0.4f, 0.6f);
+			return true;
+		}
+		if (name == "mirrors") {
+			// a ring of mirrors around a matte sphere, long chains of reflections
+			set(eye, 0, 6, 14);
+			set(target, 0, 0, 0);
+			addSphere(0, -102, 0, 100, 0.4f, 0.4f, 0.4f, 0.2f, 1, 30);
+			addSphere(0, 0, 0, 1.5f, 1, 0.3f, 0.1f, 0, 2, 40);
+			for (int i = 0; i < 8; ++i) {
+				float a = i * 0.785398163f;
+				addSphere(6 * std::cos(a), 0, 6 * std::sin(a), 2, 0.9f, 0.9f, 0.9f, 0.8f, 3, 80);
+			}
+			addLight(0, 20, 10, 1, 1, 1);
+			addLight(-15, 10, -10, 0.5f, 0.5f, 0.3f);
+			return true;
+		}
+		return load(scene);
+	}
+
+	bool load(const std::string& path)
+	{
+		std::ifstream in(path.c_str());
+		if (!in.good()) {
+			std::cerr << "No built in scene or scene file called " << path << std::endl;
+			return false;
+		}
+		*this = SceneDescription();
+		name = path;
+		std::string line;
+		for (int number = 1; std::getline(in, line); ++number) {
+			line = line.substr(0, line.find('#'));
+			std::istringstream items(line);
+			std::string kind;
+			if (!(items >> kind))
+				continue;
+			bool ok = false;
+			if (kind == "camera") {
+				ok = !!(items >> eye[0] >> eye[1] >> eye[2] >> target[0] >> target[1] >> target[2] >> fov);
+			}
+			else if (kind == "reflect-depth") {
+				ok = !!(items >> reflectDepth);
+			}
+			else if (kind == "sphere") {
+				SceneSphere s;
+				ok = !!(items >> s.center[0] >> s.center[1] >> s.center[2] >> s.radius
+					>> s.color[0] >> s.color[1] >> s.color[2] >> s.reflect >> s.specular >> s.shininess);
+				if (ok) spheres.push_back(s);
+			}
+			else if (kind == "light") {
+				SceneLight l;
+				ok = !!(items >> l.pos[0] >> l.pos[1] >> l.pos[2] >> l.color[0] >> l.color[1] >> l.color[2]);
+				if (ok) lights.push_back(l);
+			}
+			if (!ok) {
+				std::cerr << path << ":" << number << ": can't read \"" << line << "\"" << std::endl;
+				return false;
+			}
+		}
+		if (lights.empty()) {
+			std::cerr << path << ": the scene has no light" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+private:
+	static void set(float* v, float x, float y, float z) { v[0] = x, v[1] = y, v[2] = z; }
+
+	void addSphere(float x, float y, float z, float radius, float r, float g, float b, float reflect, float specular, float shininess)
+	{
+		SceneSphere s;
+		set(s.center, x, y, z);
+		s.radius = radius;
+		set(s.color, r, g, b);
+		s.reflect = reflect;
+		s.specular = specular;
+		s.shininess = shininess;
+		spheres.push_back(s);
+	}
+
+	void addLight(float x, float y, float z, float r, float g, float b)
+	{
+		SceneLight l;
+		set(l.pos, x, y, z);
+		set(l.color, r, g, b);
+		lights.push_back(l);
+	}
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "raytracer.h"
+
+// Fixed scenes of the CPU ray tracer, "default" is the one raytracer renders without arguments
+inline std::vector<std::string> sceneNames()
+{
+    std::vector<std::string> names;
+    names.push_back("default");
+    names.push_back("mirrors");
+    names.push_back("grid");
+    names.push_back("posed");
+    names.push_back("phong");
+    return names;
+}
+
+// Camera at `eye` looking at `target`, y up
+inline Matrix44f lookAt(const Vec3f& eye, const Vec3f& target)
+{
+    Vec3f forward = target - eye;
+    forward.normalize();
+    Vec3f right(-forward.z, 0, forward.x);      // forward x (0, 1, 0)
+    right.normalize();
+    Vec3f up(right.y * forward.z - right.z * forward.y, right.z * forward.x - right.x * forward.z, right.x * forward.y - right.y * forward.x);
+    Matrix44f m;
+    const Vec3f* columns[4] = { &right, &up, &forward, &eye };
+    for (int c = 0; c < 4; ++c) {
+        float sign = (c == 2) ? -1.f : 1.f;     // the camera looks down -z
+        m.m[c][0] = sign * columns[c]->x;
+        m.m[c][1] = sign * columns[c]->y;
+        m.m[c][2] = sign * columns[c]->z;
+    }
+    return m;
+}
+
+// The spheres of a scene. Scenes that need their own camera or shading also set them in
+// `settings`, when given; the other fields keep their values.
+inline bool buildScene(const std::string& name, std::vector<Sphere>& spheres, RenderSettings* settings = NULL)
+{
+    spheres.clear();
+    if (name == "default") {
+        // position, radius, surface color, reflectivity, transparency, emission color
+        spheres.push_back(Sphere(Vec3f(0.0, -10004, -20), 10000, Vec3f(0.20, 0.20, 0.20), 0, 0.0));
+        spheres.push_back(Sphere(Vec3f(0.0, 0, -20), 4, Vec3f(1.00, 0.32, 0.36), 1, 0.5));
+        spheres.push_back(Sphere(Vec3f(5.0, -1, -15), 2, Vec3f(0.90, 0.76, 0.46), 1, 0.0));
+        spheres.push_back(Sphere(Vec3f(5.0, 0, -25), 3, Vec3f(0.65, 0.77, 0.97), 1, 0.0));
+        spheres.push_back(Sphere(Vec3f(-5.5, 0, -15), 3, Vec3f(0.90, 0.90, 0.90), 1, 0.0));
+        // light
+        spheres.push_back(Sphere(Vec3f(0.0, 20, -30), 3, Vec3f(0.00, 0.00, 0.00), 0, 0.0, Vec3f(3)));
+        return true;
+    }
+    if (name == "mirrors") {
+        // a ring of mirror and glass spheres, deep reflection/refraction trees
+        spheres.push_back(Sphere(Vec3f(0.0, -10004, -20), 10000, Vec3f(0.20, 0.20, 0.20), 0.2, 0.0));
+        for (int i = 0; i < 8; ++i) {
+            float a = float(i * M_PI / 4);
+            spheres.push_back(Sphere(Vec3f(6 * cos(a), 0, -22 + 6 * sin(a)), 2, Vec3f(0.9, 0.9, 0.9), 1, (i % 2) ? 0.5f : 0.0f));
+        }
+        spheres.push_back(Sphere(Vec3f(0.0, 20, -30), 3, Vec3f(0.00, 0.00, 0.00), 0, 0.0, Vec3f(3)));
+        spheres.push_back(Sphere(Vec3f(-15.0, 10, -10), 1, Vec3f(0.00, 0.00, 0.00), 0, 0.0, Vec3f(1)));
+        return true;
+    }
+    if (name == "grid") {
+        // many small diffuse spheres, dominated by intersection tests and shadow rays
+        spheres.push_back(Sphere(Vec3f(0.0, -10004, -20), 10000, Vec3f(0.20, 0.20, 0.20), 0, 0.0));
+        for (int z = 0; z < 10; ++z) {
+            for (int x = 0; x < 10; ++x) {
+                Vec3f color(0.3f + 0.07f * x, 0.3f + 0.07f * z, 0.5f);
+                spheres.push_back(Sphere(Vec3f(-9.0f + 2 * x, -3, -12.0f - 2 * z), 0.8f, color, 0, 0.0));
+            }
+        }
+        spheres.push_back(Sphere(Vec3f(0.0, 20, -30), 3, Vec3f(0.00, 0.00, 0.00), 0, 0.0, Vec3f(3)));
+        return true;
+    }
+    if (name == "posed") {
+        // the default spheres from above and to the side, two jittered samples per pixel
+        buildScene("default", spheres);
+        if (settings) {
+            settings->cameraToWorld = lookAt(Vec3f(12, 8, -2), Vec3f(0, 0, -20));
+            settings->samples = 2;
+        }
+        return true;
+    }
+    if (name == "phong") {
+        // the GPU tracer's model (tracePhong) with highlights and a few bounces
+        spheres.push_back(Sphere(Vec3f(0.0, -10004, -20), 10000, Vec3f(0.40, 0.40, 0.40), 0.2, 0.0));
+        for (int i = 0; i < 6; ++i) {
+            float a = float(i * M_PI / 3);
+            spheres.push_back(Sphere(Vec3f(5 * cos(a), 0, -20 + 5 * sin(a)), 1.5, Vec3f(0.2f + 0.15f * i, 0.8f - 0.1f * i, 0.5), 0.5));
+            spheres.back().specular = 2;
+            spheres.back().shininess = 20 + 10 * i;
+        }
+        spheres.push_back(Sphere(Vec3f(0.0, 20, -10), 1, Vec3f(0.00, 0.00, 0.00), 0, 0.0, Vec3f(1)));
+        spheres.push_back(Sphere(Vec3f(-15.0, 10, -30), 1, Vec3f(0.00, 0.00, 0.00), 0, 0.0, Vec3f(0.3f, 0.5f, 1)));
+        if (settings) {
+            settings->cameraToWorld = lookAt(Vec3f(0, 6, 0), Vec3f(0, 0, -20));
+            settings->shading = SHADING_PHONG;
+            settings->reflectDepth = 4;
+            settings->pixelCenter = 0;
+        }
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,233 @@
+#pragma once
+
+/*
+	Frame sequence rendering for the CPU ray tracer.
+
+	A sequence is a frame range plus optional tracks: one for the camera and one
+	per animated sphere. Track files use the same format ModelManager::SetTransformData
+	reads, 16 floats (a column major 4x4 matrix) per frame, instance after instance.
+
+	Frames are cut in tiles and rendered by a single pool of threads. A thread always
+	takes the next tile of the oldest frame in flight, and only starts a new frame when
+	every started frame has handed out all of its tiles. How many frames may be in flight
+	depends on how many tiles a frame has: big frames keep every thread busy on their own
+	and only overlap with the next one (which hides the time spent saving), small frames
+	are rendered several at a time so no thread sits idle. The scene and the tracks are
+	immutable and shared by every frame, a frame only copies the spheres its tracks move.
+*/
+
+#include <cstring>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <chrono>
+#include <functional>
+
+#include "raytracer.h"
+
+// Per frame transforms read from a matrix file
+class Track
+{
+public:
+	Track() : m_frameCount(0), m_instanceCount(0) {}
+
+	bool load(const std::string& path, unsigned instanceCount = 1)
+	{
+		std::ifstream is(path.c_str());
+		if (!is.good()) {
+			std::cerr << "Failed to open track: " << path << std::endl;
+			return false;
+		}
+
+		std::vector<float> nums;
+		float num;
+		while (is >> num) nums.push_back(num);
+
+		m_instanceCount = std::max(1u, instanceCount);
+		m_frameCount = (unsigned)(nums.size() / 16 / m_instanceCount);
+		m_matrices.resize((size_t)m_frameCount * m_instanceCount);
+		for (size_t i = 0; i < m_matrices.size(); ++i) {
+			for (int k = 0; k < 16; ++k) m_matrices[i].m[k / 4][k % 4] = nums[i * 16 + k];
+		}
+		return m_frameCount > 0;
+	}
+
+	unsigned frameCount() const { return m_frameCount; }
+
+	// frames past the end loop around, like the transform frame in modelAnim.comp
+	const Matrix44f& at(unsigned frame, unsigned instance = 0) const
+	{
+		return m_matrices[(size_t)instance * m_frameCount + frame % m_frameCount];
+	}
+
+private:
+	std::vector<Matrix44f> m_matrices;
+	unsigned m_frameCount;
+	unsigned m_instanceCount;
+};
+
+struct ObjectTrack
+{
+	unsigned sphere;
+	unsigned instance;
+	std::shared_ptr<const Track> track;
+};
+
+struct SequenceSettings
+{
+	unsigned firstFrame, lastFrame;
+	unsigned tileSize;
+	unsigned threads;                   /// 0: one per hardware thread
+	std::string outPattern;             /// printf pattern taking the frame number
+	std::shared_ptr<const Track> cameraTrack;
+	std::vector<ObjectTrack> objectTracks;
+	/// called with every finished frame instead of saving it, when set
+	std::function<void(unsigned, const RenderSettings&, const std::vector<Vec3f>&)> frameDone;
+	SequenceSettings() : firstFrame(0), lastFrame(0), tileSize(32), threads(0), outPattern("frame_%04d.ppm") {}
+};
+
+class SequenceRenderer
+{
+public:
+	SequenceRenderer(std::shared_ptr<const std::vector<Sphere> > scene, const RenderSettings& settings, const SequenceSettings& sequence)
+		: m_scene(scene), m_settings(settings), m_sequence(sequence), m_nextFrame(sequence.firstFrame), m_framesDone(0)
+	{
+		m_tiles = makeTiles(settings, sequence.tileSize);
+		m_threads = sequence.threads ? sequence.threads : std::max(1u, std::thread::hardware_concurrency());
+
+		// enough frames in flight to give every thread a few tiles, plus one to hide the tail of the oldest
+		unsigned tileCount = (unsigned)m_tiles.size();
+		unsigned frameCount = sequence.lastFrame - sequence.firstFrame + 1;
+		m_maxInFlight = (4 * m_threads + tileCount - 1) / tileCount + 1;
+		m_maxInFlight = std::max(1u, std::min(m_maxInFlight, std::min(frameCount, m_threads)));
+	}
+
+	unsigned framesInFlight() const { return m_maxInFlight; }
+
+	// Renders the whole range, returns the number of frames written
+	unsigned run()
+	{
+		std::vector<std::thread> pool;
+		for (unsigned i = 1; i < m_threads; ++i) pool.push_back(std::thread(&SequenceRenderer::work, this));
+		work();
+		for (size_t i = 0; i < pool.size(); ++i) pool[i].join();
+		return m_framesDone;
+	}
+
+	// Scene and camera of one frame: the base spheres when no track moves them
+	void frameScene(unsigned frame, RenderSettings& settings, std::shared_ptr<const std::vector<Sphere> >& spheres) const
+	{
+		settings = m_settings;
+		if (m_sequence.cameraTrack) settings.cameraToWorld = m_sequence.cameraTrack->at(frame);
+
+		spheres = m_scene;
+		if (m_sequence.objectTracks.empty()) return;
+
+		std::shared_ptr<std::vector<Sphere> > moved(new std::vector<Sphere>(*m_scene));
+		for (size_t i = 0; i < m_sequence.objectTracks.size(); ++i) {
+			const ObjectTrack& t = m_sequence.objectTracks[i];
+			if (t.sphere >= moved->size()) continue;
+			(*moved)[t.sphere].center = t.track->at(frame, t.instance).multPoint((*m_scene)[t.sphere].center);
+		}
+		spheres = moved;
+	}
+
+private:
+	struct Frame
+	{
+		unsigned number;
+		RenderSettings settings;
+		std::shared_ptr<const std::vector<Sphere> > spheres;
+		std::vector<Vec3f> image;
+		unsigned nextTile;
+		unsigned tilesDone;
+	};
+
+	std::shared_ptr<const std::vector<Sphere> > m_scene;
+	RenderSettings m_settings;
+	SequenceSettings m_sequence;
+	std::vector<Tile> m_tiles;
+	unsigned m_threads;
+	unsigned m_maxInFlight;
+
+	std::mutex m_mutex;
+	std::deque<std::shared_ptr<Frame> > m_inFlight;
+	unsigned m_nextFrame;
+	unsigned m_framesDone;
+
+	// Picks the next (frame, tile), starting a frame if allowed. False when nothing is left to hand out.
+	bool take(std::shared_ptr<Frame>& frame, unsigned& tile)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t i = 0; i < m_inFlight.size(); ++i) {
+			if (m_inFlight[i]->nextTile < m_tiles.size()) {
+				frame = m_inFlight[i];
+				tile = frame->nextTile++;
+				return true;
+			}
+		}
+		if (m_nextFrame > m_sequence.lastFrame) return false;
+
+		// every frame in flight is fully handed out: start the next one, unless too many are still rendering
+		if (m_inFlight.size() >= m_maxInFlight) {
+			frame.reset();
+			return true;
+		}
+
+		frame = std::make_shared<Frame>();
+		frame->number = m_nextFrame++;
+		frameScene(frame->number, frame->settings, frame->spheres);
+		frame->image.resize(m_settings.width * m_settings.height);
+		frame->nextTile = 1;
+		frame->tilesDone = 0;
+		m_inFlight.push_back(frame);
+		tile = 0;
+		return true;
+	}
+
+	// True when this was the last tile of the frame
+	bool finishTile(const std::shared_ptr<Frame>& frame)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (++frame->tilesDone < m_tiles.size()) return false;
+		m_inFlight.erase(std::find(m_inFlight.begin(), m_inFlight.end(), frame));
+		return true;
+	}
+
+	bool deliver(const Frame& frame)
+	{
+		if (m_sequence.frameDone) {
+			m_sequence.frameDone(frame.number, frame.settings, frame.image);
+			return true;
+		}
+		char path[1024];
+		snprintf(path, sizeof(path), m_sequence.outPattern.c_str(), frame.number);
+		return savePPM(path, frame.settings, frame.image.data());
+	}
+
+	void work()
+	{
+		std::vector<Vec3f> pixels;
+		std::shared_ptr<Frame> frame;
+		unsigned tile;
+		while (take(frame, tile)) {
+			if (!frame) {
+				// the frame limit is reached and all its tiles are taken, wait for one to complete
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				continue;
+			}
+
+			const Tile& t = m_tiles[tile];
+			pixels.resize(t.pixelCount());
+			renderTile(*frame->spheres, frame->settings, t, pixels.data());
+			storeTile(frame->settings, t, pixels.data(), frame->image.data());
+
+			if (finishTile(frame) && deliver(*frame)) {
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_framesDone++;
+			}
+			frame.reset();
+		}
+	}
+};
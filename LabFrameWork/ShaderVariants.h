@@ -0,0 +1,90 @@
+#pragma once
+
+/*
+	Specialised builds of one shader.
+
+	A variant is the shader compiled with a set of #defines inserted after its #version line
+	(ShaderDefines), so the preprocessor drops the code a configuration doesn't use and loop
+	bounds become constants the compiler can unroll. Variants are compiled the first time they
+	are asked for and kept, switching back to one costs a map lookup; ShaderProgram's binary
+	cache spares the compile on later runs.
+*/
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <functional>
+
+#include "Loader.h"
+
+// Named values for a variant, written out sorted by name so equal sets give equal sources
+class ShaderDefines
+{
+public:
+	void set(const std::string& name, int value)
+	{
+		std::ostringstream os;
+		os << value;
+		m_values[name] = os.str();
+	}
+
+	void set(const std::string& name, const std::string& value) { m_values[name] = value; }
+
+	std::string str() const
+	{
+		std::ostringstream os;
+		for (std::map<std::string, std::string>::const_iterator it = m_values.begin(); it != m_values.end(); ++it)
+			os << "#define " << it->first << " " << it->second << "\n";
+		return os.str();
+	}
+
+private:
+	std::map<std::string, std::string> m_values;
+};
+
+class ShaderVariants
+{
+public:
+	// Builds the program for a defines string, including its addUniform calls
+	typedef std::function<ShaderProgram*(const std::string&)> Compile;
+
+	ShaderVariants(Compile compile) : m_compile(compile) {}
+	~ShaderVariants()
+	{
+		for (std::map<std::string, ShaderProgram*>::iterator it = m_programs.begin(); it != m_programs.end(); ++it)
+			delete it->second;
+	}
+
+	ShaderProgram* get(const ShaderDefines& defines) { return get(defines.str()); }
+
+	ShaderProgram* get(const std::string& defines)
+	{
+		std::map<std::string, ShaderProgram*>::iterator it = m_programs.find(defines);
+		if (it != m_programs.end())
+			return it->second;
+
+		std::cout << "Compiling shader variant " << m_programs.size() << ":\n" << defines;
+		ShaderProgram* program = m_compile(defines);
+		m_programs[defines] = program;
+		return program;
+	}
+
+	// Takes over a program built elsewhere with these defines, e.g. by ComputeTuner
+	void add(const std::string& defines, ShaderProgram* program)
+	{
+		std::map<std::string, ShaderProgram*>::iterator it = m_programs.find(defines);
+		if (it != m_programs.end() && it->second != program)
+			delete it->second;
+		m_programs[defines] = program;
+	}
+
+	size_t size() const { return m_programs.size(); }
+
+private:
+	Compile m_compile;
+	std::map<std::string, ShaderProgram*> m_programs;
+
+	ShaderVariants(const ShaderVariants&);
+	ShaderVariants& operator=(const ShaderVariants&);
+};
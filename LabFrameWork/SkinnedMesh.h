@@ -0,0 +1,199 @@
+#pragma once
+
+/*
+	Animated instances of a Model3D for the compute ray tracer.
+
+	modelAnim.vert only skins vertices on their way to the rasterizer, so the poses never
+	exist in memory. Every frame shaders/skinning.comp applies the same gBones palette,
+	animation frames and instance transforms (ModelManager's storage buffers 1, 2, 5 and 6)
+	to the bind pose positions and writes world space vertices, one copy per instance.
+	shaders/refit.comp then recomputes the bounds of every instance's copy of the model's
+	BLAS, one tree level per dispatch from the leaves up, so each node's children are done
+	before it. The topology never changes, only the boxes do.
+
+	`mesh` hands the result to RayTracingScene::setMesh; submesh s of instance i is
+	submesh i * submeshCount + s.
+*/
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include "GL/glew.h"
+#include "glm/glm.hpp"
+#include "glm/gtc/type_ptr.hpp"
+#include "Loader.h"
+#include "TriangleMesh.h"
+
+// Scratch bindings of the skinning and refit passes. They belong to the ray tracer's scene
+// buffers, which it binds again before every dispatch. The refit uses the MeshBinding ones.
+enum SkinningBinding {
+	SKIN_SOURCE_BINDING = 7,
+	SKIN_BONE_ID_BINDING = 8,
+	SKIN_BONE_WEIGHT_BINDING = 9,
+	SKIN_TARGET_BINDING = 10,
+	REFIT_ORDER_BINDING = 7
+};
+
+class SkinnedMesh
+{
+public:
+	TriangleMesh mesh;
+
+	SkinnedMesh() : m_skinningShader(0), m_refitShader(0), m_orderBuffer(0), m_vertexNum(0), m_instanceNum(0), m_nodesPerInstance(0) {}
+	~SkinnedMesh()
+	{
+		if (mesh.positionBuffer) glDeleteBuffers(1, &mesh.positionBuffer);
+		if (m_orderBuffer) glDeleteBuffers(1, &m_orderBuffer);
+		delete m_skinningShader;
+		delete m_refitShader;
+	}
+
+	// `source` is the model's bind pose BLAS, `positions`, `boneIds` and `boneWeights` its
+	// vertex buffers holding `vertexNum` vertices
+	void build(const TriangleMesh& source, GLuint positions, GLuint boneIds, GLuint boneWeights, int vertexNum, int instanceNum)
+	{
+		m_sourcePositions = positions;
+		m_boneIds = boneIds;
+		m_boneWeights = boneWeights;
+		m_vertexNum = vertexNum;
+		m_instanceNum = instanceNum;
+		m_nodesPerInstance = (int)source.nodes.size();
+
+		// one copy of the BLAS per instance, its leaves pointing at that instance's vertices
+		mesh.dynamic = true;
+		mesh.indexBuffer = source.indexBuffer;
+		mesh.nodes.clear();
+		mesh.triangles.clear();
+		mesh.roots.clear();
+		mesh.bounds.clear();
+		int slotsPerInstance = (int)source.triangles.size();
+		for (int i = 0; i < instanceNum; i++) {
+			for (size_t n = 0; n < source.nodes.size(); n++) {
+				BVHNode node = source.nodes[n];
+				node.leftFirst += node.count > 0 ? i * slotsPerInstance : i * m_nodesPerInstance;
+				mesh.nodes.push_back(node);
+			}
+			for (size_t t = 0; t < source.triangles.size(); t++) {
+				GPUMeshTriangle triangle = source.triangles[t];
+				triangle.baseVertex += i * vertexNum;
+				mesh.triangles.push_back(triangle);
+			}
+			for (size_t s = 0; s < source.roots.size(); s++) {
+				mesh.roots.push_back(source.roots[s] < 0 ? -1 : source.roots[s] + i * m_nodesPerInstance);
+				mesh.bounds.push_back(source.bounds[s]);
+			}
+		}
+		mesh.upload();
+
+		if (!mesh.positionBuffer) glGenBuffers(1, &mesh.positionBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mesh.positionBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, std::max(1, instanceNum * vertexNum) * 3 * sizeof(GLfloat), NULL, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+		buildRefitOrder(source);
+
+		if (!m_skinningShader) {
+			m_skinningShader = new ShaderProgram();
+			m_skinningShader->initFromFiles("shaders/skinning.comp");
+			m_skinningShader->addUniform("model");
+			m_skinningShader->addUniform("boneNum");
+			m_skinningShader->addUniform("animIndex");
+			m_skinningShader->addUniform("animMaxFrame");
+			m_skinningShader->addUniform("transMaxFrame");
+			m_skinningShader->addUniform("uVertexNum");
+		}
+		if (!m_refitShader) {
+			m_refitShader = new ShaderProgram();
+			m_refitShader->initFromFiles("shaders/refit.comp");
+			m_refitShader->addUniform("uLevelFirst");
+			m_refitShader->addUniform("uLevelCount");
+			m_refitShader->addUniform("uNodesPerInstance");
+		}
+
+		std::cout << "Skinned mesh: " << instanceNum << " instances of " << vertexNum << " vertices, "
+			<< m_levels.size() << " BLAS levels" << std::endl;
+	}
+
+	// Poses every instance for the current animation frames and refits the BLAS copies.
+	// Call after modelAnim.comp advanced the frames, with the uniforms modelAnim.vert gets.
+	void update(const glm::mat4& model, int boneNum, int animIndex, float animMaxFrame, float transMaxFrame)
+	{
+		if (m_instanceNum == 0 || m_vertexNum == 0)
+			return;
+
+		m_skinningShader->use();
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SKIN_SOURCE_BINDING, m_sourcePositions);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SKIN_BONE_ID_BINDING, m_boneIds);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SKIN_BONE_WEIGHT_BINDING, m_boneWeights);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SKIN_TARGET_BINDING, mesh.positionBuffer);
+		glUniformMatrix4fv(m_skinningShader->uniform("model"), 1, GL_FALSE, glm::value_ptr(model));
+		glUniform1i(m_skinningShader->uniform("boneNum"), boneNum);
+		glUniform1i(m_skinningShader->uniform("animIndex"), animIndex);
+		glUniform1f(m_skinningShader->uniform("animMaxFrame"), animMaxFrame);
+		glUniform1f(m_skinningShader->uniform("transMaxFrame"), transMaxFrame);
+		glUniform1i(m_skinningShader->uniform("uVertexNum"), m_vertexNum);
+		glDispatchCompute((m_vertexNum + 255) / 256, m_instanceNum, 1);
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		m_skinningShader->disable();
+
+		m_refitShader->use();
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_POSITION_BINDING, mesh.positionBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_INDEX_BINDING, mesh.indexBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_NODE_BINDING, mesh.nodeBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESH_TRIANGLE_BINDING, mesh.triangleBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, REFIT_ORDER_BINDING, m_orderBuffer);
+		glUniform1i(m_refitShader->uniform("uNodesPerInstance"), m_nodesPerInstance);
+		for (size_t level = 0; level + 1 < m_levels.size(); level++) {
+			int count = m_levels[level + 1] - m_levels[level];
+			glUniform1i(m_refitShader->uniform("uLevelFirst"), m_levels[level]);
+			glUniform1i(m_refitShader->uniform("uLevelCount"), count);
+			glDispatchCompute((count + 63) / 64, m_instanceNum, 1);
+			// the next level up reads the boxes this one wrote
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+		}
+		m_refitShader->disable();
+	}
+
+private:
+	ShaderProgram* m_skinningShader;
+	ShaderProgram* m_refitShader;
+	GLuint m_sourcePositions, m_boneIds, m_boneWeights;
+	GLuint m_orderBuffer;
+	std::vector<int> m_levels;      /// first entry of every level in the refit order, deepest level first, plus the end
+	int m_vertexNum;
+	int m_instanceNum;
+	int m_nodesPerInstance;
+
+	// Nodes of one BLAS copy grouped by depth, deepest first. Parents come before their
+	// children in the depth first layout, so depths are known in one forward pass.
+	void buildRefitOrder(const TriangleMesh& source)
+	{
+		const std::vector<BVHNode>& nodes = source.nodes;
+		std::vector<int> depth(nodes.size(), 0);
+		int maxDepth = 0;
+		for (size_t n = 0; n < nodes.size(); n++) {
+			maxDepth = std::max(maxDepth, depth[n]);
+			if (nodes[n].count == 0) {
+				depth[n + 1] = depth[n] + 1;
+				depth[nodes[n].leftFirst] = depth[n] + 1;
+			}
+		}
+
+		std::vector<int> order;
+		m_levels.clear();
+		for (int d = maxDepth; d >= 0 && !nodes.empty(); d--) {
+			m_levels.push_back((int)order.size());
+			for (size_t n = 0; n < nodes.size(); n++) {
+				if (depth[n] == d) order.push_back((int)n);
+			}
+		}
+		m_levels.push_back((int)order.size());
+		order.resize(std::max<size_t>(order.size(), 1));
+
+		if (!m_orderBuffer) glGenBuffers(1, &m_orderBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_orderBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, order.size() * sizeof(GLint), order.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+};
@@ -1,14 +1,29 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#include <cstdio>
+#include <cstring>
+#include <chrono>
 #include <iostream>
+#include <string>
 
 #include "Callback.h"
+#include "GpuProfiler.h"
+#include "HeadlessContext.h"
+#include "FrameCapture.h"
+#include "CrossValidation.h"
+#include "MeshScene.h"
 
 class Source : public Callback
 {
 public:
 	GLFWwindow* window;
+	HeadlessContext* headless;
+	FrameCapture* capture;      /// recording, NULL when not
+	MeshScene* meshes;          /// built-in mesh objects of the scene, NULL when none
+	int recordings;
+
+	Source() : window(NULL), headless(NULL), capture(NULL), meshes(NULL), recordings(0) {}
 
 	bool Init(int width, int height)
 	{
@@ -26,32 +41,363 @@ public:
 		glfwSetErrorCallback(error_callback);
 		glfwSetKeyCallback(window, key_callback);
 		glfwSetWindowSizeCallback(window, window_size_callback);
+		glfwSetWindowRefreshCallback(window, window_refresh_callback);
 		glfwSetCursorPosCallback(window, cursor_pos_callback);
 		glfwSetMouseButtonCallback(window, mouse_button_callback);
 
 		return true;
 	}
 
+	// Context and framebuffer without a window, see HeadlessContext
+	bool InitHeadless()
+	{
+		headless = new HeadlessContext();
+		return headless->create();
+	}
+
+	// The frame itself, the same with a window and without
+	void DrawFrame(int display_w, int display_h)
+	{
+		{
+			ProfileScope clear("clear");
+			glClearColor(0.2f, 0.2f, 0.2f, 1);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		}
+
+		// animated meshes are posed before the tracer reads them
+		if (meshes) {
+			ProfileScope skinning("skinning");
+			meshes->update();
+		}
+
+		// the window may have been resized, the tracer follows the framebuffer
+		scene->setSize(display_w, display_h);
+		scene->draw();
+	}
+
 	void Render()
 	{
 		// Rendering
 		int display_w, display_h;
 		glfwGetFramebufferSize(window, &display_w, &display_h);
-		
-		glClearColor(0.2f, 0.2f, 0.2f, 1);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		scene->draw();
+		// the image on screen is final: sleep until input or a window event instead of drawing
+		// it again every vsync. A recording keeps its frame rate.
+		if (!capture && !refreshNeeded && !scene->needsRedraw(display_w, display_h)) {
+			glfwWaitEvents();
+			HandleInput(display_w, display_h);
+			return;
+		}
+		refreshNeeded = false;
 
-		glfwSwapBuffers(window);
+		GpuProfiler& profiler = GpuProfiler::get();
+		profiler.beginFrame();
+		{
+			ProfileScope frame("Source::Render");
+			DrawFrame(display_w, display_h);
+			if (capture) {
+				ProfileScope readback("capture");
+				capture->capture(display_w, display_h);
+			}
+
+			ProfileScope swap("glfwSwapBuffers");
+			glfwSwapBuffers(window);
+		}
+		profiler.endFrame();
 		glfwPollEvents();
 
+		// rolling timings in the title bar, P writes the last frames as a Chrome trace
+		std::string stats = profiler.summary(true);
+		if (!stats.empty()) {
+			std::string title = "RayTracing | " + stats + " | " + std::to_string((int)(scene->renderScale() * 100 + 0.5f)) + "% res";
+			if (capture)
+				title += " | REC " + std::to_string(capture->backlog()) + " queued";
+			glfwSetWindowTitle(window, title.c_str());
+		}
+
+		HandleInput(display_w, display_h);
+	}
+
+	// Camera drags and keys of the events polled or waited for last
+	void HandleInput(int display_w, int display_h)
+	{
 		mouseDragging(display_w, display_h);
+		handleKeys();
+		if (recordKey) {
+			ToggleRecording();
+			recordKey = false;
+		}
+	}
+
+	// Starts writing the window's frames to capture<n>_<frame>.ppm, or stops it. Frames are
+	// dropped rather than holding up the window when the disk falls behind.
+	void ToggleRecording()
+	{
+		if (capture) {
+			capture->finish();
+			std::cout << capture->report() << std::endl;
+			delete capture;
+			capture = NULL;
+			return;
+		}
+		capture = new FrameCapture("capture" + std::to_string(recordings++) + "_%04d.ppm", FrameCapture::DROP);
+		std::cout << "Recording" << std::endl;
+	}
+
+	// A headless frame, read back through `capture` when `save` is set, else written to `path`
+	// unless it is empty
+	bool RenderHeadless(bool save, const std::string& path)
+	{
+		bool saved = true;
+		GpuProfiler& profiler = GpuProfiler::get();
+		profiler.beginFrame();
+		{
+			ProfileScope frame("Source::Render");
+			DrawFrame(headless->width(), headless->height());
+
+			ProfileScope readback("save frame");
+			if (save && capture)
+				capture->capture(headless->width(), headless->height());
+			else if (!path.empty())
+				saved = headless->saveFrame(path);
+			else
+				glFinish();
+		}
+		profiler.endFrame();
+		return saved && !(capture && capture->failed());
 	}
 };
 
-int main(void)
+void usage()
+{
+	std::cout << "usage: labFrameWork                                 interactive window\n"
+		"       labFrameWork --headless <frames> [options]    render frames offscreen, no display needed\n"
+		"           --width <pixels>       frame width (800)\n"
+		"           --height <pixels>      frame height (800)\n"
+		"           --out <pattern>        output files (frame_%04d.ppm), or one .y4m or .raw (RGB24) stream\n"
+		"           --every <n>            save every n-th frame, the last one always (1)\n"
+		"           --readback <mode>      async: pixel buffers read a few frames late, written by a thread;\n"
+		"                                  sync: each frame read and written before the next (async)\n"
+		"           --disk <policy>        when async writes fall behind, block the frames or drop them (block)\n"
+		"           --queue <frames>       frames waiting for the disk before that happens (8)\n"
+		"           --orbit <fraction>     turn the camera by this much of a window wide drag per frame (0)\n"
+		"           --mode <1|2|4>         pixels traced per frame while the camera moves, see RenderMode (1)\n"
+		"           --budget <ms>          frame time budget of the dynamic resolution, 0 is off (0)\n"
+		"           --samples <n>          still frames average up to n samples (64)\n"
+		"           --wavefront <0|1>      trace in wavefront passes over ray queues (0)\n"
+		"           --hybrid <0|1>         rasterize the primary hits, trace only the reflections (0)\n"
+		"           --reflections <1|2|4>  trace reflections for one pixel out of n x n, blend them into the rest (1)\n"
+		"           --meshes <n>           add n triangle mesh objects, spheres and cubes, to the scene (0)\n"
+		"           --crowd <n>            add n animated figures, skinned and refit every frame, instead (0)\n"
+		"           --trace <file>         write the profile of the last frames as a Chrome trace\n"
+		"       labFrameWork --benchmark <scene> [options]    render one scene with the GPU and the CPU tracer,\n"
+		"                                                     compare their speed and images\n"
+		"           <scene>                a scene file (see SceneDescription.h) or built in:";
+	std::vector<std::string> scenes = SceneDescription::builtinNames();
+	for (size_t i = 0; i < scenes.size(); ++i)
+		std::cout << " " << scenes[i];
+	std::cout << "\n"
+		"           --width <pixels>       image width (400)\n"
+		"           --height <pixels>      image height (300)\n"
+		"           --repeat <n>           time the best of n renders per tracer (3)\n"
+		"           --threads <n>          CPU render threads, 0 is one per hardware thread (0)\n"
+		"           --tolerance <value>    a pixel differs when a channel is further apart than this (0.01)\n"
+		"           --min-psnr <dB>        fail when the images are further apart than this (40)\n"
+		"           --diff <file>          write the per pixel difference, white at the tolerance, as a PPM\n"
+		"           --cpu-out <file>       write the CPU image as a PPM\n"
+		"           --gpu-out <file>       write the GPU image as a PPM" << std::endl;
+}
+
+// Renders `frames` frames into an offscreen framebuffer through Source::DrawFrame
+int runHeadless(int frames, int argc, char** argv)
 {
+	int width = 800, height = 800, every = 1, mode = RENDER_FULL_RATE, samples = 64, queue = 8, wavefront = 0, hybrid = 0, reflections = 1, meshes = 0, crowd = 0;
+	float orbit = 0, budget = 0;
+	std::string out = "frame_%04d.ppm", trace, readback = "async", disk = "block";
+	for (int i = 3; i + 1 < argc; i += 2) {
+		if (!strcmp(argv[i], "--width")) width = std::max(1, atoi(argv[i + 1]));
+		else if (!strcmp(argv[i], "--height")) height = std::max(1, atoi(argv[i + 1]));
+		else if (!strcmp(argv[i], "--out")) out = argv[i + 1];
+		else if (!strcmp(argv[i], "--every")) every = std::max(1, atoi(argv[i + 1]));
+		else if (!strcmp(argv[i], "--orbit")) orbit = (float)atof(argv[i + 1]);
+		else if (!strcmp(argv[i], "--mode")) mode = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "--budget")) budget = (float)atof(argv[i + 1]);
+		else if (!strcmp(argv[i], "--samples")) samples = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "--trace")) trace = argv[i + 1];
+		else if (!strcmp(argv[i], "--readback")) readback = argv[i + 1];
+		else if (!strcmp(argv[i], "--disk")) disk = argv[i + 1];
+		else if (!strcmp(argv[i], "--queue")) queue = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "--wavefront")) wavefront = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "--hybrid")) hybrid = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "--reflections")) reflections = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "--meshes")) meshes = std::max(0, atoi(argv[i + 1]));
+		else if (!strcmp(argv[i], "--crowd")) crowd = std::max(0, atoi(argv[i + 1]));
+	}
+	bool async = readback == "async";
+	if ((mode != RENDER_FULL_RATE && mode != RENDER_CHECKERBOARD && mode != RENDER_QUARTER)
+		|| (reflections != 1 && reflections != 2 && reflections != 4) || (meshes > 0 && crowd > 0)
+		|| (!async && readback != "sync") || (disk != "block" && disk != "drop")
+		|| (!async && FrameCapture::formatOf(out) != FrameCapture::PPM_SEQUENCE)) {
+		usage();
+		return 1;
+	}
+
+	Source* source = new Source();
+	if (!source->InitHeadless()) {
+		delete source->headless;
+		delete source;
+		return 1;
+	}
+
+	glewExperimental = GL_TRUE;
+	if (glewInit() != GLEW_OK)
+	{
+		std::cout << "glewInit failed" << std::endl;
+		return 1;
+	}
+	// glewInit can leave an error behind on core contexts
+	glGetError();
+	printf("OpenGL %s, GLSL %s, %s\n", glGetString(GL_VERSION), glGetString(GL_SHADING_LANGUAGE_VERSION), glGetString(GL_RENDERER));
+	if (!source->headless->createFramebuffer(width, height))
+		return 1;
+
+	source->scene = new RayTracingScene(width, height);
+	source->scene->setFrameBudget(budget);
+	source->scene->setRenderMode((RenderMode)mode);
+	source->scene->setMaxSamples(samples);
+	source->scene->setWavefront(wavefront != 0);
+	source->scene->setHybrid(hybrid != 0);
+	source->scene->setReflectionScale(reflections);
+	// the constructor's compatibility profile calls (glShadeModel, GL_TEXTURE_2D) fail on a
+	// core context, only the frames' errors are reported below
+	while (glGetError() != GL_NO_ERROR) {}
+	// the scene has one mesh, the static one or the crowd's
+	if (meshes > 0 || crowd > 0) {
+		source->meshes = new MeshScene();
+		if (crowd > 0)
+			source->meshes->buildCrowd(*source->scene, crowd);
+		else
+			source->meshes->build(*source->scene, meshes);
+	}
+	if (async)
+		source->capture = new FrameCapture(out, disk == "drop" ? FrameCapture::DROP : FrameCapture::BLOCK, queue);
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int written = 0;
+	bool ok = true;
+	for (int i = 0; i < frames && ok; i++) {
+		if (orbit != 0)
+			source->scene->m_viewer->rotate(orbit, 0);
+		bool save = i % every == 0 || i == frames - 1;
+		std::string path;
+		if (save && !async) {
+			char name[1024];
+			snprintf(name, sizeof(name), out.c_str(), i);
+			path = name;
+		}
+		ok = source->RenderHeadless(save, path);
+		written += ok && !path.empty();
+	}
+
+	// the render loop's time, the frames still on their way to the disk are waited for after it
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Rendered " << frames << " frames of " << width << " x " << height << " in " << ms << " ms ("
+		<< ms / frames << " ms per frame)";
+	if (source->capture) {
+		source->capture->finish();
+		ok = ok && !source->capture->failed();
+		std::cout << std::endl << source->capture->report() << std::endl;
+	}
+	else
+		std::cout << ", wrote " << written << " to " << out << std::endl;
+	if (!trace.empty())
+		GpuProfiler::get().writeChromeTrace(trace);
+
+	GLenum error = glGetError();
+	if (error != GL_NO_ERROR) {
+		std::cout << "GL error 0x" << std::hex << error << std::dec << std::endl;
+		ok = false;
+	}
+
+	// the scene's, the capture's and the profiler's GL objects go before the context
+	delete source->capture;
+	delete source->scene;
+	delete source->meshes;
+	GpuProfiler::get().release();
+	delete source->headless;
+	delete source;
+	return ok ? 0 : 1;
+}
+
+// Renders one scene with the GPU and the CPU tracer offscreen, see CrossValidation
+int runBenchmark(const std::string& name, int argc, char** argv)
+{
+	CrossValidationOptions options;
+	for (int i = 3; i + 1 < argc; i += 2) {
+		if (!strcmp(argv[i], "--width")) options.width = std::max(1, atoi(argv[i + 1]));
+		else if (!strcmp(argv[i], "--height")) options.height = std::max(1, atoi(argv[i + 1]));
+		else if (!strcmp(argv[i], "--repeat")) options.repeat = std::max(1, atoi(argv[i + 1]));
+		else if (!strcmp(argv[i], "--threads")) options.threads = std::max(0, atoi(argv[i + 1]));
+		else if (!strcmp(argv[i], "--tolerance")) options.tolerance = (float)atof(argv[i + 1]);
+		else if (!strcmp(argv[i], "--min-psnr")) options.minPsnr = atof(argv[i + 1]);
+		else if (!strcmp(argv[i], "--diff")) options.diffPath = argv[i + 1];
+		else if (!strcmp(argv[i], "--cpu-out")) options.cpuPath = argv[i + 1];
+		else if (!strcmp(argv[i], "--gpu-out")) options.gpuPath = argv[i + 1];
+	}
+	SceneDescription scene;
+	if (options.tolerance <= 0 || !scene.build(name)) {
+		usage();
+		return 1;
+	}
+
+	Source* source = new Source();
+	if (!source->InitHeadless()) {
+		delete source->headless;
+		delete source;
+		return 1;
+	}
+
+	glewExperimental = GL_TRUE;
+	if (glewInit() != GLEW_OK)
+	{
+		std::cout << "glewInit failed" << std::endl;
+		return 1;
+	}
+	glGetError();
+	printf("OpenGL %s, GLSL %s, %s\n", glGetString(GL_VERSION), glGetString(GL_SHADING_LANGUAGE_VERSION), glGetString(GL_RENDERER));
+	if (!source->headless->createFramebuffer(options.width, options.height))
+		return 1;
+
+	source->scene = new RayTracingScene(options.width, options.height);
+	// the constructor's compatibility profile errors, as in runHeadless
+	while (glGetError() != GL_NO_ERROR) {}
+
+	bool ok = CrossValidation(scene, options).run(*source->scene);
+
+	GLenum error = glGetError();
+	if (error != GL_NO_ERROR) {
+		std::cout << "GL error 0x" << std::hex << error << std::dec << std::endl;
+		ok = false;
+	}
+
+	delete source->scene;
+	GpuProfiler::get().release();
+	delete source->headless;
+	delete source;
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc >= 3 && !strcmp(argv[1], "--headless"))
+		return runHeadless(std::max(1, atoi(argv[2])), argc, argv);
+	if (argc >= 3 && !strcmp(argv[1], "--benchmark"))
+		return runBenchmark(argv[2], argc, argv);
+	if (argc > 1) {
+		usage();
+		return 1;
+	}
+
 	if (!glfwInit())
 	{
 		std::cout << "GLFW Initialization has failed" << std::endl;
@@ -88,7 +434,11 @@ int main(void)
 	{
 		source->Render();
 	}
+	// a recording still running gets its last frames written
+	if (source->capture)
+		source->ToggleRecording();
 
+	GpuProfiler::get().release();
 	glfwDestroyWindow(source->window);
 
 	glfwTerminate();
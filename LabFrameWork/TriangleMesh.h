@@ -0,0 +1,153 @@
+#pragma once
+
+/*
+	Triangle meshes for the compute ray tracer.
+
+	The geometry stays in the buffers the rasterizer draws from: tightly packed vec3
+	positions (Model3D::VBO_position) and three GLuint indices per triangle counted from
+	the base vertex of their submesh (Model3D::EBO). The shader reads those as storage
+	buffers. Next to them every submesh gets a bottom level BVH over its triangles; the
+	BLAS nodes of all submeshes share one buffer and every leaf slot names its triangle by
+	first index and base vertex, so the shader needs no per submesh table. A scene object
+	places a submesh by the index of its root node.
+
+	A dynamic mesh (SkinnedMesh) moves its vertices and refits the BLAS bounds on the GPU
+	every frame, the scene can't bound its objects and tests them one by one.
+*/
+
+#include <iostream>
+#include <vector>
+
+#include "GL/glew.h"
+#include "glm/glm.hpp"
+#include "BVH.h"
+
+// std430 layout of a BLAS leaf slot, an ivec2 in RayTracing.comp
+struct GPUMeshTriangle {
+	GLint firstIndex;
+	GLint baseVertex;
+};
+
+// Shader storage binding points of the mesh buffers in RayTracing.comp and refit.comp
+enum MeshBinding {
+	MESH_POSITION_BINDING = 11,
+	MESH_INDEX_BINDING = 12,
+	MESH_NODE_BINDING = 13,
+	MESH_TRIANGLE_BINDING = 14
+};
+
+struct SubMeshRange {
+	GLuint baseVertex;
+	GLuint baseIndex;
+	GLuint numIndices;
+};
+
+class TriangleMesh
+{
+public:
+	GLuint positionBuffer;          /// owned by the model
+	GLuint indexBuffer;             /// owned by the model
+	GLuint nodeBuffer;              /// BLAS nodes of every submesh
+	GLuint triangleBuffer;          /// GPUMeshTriangle per BLAS leaf slot
+	std::vector<int> roots;         /// root node of each submesh, -1 when it has no triangles
+	std::vector<AABB> bounds;       /// bounds of each submesh
+	std::vector<BVHNode> nodes;     /// CPU copy of nodeBuffer
+	std::vector<GPUMeshTriangle> triangles; /// CPU copy of triangleBuffer
+	bool dynamic;                   /// bounds change on the GPU, `bounds` is only the bind pose
+
+	TriangleMesh() : positionBuffer(0), indexBuffer(0), nodeBuffer(0), triangleBuffer(0), dynamic(false) {}
+	~TriangleMesh()
+	{
+		if (nodeBuffer) glDeleteBuffers(1, &nodeBuffer);
+		if (triangleBuffer) glDeleteBuffers(1, &triangleBuffer);
+	}
+
+	// Builds a BLAS per submesh from the CPU copy of the data already uploaded to
+	// `positions` and `indices`, and uploads the BLAS buffers
+	void build(GLuint positions, GLuint indices, const std::vector<glm::vec3>& positionData,
+		const std::vector<GLuint>& indexData, const std::vector<SubMeshRange>& submeshes)
+	{
+		positionBuffer = positions;
+		indexBuffer = indices;
+		roots.clear();
+		bounds.clear();
+		nodes.clear();
+		triangles.clear();
+		for (size_t s = 0; s < submeshes.size(); s++) {
+			const SubMeshRange& range = submeshes[s];
+			std::vector<AABB> boxes(range.numIndices / 3);
+			for (size_t t = 0; t < boxes.size(); t++) {
+				for (int corner = 0; corner < 3; corner++)
+					boxes[t].grow(positionData[range.baseVertex + indexData[range.baseIndex + 3 * t + corner]]);
+				// flat boxes of axis aligned triangles would be missed by rays grazing them
+				boxes[t].min -= glm::vec3(1e-4f);
+				boxes[t].max += glm::vec3(1e-4f);
+			}
+
+			BVH bvh;
+			bvh.build(boxes);
+			int firstNode = (int)nodes.size();
+			int firstSlot = (int)triangles.size();
+			for (size_t i = 0; i < bvh.nodes.size(); i++) {
+				BVHNode node = bvh.nodes[i];
+				node.leftFirst += node.count > 0 ? firstSlot : firstNode;
+				nodes.push_back(node);
+			}
+			for (size_t i = 0; i < bvh.order.size(); i++) {
+				GPUMeshTriangle triangle = { (GLint)(range.baseIndex + 3 * bvh.order[i]), (GLint)range.baseVertex };
+				triangles.push_back(triangle);
+			}
+
+			// an empty submesh has no root and can't be placed
+			bounds.push_back(bvh.nodes.empty() ? AABB() : AABB(bvh.nodes[0].min, bvh.nodes[0].max));
+			roots.push_back(bvh.nodes.empty() ? -1 : firstNode);
+		}
+
+		upload();
+		std::cout << "Mesh BLAS: " << submeshes.size() << " submeshes, " << nodes.size() << " nodes" << std::endl;
+	}
+
+	// BLAS leaf slots under `root`, i.e. the triangles of the submesh it is the root of:
+	// [first, first + count). The leaves of a subtree hold consecutive slots.
+	void slotRange(int root, int& first, int& count) const
+	{
+		int end = 0;
+		first = (int)triangles.size();
+		std::vector<int> stack(1, root);
+		while (!stack.empty()) {
+			const BVHNode& node = nodes[stack.back()];
+			int n = stack.back();
+			stack.pop_back();
+			if (node.count > 0) {
+				first = std::min(first, node.leftFirst);
+				end = std::max(end, node.leftFirst + node.count);
+				continue;
+			}
+			stack.push_back(n + 1);
+			stack.push_back(node.leftFirst);
+		}
+		count = std::max(end - first, 0);
+	}
+
+	// (Re)creates nodeBuffer and triangleBuffer from `nodes` and `triangles`
+	void upload()
+	{
+		// never allocate an empty buffer
+		BVHNode noNode = BVHNode();
+		GPUMeshTriangle noTriangle = GPUMeshTriangle();
+
+		if (!nodeBuffer) glGenBuffers(1, &nodeBuffer);
+		if (!triangleBuffer) glGenBuffers(1, &triangleBuffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, nodeBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(nodes.size(), 1) * sizeof(BVHNode),
+			nodes.empty() ? &noNode : nodes.data(), dynamic ? GL_DYNAMIC_COPY : GL_STATIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, triangleBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(triangles.size(), 1) * sizeof(GPUMeshTriangle),
+			triangles.empty() ? &noTriangle : triangles.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+private:
+	TriangleMesh(const TriangleMesh&);
+	TriangleMesh& operator=(const TriangleMesh&);
+};
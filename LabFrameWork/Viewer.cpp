@@ -22,7 +22,8 @@ Viewer::Viewer(
 	m_aspectRatio(aspectRatio),
 	m_translateSpeed(DEFAULT_TRANSLATE_SPEED),
 	m_zoomFraction(DEFAULT_ZOOM_FRACTION),
-	m_rotateSpeed(DEFAULT_ROTATE_SPEED)
+	m_rotateSpeed(DEFAULT_ROTATE_SPEED),
+	m_revision(0)
 {
 	m_upVector = glm::normalize(m_upVector);
 
@@ -39,17 +40,23 @@ void Viewer::translate(float changeHoriz, float changeVert, bool inImagePlane) {
 		translateVec = (m_viewCenter - m_viewPoint) * changeVert;
 	}
 	translateVec *= m_translateSpeed;
+	if (translateVec == glm::vec3(0))
+		return;
 
 	m_viewPoint += translateVec;
 	m_viewCenter += translateVec;
+	m_revision++;
 }
 
 void Viewer::zoom(float changeVert) {
+	if (changeVert == 0)
+		return;
 
 	float scaleFactor = powf(2.0, -changeVert * m_zoomFraction);
 	m_viewPoint = m_viewCenter + (m_viewPoint - m_viewCenter) * scaleFactor;
 
 	getFrustrumInfo();
+	m_revision++;
 }
 
 const float pi = glm::pi<float>();
@@ -93,6 +100,9 @@ void makeOrthogonalTo(glm::vec3& vec1, glm::vec3& vec2) {
 void Viewer::rotate(float changeHoriz, float changeVert) {
 	float horizRotAngle = m_rotateSpeed * changeVert;
 	float vertRotAngle = -m_rotateSpeed * changeHoriz;
+	// a held button with the mouse at rest, no change
+	if (horizRotAngle == 0 && vertRotAngle == 0)
+		return;
 
 	glm::quat horizRot;
 	horizRot = setFromAxisAngle(m_imagePlaneHorizDir, horizRotAngle);
@@ -109,17 +119,20 @@ void Viewer::rotate(float changeHoriz, float changeVert) {
 	m_viewPoint = m_viewCenter + viewVec;
 
 	getFrustrumInfo();
+	m_revision++;
 }
 
 void Viewer::centerAt(const  glm::vec3& pos) {
 	m_viewPoint += (pos - m_viewCenter);
 	m_viewCenter = pos;
 	getFrustrumInfo();
+	m_revision++;
 }
 
 void Viewer::lookFrom(const glm::vec3& pos) {
 	m_viewPoint = pos;
 	getFrustrumInfo();
+	m_revision++;
 }
 
 glm::vec3 Viewer::getViewPoint() const {
@@ -154,10 +167,15 @@ glm::vec3 Viewer::getImagePlaneVertDir() const {
 	return(m_imagePlaneVertDir);
 }
 
+unsigned int Viewer::getRevision() const {
+	return(m_revision);
+}
+
 void Viewer::setAspectRatio(float aspectRatio) {
 	if (m_aspectRatio != aspectRatio) {
 		m_aspectRatio = aspectRatio;
 		getFrustrumInfo();
+		m_revision++;
 	}
 }
 
@@ -165,6 +183,7 @@ void Viewer::setFieldOfView(float fieldOfView) {
 	if (m_fieldOfView != fieldOfView) {
 		m_fieldOfView = fieldOfView;
 		getFrustrumInfo();
+		m_revision++;
 	}
 }
 
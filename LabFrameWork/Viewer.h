@@ -49,6 +49,13 @@ class Viewer {
 		/** The worldspace direction (i.e., normalized vector) of the vertical image axis	*/
 		glm::vec3 getImagePlaneVertDir() const;
 
+		/**
+		 * Bumped by every call that actually moves the camera or changes its frustum, so
+		 * a renderer can tell whether the view changed since its last frame by comparing
+		 * it with the value it drew.
+		 */
+		unsigned int getRevision() const;
+
 		/** 
 		 * Translate
 		 *
@@ -145,6 +152,8 @@ class Viewer {
 		float m_zoomFraction;
 		float m_rotateSpeed;
 
+		unsigned int m_revision;
+
 		glm::vec3 m_viewDir;
 		glm::vec3 m_imagePlaneHorizDir;
 		glm::vec3 m_imagePlaneVertDir;
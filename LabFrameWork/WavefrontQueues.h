@@ -0,0 +1,117 @@
+#pragma once
+
+/*
+	Ray queues of the wavefront variant of RayTracing.comp.
+
+	Instead of one invocation following a pixel's reflections in a loop, where the lanes of
+	pixels whose chain already ended idle until the longest one in their group is done, the
+	tracer runs as passes over queues of rays: a ray per pixel is queued, the queued rays are
+	intersected, the hits are shaded and their reflections appended to the other queue with an
+	atomic counter, and so on per bounce. Every queue starts with the indirect dispatch
+	arguments of the passes reading it, counted up by the appends themselves, so the CPU never
+	reads back how many rays are left.
+
+	A pixel's colour and the objects its reflections went through stay in a PixelState array
+	between the passes, indexed by the slot of its primary ray.
+*/
+
+#include <algorithm>
+
+#include "GL/glew.h"
+
+// WAVEFRONT_PASS of RayTracing.comp
+enum WavefrontPass {
+	WAVEFRONT_OFF = 0,
+	WAVEFRONT_GENERATE = 1,
+	WAVEFRONT_INTERSECT = 2,
+	WAVEFRONT_SHADE = 3
+};
+
+// Shader storage binding points of the queues in RayTracing.comp
+enum WavefrontBinding {
+	WAVEFRONT_IN_BINDING = 15,
+	WAVEFRONT_OUT_BINDING = 16,
+	WAVEFRONT_PIXEL_BINDING = 17
+};
+
+class WavefrontQueues
+{
+public:
+	// std430 sizes in RayTracing.comp: the queue header, a Ray and a PixelState without its path
+	static const int HEADER_SIZE = 16;
+	static const int RAY_SIZE = 64;
+	static const int PIXEL_SIZE = 32;
+
+	WavefrontQueues() : m_pixels(0), m_capacity(0), m_maxBounces(-1)
+	{
+		m_queues[0] = m_queues[1] = 0;
+	}
+
+	~WavefrontQueues()
+	{
+		if (m_pixels) {
+			glDeleteBuffers(2, m_queues);
+			glDeleteBuffers(1, &m_pixels);
+		}
+	}
+
+	// Room for `rays` primary rays (at most one per pixel) whose chains are up to `maxBounces`
+	// reflections long, the MAX_BOUNCES of the shader
+	void reserve(int rays, int maxBounces)
+	{
+		if (rays <= m_capacity && maxBounces == m_maxBounces)
+			return;
+		if (!m_pixels) {
+			glGenBuffers(2, m_queues);
+			glGenBuffers(1, &m_pixels);
+		}
+		m_capacity = std::max(rays, m_capacity);
+		m_maxBounces = maxBounces;
+		// the path is an int array, the struct is padded to its 16 byte alignment
+		size_t pixelSize = (PIXEL_SIZE + 4 * (maxBounces + 1) + 15) / 16 * 16;
+		for (int i = 0; i < 2; i++) {
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_queues[i]);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, HEADER_SIZE + (size_t)RAY_SIZE * m_capacity, NULL, GL_DYNAMIC_COPY);
+		}
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_pixels);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, pixelSize * m_capacity, NULL, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// Empties queue 0 or 1, after the passes issued so far are done with it
+	void clear(int queue)
+	{
+		const GLuint empty[4] = { 0, 1, 1, 0 };
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_queues[queue]);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(empty), empty);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+
+	// Passes read the queue `in` (none when -1) and append to `out`
+	void bind(int in, int out)
+	{
+		if (in >= 0) glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_IN_BINDING, m_queues[in]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_OUT_BINDING, m_queues[out]);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WAVEFRONT_PIXEL_BINDING, m_pixels);
+	}
+
+	// One invocation per ray of `queue`, with the current program
+	void dispatch(int queue)
+	{
+		// the appends that counted the groups have to land first
+		glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_queues[queue]);
+		glDispatchComputeIndirect(0);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+	}
+
+private:
+	GLuint m_queues[2];
+	GLuint m_pixels;
+	int m_capacity;
+	int m_maxBounces;
+
+	WavefrontQueues(const WavefrontQueues&);
+	WavefrontQueues& operator=(const WavefrontQueues&);
+};
@@ -1,222 +1,189 @@
-#include <cstdlib> 
-#include <cstdio> 
-#include <cmath> 
-#include <fstream> 
-#include <vector> 
-#include <iostream> 
-#include <cassert> 
-#include <algorithm> 
-
-#if defined __linux__ || defined __APPLE__ 
-// "Compiled for Linux
-#else 
-// Windows doesn't define these values by default, Linux does
-#define M_PI 3.141592653589793 
-#define INFINITY 1e8 
-#endif 
-
-template<typename T>
-class Vec3
-{
-public:
-    T x, y, z;
-    Vec3() : x(T(0)), y(T(0)), z(T(0)) {}
-    Vec3(T xx) : x(xx), y(xx), z(xx) {}
-    Vec3(T xx, T yy, T zz) : x(xx), y(yy), z(zz) {}
-    Vec3& normalize()
-    {
-        T nor2 = length2();
-        if (nor2 > 0) {
-            T invNor = 1 / sqrt(nor2);
-            x *= invNor, y *= invNor, z *= invNor;
-        }
-        return *this;
-    }
-    Vec3<T> operator * (const T& f) const { return Vec3<T>(x * f, y * f, z * f); }
-    Vec3<T> operator * (const Vec3<T>& v) const { return Vec3<T>(x * v.x, y * v.y, z * v.z); }
-    T dot(const Vec3<T>& v) const { return x * v.x + y * v.y + z * v.z; }
-    Vec3<T> operator - (const Vec3<T>& v) const { return Vec3<T>(x - v.x, y - v.y, z - v.z); }
-    Vec3<T> operator + (const Vec3<T>& v) const { return Vec3<T>(x + v.x, y + v.y, z + v.z); }
-    Vec3<T>& operator += (const Vec3<T>& v) { x += v.x, y += v.y, z += v.z; return *this; }
-    Vec3<T>& operator *= (const Vec3<T>& v) { x *= v.x, y *= v.y, z *= v.z; return *this; }
-    Vec3<T> operator - () const { return Vec3<T>(-x, -y, -z); }
-    T length2() const { return x * x + y * y + z * z; }
-    T length() const { return sqrt(length2()); }
-    friend std::ostream& operator << (std::ostream& os, const Vec3<T>& v)
-    {
-        os << "[" << v.x << " " << v.y << " " << v.z << "]";
-        return os;
-    }
-};
+#include <cstring>
+#include <string>
 
-typedef Vec3<float> Vec3f;
+#include "raytracer.h"
+#include "DistributedRender.h"
+#include "SequenceRender.h"
+#include "SceneLibrary.h"
+#include "RegressionHarness.h"
+#include "Denoiser.h"
 
-class Sphere
+void render(const std::vector<Sphere>& spheres)
 {
-public:
-    Vec3f center;                           /// position of the sphere 
-    float radius, radius2;                  /// sphere radius and radius^2 
-    Vec3f surfaceColor, emissionColor;      /// surface color and emission (light) 
-    float transparency, reflection;         /// surface transparency and reflectivity 
-    Sphere(
-        const Vec3f& c,
-        const float& r,
-        const Vec3f& sc,
-        const float& refl = 0,
-        const float& transp = 0,
-        const Vec3f& ec = 0) :
-        center(c), radius(r), radius2(r* r), surfaceColor(sc), emissionColor(ec),
-        transparency(transp), reflection(refl)
-    { /* empty */
-    }
-    bool intersect(const Vec3f& rayorig, const Vec3f& raydir, float& t0, float& t1) const
-    {
-        Vec3f l = center - rayorig;
-        float tca = l.dot(raydir);
-        if (tca < 0) return false;
-        float d2 = l.dot(l) - tca * tca;
-        if (d2 > radius2) return false;
-        float thc = sqrt(radius2 - d2);
-        t0 = tca - thc;
-        t1 = tca + thc;
-
-        return true;
-    }
-};
+    RenderSettings settings;
+    Vec3f* image = new Vec3f[settings.width * settings.height];
+    // Trace rays
+    Tile full = { 0, 0, settings.width, settings.height };
+    renderTile(spheres, settings, full, image);
 
-#define MAX_RAY_DEPTH 5 
+    savePPM("./untitled.ppm", settings, image);
+    delete[] image;
+}
 
-float mix(const float& a, const float& b, const float& mix)
+void usage()
 {
-    return b * mix + a * (1 - mix);
+    std::cout << "usage: raytracer                                    render ./untitled.ppm locally\n"
+        "       raytracer --stats <prefix>                  same, plus per pixel ray heatmaps and histograms\n"
+        "                                                   (needs a build with -DRT_STATS)\n"
+        "       raytracer --coordinator <port> [options]    hand out tiles to remote workers\n"
+        "           --tile <pixels>        tile size (32)\n"
+        "           --timeout <seconds>    re-issue tiles not returned in time (30)\n"
+        "           --local-workers <n>    also start n workers in this process\n"
+        "           --out <file>           output image (./untitled.ppm)\n"
+        "       raytracer --worker <host> <port> [--threads <n>]\n"
+        "       raytracer --sequence <first> <last> [options]\n"
+        "           --camera-track <file>          camera to world matrix per frame\n"
+        "           --object-track <file> <sphere> move a sphere along a track (repeatable)\n"
+        "           --tile <pixels>                tile size (32)\n"
+        "           --threads <n>                  render threads (one per core)\n"
+        "           --out <pattern>                output files (frame_%04d.ppm)\n"
+        "       raytracer --regress [options]               compare every mode against trace() on the test scenes\n"
+        "           --baseline <file>       timings to check against (regression_baseline.txt)\n"
+        "           --update-baseline       store this run's timings as the baseline\n"
+        "                                   exit code: 0 pass, 1 fail, 2 images pass but no baseline to time against\n"
+        "           --report <file>         also write the report to a file\n"
+        "           --tolerance <error>     largest allowed channel error (1e-5)\n"
+        "           --min-psnr <dB>         lowest allowed PSNR (60)\n"
+        "           --time-tolerance <f>    allowed slow down against the baseline (0.25)\n"
+        "           --repeat <n>            best of n runs (3)\n"
+        "           --port <port>           localhost port for the distributed mode (5599)\n"
+        "       raytracer --denoise [options]               render a few samples per pixel and denoise them\n"
+        "           --spp <n>               samples per pixel (4)\n"
+        "           --threads <n>           render and denoise threads (one per core)\n"
+        "           --iterations <n>        a-trous passes (3)\n"
+        "           --noisy <file>          also save the image before denoising\n"
+        "           --out <file>            output image (./untitled.ppm)" << std::endl;
 }
 
-Vec3f trace(
-    const Vec3f& rayorig,
-    const Vec3f& raydir,
-    const std::vector<Sphere>& spheres,
-    const int& depth)
+int main(int argc, char** argv)
 {
-    //if (raydir.length() != 1) std::cerr << "Error " << raydir << std::endl;
-    float tnear = INFINITY;
-    const Sphere* sphere = NULL;
-    // find intersection of this ray with the sphere in the scene
-    for (unsigned i = 0; i < spheres.size(); ++i) {
-        float t0 = INFINITY, t1 = INFINITY;
-        if (spheres[i].intersect(rayorig, raydir, t0, t1)) {
-            if (t0 < 0) t0 = t1;
-            if (t0 < tnear) {
-                tnear = t0;
-                sphere = &spheres[i];
-            }
+    //srand48(13);
+    std::vector<Sphere> spheres;
+    buildScene("default", spheres);
+
+    if (argc == 1) {
+        render(spheres);
+        return 0;
+    }
+
+    std::string mode = argv[1];
+    if (mode == "--stats" && argc >= 3) {
+#ifdef RT_STATS
+        RenderSettings settings;
+        RayStatsBuffer stats(settings.width, settings.height);
+        settings.stats = &stats;
+        std::vector<Vec3f> image(settings.width * settings.height);
+        renderTiles(spheres, settings, makeTiles(settings, 32), image.data());
+        bool ok = savePPM("./untitled.ppm", settings, image.data());
+        ok = ok && stats.writeHeatmaps(argv[2]) && stats.writeHistograms(argv[2]);
+        return ok ? 0 : 1;
+#else
+        std::cerr << "Ray statistics are off, rebuild with -DRT_STATS" << std::endl;
+        return 1;
+#endif
+    }
+    if (mode == "--worker" && argc >= 4) {
+        unsigned threads = 0;
+        for (int i = 4; i + 1 < argc; i += 2) {
+            if (!strcmp(argv[i], "--threads")) threads = atoi(argv[i + 1]);
         }
+        return runWorker(argv[2], (unsigned short)atoi(argv[3]), threads) ? 0 : 1;
     }
-    // if there's no intersection return black or background color
-    if (!sphere) return Vec3f(2);
-    Vec3f surfaceColor = 0; // color of the ray/surfaceof the object intersected by the ray 
-    Vec3f phit = rayorig + raydir * tnear; // point of intersection 
-    Vec3f nhit = phit - sphere->center; // normal at the intersection point 
-    nhit.normalize(); // normalize normal direction 
-    // If the normal and the view direction are not opposite to each other
-    // reverse the normal direction. That also means we are inside the sphere so set
-    // the inside bool to true. Finally reverse the sign of IdotN which we want
-    // positive.
-    float bias = 1e-4; // add some bias to the point from which we will be tracing 
-    bool inside = false;
-    if (raydir.dot(nhit) > 0) nhit = -nhit, inside = true;
-    if ((sphere->transparency > 0 || sphere->reflection > 0) && depth < MAX_RAY_DEPTH) {
-        float facingratio = -raydir.dot(nhit);
-        // change the mix value to tweak the effect
-        float fresneleffect = mix(pow(1 - facingratio, 3), 1, 0.1);
-        // compute reflection direction (not need to normalize because all vectors
-        // are already normalized)
-        Vec3f refldir = raydir - nhit * 2 * raydir.dot(nhit);
-        refldir.normalize();
-        Vec3f reflection = trace(phit + nhit * bias, refldir, spheres, depth + 1);
-        Vec3f refraction = 0;
-        // if the sphere is also transparent compute refraction ray (transmission)
-        if (sphere->transparency) {
-            float ior = 1.1, eta = (inside) ? ior : 1 / ior; // are we inside or outside the surface? 
-            float cosi = -nhit.dot(raydir);
-            float k = 1 - eta * eta * (1 - cosi * cosi);
-            Vec3f refrdir = raydir * eta + nhit * (eta * cosi - sqrt(k));
-            refrdir.normalize();
-            refraction = trace(phit - nhit * bias, refrdir, spheres, depth + 1);
+    if (mode == "--coordinator" && argc >= 3) {
+        unsigned tileSize = 32, localWorkers = 0;
+        double timeout = 30;
+        std::string out = "./untitled.ppm";
+        for (int i = 3; i + 1 < argc; i += 2) {
+            if (!strcmp(argv[i], "--tile")) tileSize = std::max(1, atoi(argv[i + 1]));
+            else if (!strcmp(argv[i], "--timeout")) timeout = atof(argv[i + 1]);
+            else if (!strcmp(argv[i], "--local-workers")) localWorkers = atoi(argv[i + 1]);
+            else if (!strcmp(argv[i], "--out")) out = argv[i + 1];
         }
-        // the result is a mix of reflection and refraction (if the sphere is transparent)
-        surfaceColor = (
-            reflection * fresneleffect +
-            refraction * (1 - fresneleffect) * sphere->transparency) * sphere->surfaceColor;
+
+        RenderSettings settings;
+        std::vector<Vec3f> image(settings.width * settings.height);
+        if (!runCoordinator(spheres, settings, image.data(), (unsigned short)atoi(argv[2]), tileSize, timeout, localWorkers)) return 1;
+        return savePPM(out.c_str(), settings, image.data()) ? 0 : 1;
     }
-    else {
-        // it's a diffuse object, no need to raytrace any further
-        for (unsigned i = 0; i < spheres.size(); ++i) {
-            if (spheres[i].emissionColor.x > 0) {
-                // this is a light
-                Vec3f transmission = 1;
-                Vec3f lightDirection = spheres[i].center - phit;
-                lightDirection.normalize();
-                for (unsigned j = 0; j < spheres.size(); ++j) {
-                    if (i != j) {
-                        float t0, t1;
-                        if (spheres[j].intersect(phit + nhit * bias, lightDirection, t0, t1)) {
-                            transmission = 0;
-                            break;
-                        }
-                    }
-                }
-                surfaceColor += sphere->surfaceColor * transmission *
-                    std::max(float(0), nhit.dot(lightDirection)) * spheres[i].emissionColor;
+
+    if (mode == "--sequence" && argc >= 4) {
+        SequenceSettings sequence;
+        sequence.firstFrame = atoi(argv[2]);
+        sequence.lastFrame = std::max(sequence.firstFrame, (unsigned)atoi(argv[3]));
+        for (int i = 4; i + 1 < argc; i += 2) {
+            if (!strcmp(argv[i], "--tile")) sequence.tileSize = std::max(1, atoi(argv[i + 1]));
+            else if (!strcmp(argv[i], "--threads")) sequence.threads = atoi(argv[i + 1]);
+            else if (!strcmp(argv[i], "--out")) sequence.outPattern = argv[i + 1];
+            else if (!strcmp(argv[i], "--camera-track")) {
+                std::shared_ptr<Track> track(new Track());
+                if (!track->load(argv[i + 1])) return 1;
+                sequence.cameraTrack = track;
+            }
+            else if (!strcmp(argv[i], "--object-track") && i + 2 < argc) {
+                std::shared_ptr<Track> track(new Track());
+                if (!track->load(argv[i + 1])) return 1;
+                ObjectTrack objectTrack = { (unsigned)atoi(argv[i + 2]), 0, track };
+                sequence.objectTracks.push_back(objectTrack);
+                ++i;
             }
         }
-    }
 
-    return surfaceColor + sphere->emissionColor;
-}
+        std::shared_ptr<const std::vector<Sphere> > scene(new std::vector<Sphere>(spheres));
+        SequenceRenderer renderer(scene, RenderSettings(), sequence);
+        std::cout << "Rendering frames " << sequence.firstFrame << "-" << sequence.lastFrame
+            << ", " << renderer.framesInFlight() << " in flight" << std::endl;
+        unsigned written = renderer.run();
+        return written == sequence.lastFrame - sequence.firstFrame + 1 ? 0 : 1;
+    }
 
-void render(const std::vector<Sphere>& spheres)
-{
-    unsigned width = 640, height = 480;
-    Vec3f* image = new Vec3f[width * height], * pixel = image;
-    float invWidth = 1 / float(width), invHeight = 1 / float(height);
-    float fov = 30, aspectratio = width / float(height);
-    float angle = tan(M_PI * 0.5 * fov / 180.);
-    // Trace rays
-    for (unsigned y = 0; y < height; ++y) {
-        for (unsigned x = 0; x < width; ++x, ++pixel) {
-            float xx = (2 * ((x + 0.5) * invWidth) - 1) * angle * aspectratio;
-            float yy = (1 - 2 * ((y + 0.5) * invHeight)) * angle;
-            Vec3f raydir(xx, yy, -1);
-            raydir.normalize();
-            *pixel = trace(Vec3f(0), raydir, spheres, 0);
+    if (mode == "--regress") {
+        RegressionOptions options;
+        for (int i = 2; i < argc; ++i) {
+            if (!strcmp(argv[i], "--update-baseline")) options.updateBaseline = true;
+            else if (i + 1 >= argc) break;
+            else if (!strcmp(argv[i], "--baseline")) options.baselinePath = argv[++i];
+            else if (!strcmp(argv[i], "--report")) options.reportPath = argv[++i];
+            else if (!strcmp(argv[i], "--tolerance")) options.maxAbsError = (float)atof(argv[++i]);
+            else if (!strcmp(argv[i], "--min-psnr")) options.minPsnr = atof(argv[++i]);
+            else if (!strcmp(argv[i], "--time-tolerance")) options.timeTolerance = atof(argv[++i]);
+            else if (!strcmp(argv[i], "--repeat")) options.repeat = atoi(argv[++i]);
+            else if (!strcmp(argv[i], "--port")) options.port = (unsigned short)atoi(argv[++i]);
         }
+        RegressionHarness harness(options);
+        return harness.run();
     }
-    
-    // Save result to a PPM image (keep these flags if you compile under Windows)
-    std::ofstream ofs("./untitled.ppm", std::ios::out | std::ios::binary);
-    ofs << "P6\n" << width << " " << height << "\n255\n";
-    for (unsigned i = 0; i < width * height; ++i) {
-        ofs << (unsigned char)(std::min(float(1), image[i].x) * 255) <<
-            (unsigned char)(std::min(float(1), image[i].y) * 255) <<
-            (unsigned char)(std::min(float(1), image[i].z) * 255);
+
+    if (mode == "--denoise") {
+        RenderSettings settings;
+        settings.samples = 4;
+        DenoiseSettings denoise;
+        std::string out = "./untitled.ppm", noisy;
+        for (int i = 2; i + 1 < argc; i += 2) {
+            if (!strcmp(argv[i], "--spp")) settings.samples = std::max(1, atoi(argv[i + 1]));
+            else if (!strcmp(argv[i], "--threads")) denoise.threads = atoi(argv[i + 1]);
+            else if (!strcmp(argv[i], "--iterations")) denoise.iterations = atoi(argv[i + 1]);
+            else if (!strcmp(argv[i], "--noisy")) noisy = argv[i + 1];
+            else if (!strcmp(argv[i], "--out")) out = argv[i + 1];
+        }
+
+        FeatureBuffers features(settings.width, settings.height);
+        settings.features = &features;
+        std::vector<Vec3f> image(settings.width * settings.height), result;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        renderTiles(spheres, settings, makeTiles(settings, 32), image.data(), denoise.threads);
+        std::chrono::steady_clock::time_point rendered = std::chrono::steady_clock::now();
+        Denoiser(denoise).denoise(settings.width, settings.height, image, features, result);
+        std::chrono::steady_clock::time_point denoised = std::chrono::steady_clock::now();
+
+        double renderMs = std::chrono::duration<double, std::milli>(rendered - start).count();
+        double denoiseMs = std::chrono::duration<double, std::milli>(denoised - rendered).count();
+        std::cout << "Rendered " << settings.samples << " spp in " << renderMs << " ms, denoised in " << denoiseMs
+            << " ms (" << denoiseMs * 1e6 / (settings.width * settings.height) << " ms per megapixel)" << std::endl;
+
+        if (!noisy.empty() && !savePPM(noisy.c_str(), settings, image.data())) return 1;
+        return savePPM(out.c_str(), settings, result.data()) ? 0 : 1;
     }
-    ofs.close();
-    delete[] image;
-}
 
-int main(int argc, char** argv)
-{
-    //srand48(13);
-    std::vector<Sphere> spheres;
-    // position, radius, surface color, reflectivity, transparency, emission color
-    spheres.push_back(Sphere(Vec3f(0.0, -10004, -20), 10000, Vec3f(0.20, 0.20, 0.20), 0, 0.0));
-    spheres.push_back(Sphere(Vec3f(0.0, 0, -20), 4, Vec3f(1.00, 0.32, 0.36), 1, 0.5));
-    spheres.push_back(Sphere(Vec3f(5.0, -1, -15), 2, Vec3f(0.90, 0.76, 0.46), 1, 0.0));
-    spheres.push_back(Sphere(Vec3f(5.0, 0, -25), 3, Vec3f(0.65, 0.77, 0.97), 1, 0.0));
-    spheres.push_back(Sphere(Vec3f(-5.5, 0, -15), 3, Vec3f(0.90, 0.90, 0.90), 1, 0.0));
-    // light
-    spheres.push_back(Sphere(Vec3f(0.0, 20, -30), 3, Vec3f(0.00, 0.00, 0.00), 0, 0.0, Vec3f(3)));
-    render(spheres);
-
-    return 0;
-}
\ No newline at end of file
+    usage();
+    return 1;
+}
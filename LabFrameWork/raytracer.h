@@ -0,0 +1,528 @@
+#pragma once
+
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <fstream>
+#include <vector>
+#include <iostream>
+#include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "RayStats.h"
+
+#if defined __linux__ || defined __APPLE__
+// "Compiled for Linux
+#else
+// Windows doesn't define these values by default, Linux does
+#define M_PI 3.141592653589793
+#define INFINITY 1e8
+#endif
+
+template<typename T>
+class Vec3
+{
+public:
+    T x, y, z;
+    Vec3() : x(T(0)), y(T(0)), z(T(0)) {}
+    Vec3(T xx) : x(xx), y(xx), z(xx) {}
+    Vec3(T xx, T yy, T zz) : x(xx), y(yy), z(zz) {}
+    Vec3& normalize()
+    {
+        T nor2 = length2();
+        if (nor2 > 0) {
+            T invNor = 1 / sqrt(nor2);
+            x *= invNor, y *= invNor, z *= invNor;
+        }
+        return *this;
+    }
+    Vec3<T> operator * (const T& f) const { return Vec3<T>(x * f, y * f, z * f); }
+    Vec3<T> operator * (const Vec3<T>& v) const { return Vec3<T>(x * v.x, y * v.y, z * v.z); }
+    T dot(const Vec3<T>& v) const { return x * v.x + y * v.y + z * v.z; }
+    Vec3<T> operator - (const Vec3<T>& v) const { return Vec3<T>(x - v.x, y - v.y, z - v.z); }
+    Vec3<T> operator + (const Vec3<T>& v) const { return Vec3<T>(x + v.x, y + v.y, z + v.z); }
+    Vec3<T>& operator += (const Vec3<T>& v) { x += v.x, y += v.y, z += v.z; return *this; }
+    Vec3<T>& operator *= (const Vec3<T>& v) { x *= v.x, y *= v.y, z *= v.z; return *this; }
+    Vec3<T> operator - () const { return Vec3<T>(-x, -y, -z); }
+    T length2() const { return x * x + y * y + z * z; }
+    T length() const { return sqrt(length2()); }
+    friend std::ostream& operator << (std::ostream& os, const Vec3<T>& v)
+    {
+        os << "[" << v.x << " " << v.y << " " << v.z << "]";
+        return os;
+    }
+};
+
+typedef Vec3<float> Vec3f;
+
+class Sphere
+{
+public:
+    Vec3f center;                           /// position of the sphere
+    float radius, radius2;                  /// sphere radius and radius^2
+    Vec3f surfaceColor, emissionColor;      /// surface color and emission (light)
+    float transparency, reflection;         /// surface transparency and reflectivity
+    float specular, shininess;              /// highlight of the Phong model, see tracePhong
+    Sphere(
+        const Vec3f& c,
+        const float& r,
+        const Vec3f& sc,
+        const float& refl = 0,
+        const float& transp = 0,
+        const Vec3f& ec = 0) :
+        center(c), radius(r), radius2(r* r), surfaceColor(sc), emissionColor(ec),
+        transparency(transp), reflection(refl), specular(0), shininess(1)
+    { /* empty */
+    }
+    bool intersect(const Vec3f& rayorig, const Vec3f& raydir, float& t0, float& t1) const
+    {
+        Vec3f l = center - rayorig;
+        float tca = l.dot(raydir);
+        if (tca < 0) return false;
+        float d2 = l.dot(l) - tca * tca;
+        if (d2 > radius2) return false;
+        float thc = sqrt(radius2 - d2);
+        t0 = tca - thc;
+        t1 = tca + thc;
+
+        return true;
+    }
+};
+
+#define MAX_RAY_DEPTH 5
+
+inline float mix(const float& a, const float& b, const float& mix)
+{
+    return b * mix + a * (1 - mix);
+}
+
+inline Vec3f trace(
+    const Vec3f& rayorig,
+    const Vec3f& raydir,
+    const std::vector<Sphere>& spheres,
+    const int& depth)
+{
+    //if (raydir.length() != 1) std::cerr << "Error " << raydir << std::endl;
+    float tnear = INFINITY;
+    const Sphere* sphere = NULL;
+    // find intersection of this ray with the sphere in the scene
+    for (unsigned i = 0; i < spheres.size(); ++i) {
+        float t0 = INFINITY, t1 = INFINITY;
+        RT_STAT(STAT_INTERSECTION_TESTS);
+        if (spheres[i].intersect(rayorig, raydir, t0, t1)) {
+            if (t0 < 0) t0 = t1;
+            if (t0 < tnear) {
+                tnear = t0;
+                sphere = &spheres[i];
+            }
+        }
+    }
+    // if there's no intersection return black or background color
+    if (!sphere) return Vec3f(2);
+    Vec3f surfaceColor = 0; // color of the ray/surfaceof the object intersected by the ray
+    Vec3f phit = rayorig + raydir * tnear; // point of intersection
+    Vec3f nhit = phit - sphere->center; // normal at the intersection point
+    nhit.normalize(); // normalize normal direction
+    // If the normal and the view direction are not opposite to each other
+    // reverse the normal direction. That also means we are inside the sphere so set
+    // the inside bool to true. Finally reverse the sign of IdotN which we want
+    // positive.
+    float bias = 1e-4; // add some bias to the point from which we will be tracing
+    bool inside = false;
+    if (raydir.dot(nhit) > 0) nhit = -nhit, inside = true;
+    if ((sphere->transparency > 0 || sphere->reflection > 0) && depth < MAX_RAY_DEPTH) {
+        float facingratio = -raydir.dot(nhit);
+        // change the mix value to tweak the effect
+        float fresneleffect = mix(pow(1 - facingratio, 3), 1, 0.1);
+        // compute reflection direction (not need to normalize because all vectors
+        // are already normalized)
+        Vec3f refldir = raydir - nhit * 2 * raydir.dot(nhit);
+        refldir.normalize();
+        RT_STAT(STAT_REFLECTION_RAYS);
+        Vec3f reflection = trace(phit + nhit * bias, refldir, spheres, depth + 1);
+        Vec3f refraction = 0;
+        // if the sphere is also transparent compute refraction ray (transmission)
+        if (sphere->transparency) {
+            float ior = 1.1, eta = (inside) ? ior : 1 / ior; // are we inside or outside the surface?
+            float cosi = -nhit.dot(raydir);
+            float k = 1 - eta * eta * (1 - cosi * cosi);
+            Vec3f refrdir = raydir * eta + nhit * (eta * cosi - sqrt(k));
+            refrdir.normalize();
+            RT_STAT(STAT_REFRACTION_RAYS);
+            refraction = trace(phit - nhit * bias, refrdir, spheres, depth + 1);
+        }
+        // the result is a mix of reflection and refraction (if the sphere is transparent)
+        surfaceColor = (
+            reflection * fresneleffect +
+            refraction * (1 - fresneleffect) * sphere->transparency) * sphere->surfaceColor;
+    }
+    else {
+        // it's a diffuse object, no need to raytrace any further
+        for (unsigned i = 0; i < spheres.size(); ++i) {
+            if (spheres[i].emissionColor.x > 0) {
+                // this is a light
+                Vec3f transmission = 1;
+                Vec3f lightDirection = spheres[i].center - phit;
+                lightDirection.normalize();
+                RT_STAT(STAT_SHADOW_RAYS);
+                for (unsigned j = 0; j < spheres.size(); ++j) {
+                    if (i != j) {
+                        float t0, t1;
+                        RT_STAT(STAT_INTERSECTION_TESTS);
+                        if (spheres[j].intersect(phit + nhit * bias, lightDirection, t0, t1)) {
+                            transmission = 0;
+                            break;
+                        }
+                    }
+                }
+                surfaceColor += sphere->surfaceColor * transmission *
+                    std::max(float(0), nhit.dot(lightDirection)) * spheres[i].emissionColor;
+            }
+        }
+    }
+
+    return surfaceColor + sphere->emissionColor;
+}
+
+/*
+    The GPU tracer's model (RayTracing.comp), so both tracers can render the same scene and
+    be compared pixel by pixel (CrossValidation.h): spheres lit by point lights with a
+    diffuse and a Phong specular term, averaged over the lights, no shadows, no refraction.
+    A hit blends in the chain of reflections off it by its reflectivity, up to `reflectDepth`
+    of them (at most 16) and stopping at a sphere the chain already went through. Misses
+    are black. Emissive spheres are the point lights and aren't hit. The arithmetic follows
+    the shader's, down to the quadratic it solves for the spheres.
+*/
+
+#define PHONG_MAX_BOUNCES 16
+
+inline bool isLight(const Sphere& sphere)
+{
+    return sphere.emissionColor.length2() > 0;
+}
+
+// Closest sphere along the ray, `exclude` left out; -1 on a miss, the sphere goes to `index`
+inline float phongIntersect(const Vec3f& rayorig, const Vec3f& raydir, const std::vector<Sphere>& spheres, int exclude, int& index)
+{
+    float tnear = -1;
+    index = -1;
+    for (unsigned i = 0; i < spheres.size(); ++i) {
+        if ((int)i == exclude || isLight(spheres[i])) continue;
+        Vec3f eye = rayorig - spheres[i].center;
+        float a = raydir.dot(raydir);
+        float b = 2 * raydir.dot(eye);
+        float c = eye.dot(eye) - spheres[i].radius2;
+        float delta = b * b - 4 * a * c;
+        float t;
+        if (delta < 0) continue;
+        if (delta > 0) {
+            delta = sqrt(delta);
+            float t0 = (-b - delta) / (2 * a), t1 = (-b + delta) / (2 * a);
+            t = (t0 > 0) ? ((t1 > 0) ? std::min(t0, t1) : t0) : ((t1 > 0) ? t1 : -1);
+        }
+        else t = -b / (2 * a);
+        if (t != -1 && (tnear == -1 || t < tnear)) {
+            tnear = t;
+            index = i;
+        }
+    }
+    return tnear;
+}
+
+// One ray: the colour of its closest hit, black on a miss. The hit's sphere, position and
+// reflected direction go to `index`, `phit` and `refldir`. The specular highlight looks from
+// `camera` for every bounce, as the shader does.
+inline Vec3f phongRay(const Vec3f& rayorig, const Vec3f& raydir, const Vec3f& camera, const std::vector<Sphere>& spheres,
+    int exclude, int& index, Vec3f& phit, Vec3f& refldir)
+{
+    float t = phongIntersect(rayorig, raydir, spheres, exclude, index);
+    if (index < 0) return Vec3f(0);
+    const Sphere& sphere = spheres[index];
+    Vec3f local = rayorig - sphere.center + raydir * t;
+    Vec3f nhit = local;
+    nhit.normalize();
+    refldir = raydir - nhit * 2 * nhit.dot(raydir);
+    phit = local + sphere.center;
+
+    Vec3f color = 0;
+    unsigned lights = 0;
+    for (unsigned i = 0; i < spheres.size(); ++i) {
+        if (!isLight(spheres[i])) continue;
+        Vec3f toLight = spheres[i].center - phit;
+        Vec3f toCamera = camera - phit;
+        toLight.normalize();
+        toCamera.normalize();
+        float diffuse = std::max(float(0), nhit.dot(toLight));
+        float specular = 0;
+        if (nhit.dot(toLight) >= 0) {
+            Vec3f lightReflect = -toLight - nhit * 2 * nhit.dot(-toLight);
+            specular = pow(std::max(float(0), lightReflect.dot(toCamera)), sphere.shininess) * sphere.specular;
+        }
+        color += sphere.surfaceColor * spheres[i].emissionColor * (diffuse + specular);
+        ++lights;
+    }
+    return lights ? Vec3f(color.x / lights, color.y / lights, color.z / lights) : color;
+}
+
+// A primary ray from the camera and its reflections, counted in `rays`
+inline Vec3f tracePhong(const Vec3f& camera, const Vec3f& raydir, const std::vector<Sphere>& spheres, unsigned reflectDepth, unsigned long long& rays)
+{
+    int index, path[PHONG_MAX_BOUNCES + 1], pathLength = 0;
+    Vec3f phit, refldir;
+    ++rays;
+    Vec3f color = phongRay(camera, raydir, camera, spheres, -1, index, phit, refldir);
+    if (index >= 0) path[pathLength++] = index;
+    unsigned depth = std::min(reflectDepth, unsigned(PHONG_MAX_BOUNCES));
+    while (index >= 0 && depth > 0) {
+        float reflectivity = spheres[index].reflection;
+        if (reflectivity == 0) break;
+        --depth;
+        int next;
+        Vec3f nextHit, nextDir;
+        ++rays;
+        Vec3f reflection = phongRay(phit, refldir, camera, spheres, index, next, nextHit, nextDir);
+        color = color * (1 - reflectivity) + reflection * reflectivity;
+        if (next < 0 || std::find(path, path + pathLength, next) != path + pathLength) break;
+        index = next, phit = nextHit, refldir = nextDir;
+        path[pathLength++] = index;
+    }
+    return color;
+}
+
+/// 4x4 matrix stored column by column, the same layout as glm and the matrix.txt tracks
+class Matrix44f
+{
+public:
+    float m[4][4];  /// m[column][row]
+    Matrix44f()
+    {
+        for (int c = 0; c < 4; ++c)
+            for (int r = 0; r < 4; ++r) m[c][r] = (c == r) ? 1.f : 0.f;
+    }
+    Vec3f multPoint(const Vec3f& p) const
+    {
+        return Vec3f(
+            m[0][0] * p.x + m[1][0] * p.y + m[2][0] * p.z + m[3][0],
+            m[0][1] * p.x + m[1][1] * p.y + m[2][1] * p.z + m[3][1],
+            m[0][2] * p.x + m[1][2] * p.y + m[2][2] * p.z + m[3][2]);
+    }
+    Vec3f multDir(const Vec3f& d) const
+    {
+        return Vec3f(
+            m[0][0] * d.x + m[1][0] * d.y + m[2][0] * d.z,
+            m[0][1] * d.x + m[1][1] * d.y + m[2][1] * d.z,
+            m[0][2] * d.x + m[1][2] * d.y + m[2][2] * d.z);
+    }
+};
+
+/// what the primary rays hit, written next to the colour to guide the denoiser
+struct FeatureBuffers
+{
+    std::vector<Vec3f> albedo;  /// surface color of the first hit, 1 for lights and misses
+    std::vector<Vec3f> normal;  /// facing normal of the first hit, 0 for misses
+    std::vector<float> depth;   /// distance to the first hit, INFINITY for misses
+    FeatureBuffers(unsigned w, unsigned h) : albedo(w * h), normal(w * h), depth(w * h) {}
+};
+
+/// trace(), or tracePhong() for the GPU tracer's model
+enum ShadingModel
+{
+    SHADING_WHITTED,
+    SHADING_PHONG
+};
+
+/// image size and camera parameters shared by every render mode
+struct RenderSettings
+{
+    unsigned width, height;
+    float fov;
+    unsigned samples;           /// rays per pixel, 1 traces the pixel center only
+    float pixelCenter;          /// where in its pixel a single sample goes, 0 is the top left corner
+    Matrix44f cameraToWorld;    /// identity: camera at the origin looking down -z
+    FeatureBuffers* features;   /// full size feature buffers to fill, NULL to skip them
+    ShadingModel shading;
+    unsigned reflectDepth;      /// reflections tracePhong follows
+    std::atomic<unsigned long long>* rays;  /// rays tracePhong traced get added here, NULL to skip counting
+#ifdef RT_STATS
+    RayStatsBuffer* stats;      /// per pixel ray statistics, NULL to skip them
+#endif
+    RenderSettings() : width(640), height(480), fov(30), samples(1), pixelCenter(0.5f), features(NULL),
+        shading(SHADING_WHITTED), reflectDepth(10), rays(NULL)
+    {
+#ifdef RT_STATS
+        stats = NULL;
+#endif
+    }
+};
+
+/// a rectangle of pixels [x0, x1) x [y0, y1)
+struct Tile
+{
+    unsigned x0, y0, x1, y1;
+    unsigned pixelCount() const { return (x1 - x0) * (y1 - y0); }
+};
+
+// split the image in tiles of tileSize x tileSize pixels (smaller on the right/bottom border)
+inline std::vector<Tile> makeTiles(const RenderSettings& settings, unsigned tileSize)
+{
+    std::vector<Tile> tiles;
+    for (unsigned y = 0; y < settings.height; y += tileSize) {
+        for (unsigned x = 0; x < settings.width; x += tileSize) {
+            Tile tile;
+            tile.x0 = x;
+            tile.y0 = y;
+            tile.x1 = std::min(x + tileSize, settings.width);
+            tile.y1 = std::min(y + tileSize, settings.height);
+            tiles.push_back(tile);
+        }
+    }
+    return tiles;
+}
+
+// First surface along a primary ray, see FeatureBuffers
+inline void primaryFeatures(
+    const Vec3f& rayorig,
+    const Vec3f& raydir,
+    const std::vector<Sphere>& spheres,
+    Vec3f& albedo, Vec3f& normal, float& depth)
+{
+    float tnear = INFINITY;
+    const Sphere* sphere = NULL;
+    for (unsigned i = 0; i < spheres.size(); ++i) {
+        float t0 = INFINITY, t1 = INFINITY;
+        if (spheres[i].intersect(rayorig, raydir, t0, t1)) {
+            if (t0 < 0) t0 = t1;
+            if (t0 < tnear) {
+                tnear = t0;
+                sphere = &spheres[i];
+            }
+        }
+    }
+    if (!sphere) {
+        albedo = Vec3f(1), normal = Vec3f(0), depth = INFINITY;
+        return;
+    }
+    normal = rayorig + raydir * tnear - sphere->center;
+    normal.normalize();
+    if (raydir.dot(normal) > 0) normal = -normal;
+    albedo = (sphere->surfaceColor.length2() > 0) ? sphere->surfaceColor : Vec3f(1);
+    depth = tnear;
+}
+
+// Sub-pixel position of sample `s`: a hash of pixel and sample, so renders are repeatable
+inline void sampleOffset(unsigned x, unsigned y, unsigned s, double& dx, double& dy)
+{
+    unsigned h = x * 73856093u ^ y * 19349663u ^ s * 83492791u;
+    h ^= h >> 16; h *= 0x7feb352du; h ^= h >> 15; h *= 0x846ca68bu; h ^= h >> 16;
+    dx = (h & 0xffff) / 65536.0;
+    dy = (h >> 16) / 65536.0;
+}
+
+// Trace the primary rays of one tile. `pixels` points to the tile's own
+// (x1 - x0) * (y1 - y0) buffer, rows are tightly packed.
+inline void renderTile(const std::vector<Sphere>& spheres, const RenderSettings& settings, const Tile& tile, Vec3f* pixels)
+{
+    float invWidth = 1 / float(settings.width), invHeight = 1 / float(settings.height);
+    float aspectratio = settings.width / float(settings.height);
+    float angle = tan(M_PI * 0.5 * settings.fov / 180.);
+    Vec3f orig = settings.cameraToWorld.multPoint(Vec3f(0));
+    unsigned long long rays = 0;
+    Vec3f* pixel = pixels;
+    for (unsigned y = tile.y0; y < tile.y1; ++y) {
+        for (unsigned x = tile.x0; x < tile.x1; ++x, ++pixel) {
+#ifdef RT_STATS
+            RayCounters before = rayCounters();
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+#endif
+            Vec3f color = 0, albedo = 0, normal = 0;
+            float depth = 0;
+            for (unsigned s = 0; s < settings.samples; ++s) {
+                double dx = settings.pixelCenter, dy = settings.pixelCenter;
+                if (settings.samples > 1) sampleOffset(x, y, s, dx, dy);
+                float xx = (2 * ((x + dx) * invWidth) - 1) * angle * aspectratio;
+                float yy = (1 - 2 * ((y + dy) * invHeight)) * angle;
+                Vec3f raydir = settings.cameraToWorld.multDir(Vec3f(xx, yy, -1));
+                raydir.normalize();
+                RT_STAT(STAT_PRIMARY_RAYS);
+                if (settings.shading == SHADING_PHONG) color += tracePhong(orig, raydir, spheres, settings.reflectDepth, rays);
+                else color += trace(orig, raydir, spheres, 0);
+
+                if (settings.features) {
+                    Vec3f a, n;
+                    float d;
+                    primaryFeatures(orig, raydir, spheres, a, n, d);
+                    albedo += a, normal += n, depth += d;
+                }
+            }
+            if (settings.samples > 1) {
+                float invSamples = 1 / float(settings.samples);
+                color = color * invSamples, albedo = albedo * invSamples, normal = normal * invSamples, depth *= invSamples;
+            }
+            *pixel = color;
+            if (settings.features) {
+                unsigned i = y * settings.width + x;
+                settings.features->albedo[i] = albedo;
+                settings.features->normal[i] = normal;
+                settings.features->depth[i] = depth;
+            }
+#ifdef RT_STATS
+            if (settings.stats) {
+                PixelStats& stats = settings.stats->pixels[y * settings.width + x];
+                for (int c = 0; c < STAT_COUNTER_COUNT; ++c) stats.count[c] = rayCounters().count[c] - before.count[c];
+                stats.nanoseconds = (float)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            }
+#endif
+        }
+    }
+    if (settings.rays) *settings.rays += rays;
+}
+
+// copy a tile buffer into the full width * height image
+inline void storeTile(const RenderSettings& settings, const Tile& tile, const Vec3f* pixels, Vec3f* image)
+{
+    unsigned tileWidth = tile.x1 - tile.x0;
+    for (unsigned y = tile.y0; y < tile.y1; ++y) {
+        std::copy(pixels + (y - tile.y0) * tileWidth, pixels + (y - tile.y0 + 1) * tileWidth, image + y * settings.width + tile.x0);
+    }
+}
+
+// Render a list of tiles straight into the full image using `threads` threads
+// (0 means one per hardware thread). Threads pull the next tile from a shared
+// counter so a slow tile never stalls the others.
+inline void renderTiles(const std::vector<Sphere>& spheres, const RenderSettings& settings, const std::vector<Tile>& tiles, Vec3f* image, unsigned threads = 0)
+{
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    std::atomic<unsigned> next(0);
+    auto work = [&]() {
+        std::vector<Vec3f> pixels;
+        for (unsigned i = next++; i < tiles.size(); i = next++) {
+            pixels.resize(tiles[i].pixelCount());
+            renderTile(spheres, settings, tiles[i], pixels.data());
+            storeTile(settings, tiles[i], pixels.data(), image);
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; ++i) pool.push_back(std::thread(work));
+    work();
+    for (unsigned i = 0; i < pool.size(); ++i) pool[i].join();
+}
+
+// Save result to a PPM image (keep these flags if you compile under Windows)
+inline bool savePPM(const char* path, const RenderSettings& settings, const Vec3f* image)
+{
+    std::ofstream ofs(path, std::ios::out | std::ios::binary);
+    if (!ofs.good()) {
+        std::cerr << "Failed to open file: " << path << std::endl;
+        return false;
+    }
+    ofs << "P6\n" << settings.width << " " << settings.height << "\n255\n";
+    for (unsigned i = 0; i < settings.width * settings.height; ++i) {
+        ofs << (unsigned char)(std::min(float(1), image[i].x) * 255) <<
+            (unsigned char)(std::min(float(1), image[i].y) * 255) <<
+            (unsigned char)(std::min(float(1), image[i].z) * 255);
+    }
+    ofs.close();
+    return true;
+}
@@ -2,9 +2,13 @@
 in vec2 texCoord;
 
 uniform sampler2D tex;
+// part of tex the compute shader traced, stretched over the screen with bilinear filtering
+uniform vec2 uRenderScale;
 out vec4 FragColors;
 
 void main()
 {
-    FragColors = texture(tex, texCoord);
+    // half a texel inside the traced part, so the filter never reaches what lies past it
+    vec2 halfTexel = 0.5 / vec2(textureSize(tex, 0));
+    FragColors = texture(tex, min(texCoord * uRenderScale, uRenderScale - halfTexel));
 }
\ No newline at end of file
@@ -0,0 +1,65 @@
+// Camera model of RayTracing.comp, shared with Reconstruct.comp which projects through it.
+// Pixel (x, y) of a size.x by size.y image looks along rot * normalize(calcDirVector(...)),
+// the image plane sits (size.x / 2) / tan(fov / 2) pixels in front of the eye.
+
+vec3 calcDirVector(vec2 fpos, vec2 size, float fov) {
+    return vec3(
+        (size.x / 2) - fpos.x,
+        (size.y / 2) - fpos.y,
+        (size.x / 2) / tan(radians(fov / 2))
+    );
+}
+
+mat3 VectorToRotationMatrix(vec3 vec) {
+    float angle1 = atan(-vec.x, vec.z);
+	float angle2 = atan(vec.y, sqrt(vec.x * vec.x + vec.z * vec.z));
+    
+	mat3 yaw = mat3(
+		cos(angle1), 0, sin(angle1),
+		0, 1, 0,
+		-sin(angle1), 0, cos(angle1)
+	);
+
+	mat3 pitch = mat3(
+		1, 0, 0,
+		0, cos(angle2), -sin(angle2),
+		0, sin(angle2), cos(angle2)
+	);
+    
+	return yaw * pitch;
+}
+
+// Inverse of the above: the pixel position a world point shows at, false behind the eye.
+// `inverseRot` is transpose(VectorToRotationMatrix(rot)), the rotation is orthonormal.
+bool projectToPixel(vec3 point, vec3 eye, mat3 inverseRot, float fov, vec2 size, out vec2 fpos) {
+    vec3 local = inverseRot * (point - eye);
+    fpos = vec2(0);
+    if (local.z <= 0.0)
+        return false;
+    float k = (size.x / 2) / tan(radians(fov / 2)) / local.z;
+    fpos = vec2((size.x / 2) - local.x * k, (size.y / 2) - local.y * k);
+    return true;
+}
+
+// Checkerboard frames trace one pixel out of `pattern`: 2 alternates the two colours of a
+// checkerboard, 4 visits the pixels of every 2x2 block in turn, diagonal ones first.
+// patternPixel maps the invocations of a (size.x / 2) by (size.y * 2 / pattern) grid onto
+// the pixels traced in frame `frame`.
+ivec2 patternOffset(int pattern, int frame, int y) {
+    if (pattern == 2)
+        return ivec2((y + frame) & 1, 0);
+    const ivec2 order[4] = ivec2[4](ivec2(0, 0), ivec2(1, 1), ivec2(1, 0), ivec2(0, 1));
+    return order[frame & 3];
+}
+
+ivec2 patternPixel(ivec2 id, int pattern, int frame) {
+    if (pattern == 2)
+        return ivec2(2 * id.x + patternOffset(2, frame, id.y).x, id.y);
+    return 2 * id + patternOffset(4, frame, 0);
+}
+
+bool patternTraced(ivec2 pos, int pattern, int frame) {
+    if (pattern == 2)
+        return (pos.x & 1) == patternOffset(2, frame, pos.y).x;
+    return (pos & 1) == patternOffset(4, frame, 0);
+}
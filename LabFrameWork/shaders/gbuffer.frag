@@ -0,0 +1,64 @@
+#version 430 core
+
+// Tests the pixel's primary ray against the object rasterized there, exactly as
+// RayTracing.comp would, and keeps the closest hit: depth is a decreasing function of the
+// hit distance, cleared to 0 and tested with GL_GREATER.
+
+#include "mesh.glsl"
+#include "primitives.glsl"
+#include "camera.glsl"
+
+struct Camera {
+    vec3    pos;
+    vec3    rot;
+    float   fov;
+};
+
+uniform Camera uCamera;
+uniform vec2 uSize;
+uniform vec2 uJitter;
+
+flat in int vObject;
+flat in int vSlot;
+
+// normal of the hit, not normalized, and its distance along the ray
+layout (location = 0) out vec4 gHit;
+layout (location = 1) out int gObject;
+
+void main() {
+    vec3 dirVec = VectorToRotationMatrix(uCamera.rot) * normalize(calcDirVector(floor(gl_FragCoord.xy) + uJitter, uSize, uCamera.fov));
+    Object o = uObjects[vObject];
+    vec3 eye = uCamera.pos - o.pos;
+    float dist = -1.0;
+    vec3 normal = vec3(0);
+
+    switch (o.type) {
+    case 0:
+        dist = intersectSphere(uCamera.pos, dirVec, vObject);
+        normal = eye + dirVec * dist;
+        break;
+    case 1:
+        dist = intersectPlane(eye, dirVec);
+        normal = vec3(0, 1, 0);
+        break;
+    case 2:
+        dist = intersectTriangle(uCamera.pos, dirVec, vObject);
+        normal = getTriangleNormal(vObject);
+        break;
+    case 3: {
+        // in the mesh's own space, as intersectMesh() does
+        float scale = o.radius;
+        float objectHit = intersectTriangle(eye / scale, dirVec, meshVertex(vSlot, 0), meshVertex(vSlot, 1), meshVertex(vSlot, 2));
+        dist = objectHit == -1.0 ? -1.0 : objectHit * scale;
+        normal = getMeshTriangleNormal(vSlot);
+        break;
+    }
+    }
+
+    // the rasterizer's coverage is only a guess, a back face or a ray past the sphere misses
+    if (dist == -1.0)
+        discard;
+    gl_FragDepth = 1.0 / (1.0 + dist);
+    gHit = vec4(normal, dist);
+    gObject = vObject;
+}
@@ -0,0 +1,80 @@
+#version 430 core
+
+// Primary visibility of the hybrid renderer: rasterizes the ray traced scene into the G-buffer
+// (see GBuffer.h). An instanced draw covers the objects of ObjectBuffer, one instance each:
+// a triangle its triangle, a sphere its bounding box and a plane the whole screen, the rest
+// of the 36 vertices collapse. Mesh objects are drawn one by one, a triangle per BLAS leaf slot.
+
+#include "mesh.glsl"
+#include "primitives.glsl"
+#include "camera.glsl"
+
+struct Camera {
+    vec3    pos;
+    vec3    rot;
+    float   fov;
+};
+
+uniform Camera uCamera;
+uniform vec2 uSize;
+uniform vec2 uJitter;
+// the mesh object drawn and its first slot, -1 for the instanced draw
+uniform int uObject;
+uniform int uFirstSlot;
+
+flat out int vObject;
+flat out int vSlot;
+
+// closer than this the rasterizer clips, the tracer would still see it
+#define NEAR 0.001
+
+const vec3 cubeCorners[8] = vec3[8](
+    vec3(-1, -1, -1), vec3(1, -1, -1), vec3(-1, 1, -1), vec3(1, 1, -1),
+    vec3(-1, -1, 1), vec3(1, -1, 1), vec3(-1, 1, 1), vec3(1, 1, 1)
+);
+const int cubeIndices[36] = int[36](
+    0, 2, 1, 1, 2, 3,   4, 5, 6, 5, 7, 6,   0, 1, 4, 1, 5, 4,
+    2, 6, 3, 3, 6, 7,   0, 4, 2, 2, 4, 6,   1, 3, 5, 3, 7, 5
+);
+
+// Pixel (x, y) traces the ray through calcDirVector(x + uJitter.x, y + uJitter.y), it is
+// rasterized at the centre (x + 0.5, y + 0.5): projectToPixel, shifted by 0.5 - uJitter
+vec4 projectToClip(vec3 point) {
+    vec3 local = transpose(VectorToRotationMatrix(uCamera.rot)) * (point - uCamera.pos);
+    float k = (uSize.x / 2) / tan(radians(uCamera.fov / 2));
+    vec2 xy = -2.0 * k * local.xy / uSize + 2.0 * (0.5 - uJitter) * local.z / uSize;
+    // depth comes from the fragment shader, z only clips at NEAR
+    return vec4(xy, local.z - 2.0 * NEAR, local.z);
+}
+
+void main() {
+    // no triangle unless one of the cases below places it
+    gl_Position = vec4(0, 0, 0, 1);
+    vSlot = -1;
+
+    if (uObject >= 0) {
+        int slot = uFirstSlot + gl_VertexID / 3;
+        vObject = uObject;
+        vSlot = slot;
+        Object o = uObjects[uObject];
+        gl_Position = projectToClip(o.pos + meshVertex(slot, gl_VertexID % 3) * o.radius);
+        return;
+    }
+
+    vObject = gl_InstanceID;
+    Object o = uObjects[gl_InstanceID];
+    switch (o.type) {
+    case 0:
+        gl_Position = projectToClip(o.pos + cubeCorners[cubeIndices[gl_VertexID]] * o.radius);
+        break;
+    case 1:
+        // one triangle over the screen, the plane test finds where it shows
+        if (gl_VertexID < 3)
+            gl_Position = vec4(gl_VertexID == 1 ? 3 : -1, gl_VertexID == 2 ? 3 : -1, 0, 1);
+        break;
+    case 2:
+        if (gl_VertexID < 3)
+            gl_Position = projectToClip(o.pos + (gl_VertexID == 0 ? o.vert1 : gl_VertexID == 1 ? o.vert2 : o.vert3));
+        break;
+    }
+}
@@ -0,0 +1,32 @@
+// Shared by RayTracing.comp and refit.comp, which #include it (see ShaderProgram::loadShaderFromFile).
+// Each declares MeshNodeBuffer (binding 13) itself: one only reads the BLAS nodes, the other writes them.
+
+// mirrors BVHNode in BVH.h. Flattened depth first: interior nodes have count 0, their left
+// child follows them and leftFirst is the right child; leaves test objects (or mesh triangle
+// slots) leftFirst .. leftFirst + count - 1
+struct BVHNode {
+    vec3    bmin;
+    int     leftFirst;
+    vec3    bmax;
+    int     count;
+};
+
+// geometry of mesh objects (type 3): the model's own vertex and index buffers and, per BLAS
+// leaf slot, (first index, base vertex)
+layout (std430, binding = 11) readonly buffer MeshPositionBuffer {
+    float uMeshPositions[];
+};
+
+layout (std430, binding = 12) readonly buffer MeshIndexBuffer {
+    uint uMeshIndices[];
+};
+
+layout (std430, binding = 14) readonly buffer MeshTriangleBuffer {
+    ivec2 uMeshTriangles[];
+};
+
+vec3 meshVertex(int slot, int corner) {
+    ivec2 triangle = uMeshTriangles[slot];
+    int v = triangle.y + int(uMeshIndices[triangle.x + corner]);
+    return vec3(uMeshPositions[3 * v], uMeshPositions[3 * v + 1], uMeshPositions[3 * v + 2]);
+}
@@ -0,0 +1,129 @@
+// Scene objects and their ray tests, shared by RayTracing.comp and the G-buffer pass of the
+// hybrid renderer (gbuffer.vert, gbuffer.frag), which #include it after mesh.glsl. Both find
+// the same hits with the same arithmetic: the rasterizer only decides which object a pixel's
+// primary ray meets, the distance and normal come from these tests.
+
+// std430 layout, mirrored by GPUObject in RayTracingScene.h
+struct Object {
+    vec3    pos;
+    int     type;
+    vec3    vert1;
+    float   radius;
+    vec3    vert2;
+    int     material;
+    vec3    vert3;
+    int     mesh;       // BLAS root node of a mesh object
+};
+
+layout (std430, binding = 7) readonly buffer ObjectBuffer {
+    Object uObjects[];
+};
+
+// What the ray tests of spheres and triangles read, packed on their own so the loops over
+// them load nothing else: a sphere's centre and radius, a triangle's first vertex and edges
+// in world space. Indexed like uObjects, the entries of other objects go unread.
+struct Triangle {
+    vec3    vert;
+    float   pad0;
+    vec3    edge1;
+    float   pad1;
+    vec3    edge2;
+    float   pad2;
+};
+
+layout (std430, binding = 18) readonly buffer SphereBuffer {
+    vec4 uSpheres[];
+};
+
+layout (std430, binding = 19) readonly buffer TriangleBuffer {
+    Triangle uTriangles[];
+};
+
+float intersectSphere(vec3 camera, vec3 dir, float radius) {
+    float a = dir.x * dir.x + dir.y * dir.y + dir.z * dir.z;
+    float b = 2 * dir.x * camera.x + 2 * dir.y * camera.y + 2 * dir.z * camera.z;
+    float c = camera.x * camera.x + camera.y * camera.y + camera.z * camera.z - radius * radius;
+
+    float delta = b * b - 4 * a * c;
+
+    if (delta < 0)
+        return -1.0;
+    else if (delta > 0) {
+        delta = sqrt(delta);
+        float root[2];
+        root[0] = (-b - delta) / (2 * a);
+        root[1] = (-b + delta) / (2 * a);
+        if (root[0] > 0)
+            if (root[1] > 0)
+                return (root[0] > root[1]) ? root[1] : root[0];
+            else
+                return root[0];
+        else
+            return (root[1] > 0) ? root[1] : -1.0;
+    } else
+        return -b / (2 * a);
+}
+
+float intersectPlane(vec3 camera, vec3 dir) {
+    vec3    normal = vec3(0, 1, 0);
+    float   n1 = dot(normal, camera);
+    float   n2 = dot(normal, dir);
+    float   d;
+
+    if (n2 == 0)
+        return -1.0;
+    d = -n1 / n2;
+    return (d < 0) ? -1.0 : d;
+}
+
+// Edges from v1 to the other two vertices
+float intersectTriangleEdges(vec3 camera, vec3 dir, vec3 v1, vec3 e1, vec3 e2){
+    vec3 h = cross(dir, e2);
+    float a = dot(e1, h);
+    if (a < 0.00001)
+        return -1.0f;
+
+    float f = 1 / a;
+    vec3 s = camera - v1;
+    float u = f * dot(s, h);
+	if (u < 0.0 || u > 1.0)
+        return -1.0f;
+
+    vec3 q = cross(s, e1);
+    float v = f * dot(dir, q);
+	if (v < 0.0 || u + v > 1.0)
+        return -1.0f;
+
+    float t = f * dot(e2, q);
+
+    if (t > 0)
+        return t;
+    else
+        return -1.0f;
+}
+
+float intersectTriangle(vec3 camera, vec3 dir, vec3 v1, vec3 v2, vec3 v3){
+    return intersectTriangleEdges(camera, dir, v1, v2 - v1, v3 - v1);
+}
+
+// Triangle object `index` from a world space `camera`
+float intersectTriangle(vec3 camera, vec3 dir, int index){
+    return intersectTriangleEdges(camera, dir, uTriangles[index].vert, uTriangles[index].edge1, uTriangles[index].edge2);
+}
+
+// Sphere object `index` from a world space `camera`
+float intersectSphere(vec3 camera, vec3 dir, int index){
+    return intersectSphere(camera - uSpheres[index].xyz, dir, uSpheres[index].w);
+}
+
+vec3 getTriangleNormal(int index){
+    vec3 v1 = uObjects[index].vert2 - uObjects[index].vert1;
+    vec3 v2 = uObjects[index].vert3 - uObjects[index].vert1;
+
+    return cross(v1, v2);
+}
+
+vec3 getMeshTriangleNormal(int slot) {
+    vec3 v1 = meshVertex(slot, 0);
+    return cross(meshVertex(slot, 1) - v1, meshVertex(slot, 2) - v1);
+}